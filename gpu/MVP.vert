@@ -25,11 +25,14 @@
 
 #version 400
 
+// xyz is the position, w the mass
 in vec4 vp;
 in vec4 cp;
-in float mp;
+// the published state before vp
+in vec4 vp_prev;
 uniform mat4 viewMatrix;
 uniform mat4 projectionMatrix;
+uniform float interpolation;
 out vec4 color;
 out float massColor;
 
@@ -40,8 +43,10 @@ out gl_PerVertex {
 };
 
 void main () {
+  float mp = vp.w;
   color = cp;
-  vec4 position = viewMatrix * vec4 (vp);
+  vec3 interpolated = mix(vp_prev.xyz, vp.xyz, interpolation);
+  vec4 position = viewMatrix * vec4 (interpolated, 1);
   float distance = -position.z;
   gl_Position = projectionMatrix * position;
   gl_PointSize = 50 * mp / distance;
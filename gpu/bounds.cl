@@ -0,0 +1,96 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Bounding boxes over clusters of clusterSize consecutive particles and
+// groups of groupSize consecutive clusters. They are refitted bottom-up
+// after every step, which stays cheap and tight as long as the particles
+// are in Morton order.
+
+// A box is stored as lower (xyz, w = mass) and upper (xyz, w = live
+// particles) corners. Boxes without live particles have upper.w == 0.
+void emptyBox(float4* lower, float4* upper) {
+    *lower = (float4)(INFINITY, INFINITY, INFINITY, 0);
+    *upper = (float4)(-INFINITY, -INFINITY, -INFINITY, 0);
+}
+
+void growBox(float4* lower, float4* upper, float4 boxLower, float4 boxUpper) {
+    *lower = (float4)(fmin(lower->xyz, boxLower.xyz), lower->w + boxLower.w);
+    *upper = (float4)(fmax(upper->xyz, boxUpper.xyz), upper->w + boxUpper.w);
+}
+
+__kernel void refitClusters(
+  __global const float4* pos,
+  unsigned int count,
+  unsigned int clusterSize,
+  __global float4* clusters) {
+    unsigned int cluster = get_global_id(0);
+    unsigned int first = cluster * clusterSize;
+    if (first >= count)
+        return;
+    unsigned int last = min(first + clusterSize, count);
+
+    float4 lower, upper;
+    emptyBox(&lower, &upper);
+    for (unsigned int i = first; i < last; i++) {
+        float4 p = pos[i];
+        // merged particles have no mass
+        if (p.w == 0)
+            continue;
+        growBox(&lower, &upper, p, (float4)(p.xyz, 1.0f));
+    }
+    clusters[2 * cluster] = lower;
+    clusters[2 * cluster + 1] = upper;
+}
+
+// spread is the sum of the cluster diagonals of each group and the number
+// of clusters with live particles, their mean measures how well the
+// current order keeps particles close in space
+__kernel void refitGroups(
+  __global const float4* clusters,
+  unsigned int clusterCount,
+  unsigned int groupSize,
+  __global float4* groups,
+  __global float2* spread) {
+    unsigned int group = get_global_id(0);
+    unsigned int first = group * groupSize;
+    if (first >= clusterCount)
+        return;
+    unsigned int last = min(first + groupSize, clusterCount);
+
+    float4 lower, upper;
+    emptyBox(&lower, &upper);
+    float2 groupSpread = (float2)(0);
+    for (unsigned int i = first; i < last; i++) {
+        float4 clusterLower = clusters[2 * i];
+        float4 clusterUpper = clusters[2 * i + 1];
+        growBox(&lower, &upper, clusterLower, clusterUpper);
+        if (clusterUpper.w > 0)
+            groupSpread += (float2)(
+                        length(clusterUpper.xyz - clusterLower.xyz), 1.0f);
+    }
+    groups[2 * group] = lower;
+    groups[2 * group + 1] = upper;
+    spread[group] = groupSpread;
+}
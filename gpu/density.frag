@@ -0,0 +1,41 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#version 400
+
+// Adds the light of a particle to the floating point density buffer.
+// Blending is additive, so the result does not depend on draw order.
+
+in vec4 color;
+in float mass;
+
+out vec4 density;
+
+void main () {
+  vec2 offset = gl_PointCoord * 2 - 1;
+  float falloff = exp(-4 * dot(offset, offset));
+  float weight = falloff * mass;
+  density = vec4(color.rgb * weight, weight);
+};
@@ -0,0 +1,61 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#version 400
+
+// Same inputs as MVP.vert, but the point size is capped so the cost of a
+// particle does not depend on its mass or the zoom.
+
+// xyz is the position, w the mass
+in vec4 vp;
+in vec4 cp;
+// the published state before vp
+in vec4 vp_prev;
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+uniform float interpolation;
+// size of a window pixel in density buffer pixels
+uniform float resolutionScale;
+uniform float maxPointSize;
+out vec4 color;
+out float mass;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+    float gl_PointSize;
+    float gl_ClipDistance[];
+};
+
+void main () {
+  float mp = vp.w;
+  // the sprite renderer mixes heavy particles towards white
+  color = mix(cp, vec4(1,1,1,1), clamp(mp / 100, 0, 1));
+  mass = mp;
+  vec3 interpolated = mix(vp_prev.xyz, vp.xyz, interpolation);
+  vec4 position = viewMatrix * vec4 (interpolated, 1);
+  float distance = -position.z;
+  gl_Position = projectionMatrix * position;
+  gl_PointSize = clamp(50 * mp / distance * resolutionScale, 1, maxPointSize);
+};
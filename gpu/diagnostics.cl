@@ -0,0 +1,303 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "storage.cl"
+
+__constant float GRAVITY = 0.000000000066742;
+
+// Layout of the stats record, must match SimulationStats in Diagnostics.h
+#define STAT_KINETIC_ENERGY 0
+#define STAT_POTENTIAL_ENERGY 1
+#define STAT_MASS 2
+#define STAT_MOMENTUM 3
+#define STAT_ANGULAR_MOMENTUM 6
+#define STAT_CENTER_OF_MASS 9
+#define STAT_BOUNDS_MIN 12
+#define STAT_BOUNDS_MAX 15
+#define STAT_LIVE_PARTICLES 18
+#define STAT_MAX_VELOCITY 19
+#define STAT_COUNT 20
+
+// Work group tree reductions, the local size has to be a power of two.
+// The first work item writes the result of the group to out.
+void storeSum(__local float* scratch, float value, __global float* out) {
+    uint lid = get_local_id(0);
+    scratch[lid] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint offset = get_local_size(0) / 2; offset > 0; offset >>= 1) {
+        if (lid < offset)
+            scratch[lid] += scratch[lid + offset];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0)
+        *out = scratch[0];
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+void storeMin(__local float* scratch, float value, __global float* out) {
+    uint lid = get_local_id(0);
+    scratch[lid] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint offset = get_local_size(0) / 2; offset > 0; offset >>= 1) {
+        if (lid < offset)
+            scratch[lid] = fmin(scratch[lid], scratch[lid + offset]);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0)
+        *out = scratch[0];
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+void storeMax(__local float* scratch, float value, __global float* out) {
+    uint lid = get_local_id(0);
+    scratch[lid] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint offset = get_local_size(0) / 2; offset > 0; offset >>= 1) {
+        if (lid < offset)
+            scratch[lid] = fmax(scratch[lid], scratch[lid + offset]);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0)
+        *out = scratch[0];
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+// One partial stats record per work group
+__kernel void reduceStats(
+  __global float4* pos,
+  __global VelocityStorage* vel,
+  uint particleCount,
+  __global float* partials,
+  __local float* scratch)
+{
+    float mass = 0;
+    float kinetic = 0;
+    float3 momentum = (float3)(0, 0, 0);
+    float3 angularMomentum = (float3)(0, 0, 0);
+    float3 weightedPosition = (float3)(0, 0, 0);
+    float3 boundsMin = (float3)(INFINITY, INFINITY, INFINITY);
+    float3 boundsMax = (float3)(-INFINITY, -INFINITY, -INFINITY);
+    float live = 0;
+    float maxSquaredVelocity = 0;
+
+    for (uint i = get_global_id(0); i < particleCount;
+         i += get_global_size(0)) {
+        float4 p = pos[i];
+
+        // Ignore deleted particles
+        if (p.w == 0)
+            continue;
+
+        float3 v = loadVelocity(i, vel);
+        float squaredVelocity = dot(v, v);
+
+        mass += p.w;
+        kinetic += 0.5f * p.w * squaredVelocity;
+        momentum += p.w * v;
+        angularMomentum += p.w * cross(p.xyz, v);
+        weightedPosition += p.w * p.xyz;
+        boundsMin = fmin(boundsMin, p.xyz);
+        boundsMax = fmax(boundsMax, p.xyz);
+        live += 1;
+        maxSquaredVelocity = fmax(maxSquaredVelocity, squaredVelocity);
+    }
+
+    __global float* out = partials + get_group_id(0) * STAT_COUNT;
+
+    // Filled in by finalizeStats from the potential samples
+    if (get_local_id(0) == 0)
+        out[STAT_POTENTIAL_ENERGY] = 0;
+
+    storeSum(scratch, kinetic, out + STAT_KINETIC_ENERGY);
+    storeSum(scratch, mass, out + STAT_MASS);
+    storeSum(scratch, momentum.x, out + STAT_MOMENTUM);
+    storeSum(scratch, momentum.y, out + STAT_MOMENTUM + 1);
+    storeSum(scratch, momentum.z, out + STAT_MOMENTUM + 2);
+    storeSum(scratch, angularMomentum.x, out + STAT_ANGULAR_MOMENTUM);
+    storeSum(scratch, angularMomentum.y, out + STAT_ANGULAR_MOMENTUM + 1);
+    storeSum(scratch, angularMomentum.z, out + STAT_ANGULAR_MOMENTUM + 2);
+    storeSum(scratch, weightedPosition.x, out + STAT_CENTER_OF_MASS);
+    storeSum(scratch, weightedPosition.y, out + STAT_CENTER_OF_MASS + 1);
+    storeSum(scratch, weightedPosition.z, out + STAT_CENTER_OF_MASS + 2);
+    storeMin(scratch, boundsMin.x, out + STAT_BOUNDS_MIN);
+    storeMin(scratch, boundsMin.y, out + STAT_BOUNDS_MIN + 1);
+    storeMin(scratch, boundsMin.z, out + STAT_BOUNDS_MIN + 2);
+    storeMax(scratch, boundsMax.x, out + STAT_BOUNDS_MAX);
+    storeMax(scratch, boundsMax.y, out + STAT_BOUNDS_MAX + 1);
+    storeMax(scratch, boundsMax.z, out + STAT_BOUNDS_MAX + 2);
+    storeSum(scratch, live, out + STAT_LIVE_PARTICLES);
+    storeMax(scratch, maxSquaredVelocity, out + STAT_MAX_VELOCITY);
+}
+
+// Exact potential of every sampleStride-th particle against all others
+__kernel void samplePotential(
+  __global float4* pos,
+  uint particleCount,
+  uint sampleStride,
+  __global float* potentials)
+{
+    unsigned int sample = get_global_id(0);
+    unsigned int i = sample * sampleStride;
+    float potential = 0;
+
+    if (i < particleCount && pos[i].w != 0) {
+        float4 p = pos[i];
+        for (unsigned int j = 0; j < particleCount; j++) {
+            float4 other = pos[j];
+            if (other.w == 0 || j == i)
+                continue;
+
+            float3 distance = other.xyz - p.xyz;
+            float qdistance = dot(distance, distance);
+
+            // Same cutoff as the force calculation in vortex
+            if (qdistance > 0.01)
+                potential -= GRAVITY * p.w * other.w * rsqrt(qdistance);
+        }
+    }
+
+    potentials[sample] = potential;
+}
+
+// Combines the group partials and the potential samples, runs as a
+// single work item since there are only a few groups
+__kernel void finalizeStats(
+  __global float* partials,
+  uint groupCount,
+  __global float* potentials,
+  uint sampleCount,
+  float sampleScale,
+  __global float* stats)
+{
+    float result[STAT_COUNT];
+
+    for (int k = 0; k < STAT_COUNT; k++)
+        result[k] = partials[k];
+
+    for (uint group = 1; group < groupCount; group++) {
+        __global float* partial = partials + group * STAT_COUNT;
+        for (int k = 0; k < STAT_BOUNDS_MIN; k++)
+            result[k] += partial[k];
+        for (int k = STAT_BOUNDS_MIN; k < STAT_BOUNDS_MAX; k++)
+            result[k] = fmin(result[k], partial[k]);
+        for (int k = STAT_BOUNDS_MAX; k < STAT_LIVE_PARTICLES; k++)
+            result[k] = fmax(result[k], partial[k]);
+        result[STAT_LIVE_PARTICLES] += partial[STAT_LIVE_PARTICLES];
+        result[STAT_MAX_VELOCITY] =
+            fmax(result[STAT_MAX_VELOCITY], partial[STAT_MAX_VELOCITY]);
+    }
+
+    // Every pair was visited from both sides
+    float potential = 0;
+    for (uint sample = 0; sample < sampleCount; sample++)
+        potential += potentials[sample];
+    result[STAT_POTENTIAL_ENERGY] = 0.5f * sampleScale * potential;
+
+    float mass = result[STAT_MASS];
+    for (int k = STAT_CENTER_OF_MASS; k < STAT_CENTER_OF_MASS + 3; k++)
+        result[k] = mass > 0 ? result[k] / mass : 0;
+
+    result[STAT_MAX_VELOCITY] = sqrt(result[STAT_MAX_VELOCITY]);
+
+    for (int k = 0; k < STAT_COUNT; k++)
+        stats[k] = result[k];
+}
+
+// One complete stats record per system of an ensemble, systems are small
+// enough for one work item each and the potential is summed exactly
+__kernel void systemStats(
+  __global float4* pos,
+  __global VelocityStorage* vel,
+  __global const uint2* systems,
+  uint systemCount,
+  __global float* stats)
+{
+    uint system = get_global_id(0);
+    if (system >= systemCount)
+        return;
+
+    uint first = systems[system].x;
+    uint last = first + systems[system].y;
+
+    float result[STAT_COUNT];
+    for (int k = 0; k < STAT_COUNT; k++)
+        result[k] = 0;
+    for (int k = STAT_BOUNDS_MIN; k < STAT_BOUNDS_MAX; k++)
+        result[k] = INFINITY;
+    for (int k = STAT_BOUNDS_MAX; k < STAT_LIVE_PARTICLES; k++)
+        result[k] = -INFINITY;
+
+    for (uint i = first; i < last; i++) {
+        float4 p = pos[i];
+
+        // Ignore deleted particles
+        if (p.w == 0)
+            continue;
+
+        float3 v = loadVelocity(i, vel);
+        float3 angular = p.w * cross(p.xyz, v);
+        float squaredVelocity = dot(v, v);
+
+        result[STAT_KINETIC_ENERGY] += 0.5f * p.w * squaredVelocity;
+        result[STAT_MASS] += p.w;
+        for (int k = 0; k < 3; k++) {
+            float position = k == 0 ? p.x : k == 1 ? p.y : p.z;
+            float velocity = k == 0 ? v.x : k == 1 ? v.y : v.z;
+            result[STAT_MOMENTUM + k] += p.w * velocity;
+            result[STAT_CENTER_OF_MASS + k] += p.w * position;
+            result[STAT_BOUNDS_MIN + k] =
+                fmin(result[STAT_BOUNDS_MIN + k], position);
+            result[STAT_BOUNDS_MAX + k] =
+                fmax(result[STAT_BOUNDS_MAX + k], position);
+        }
+        result[STAT_ANGULAR_MOMENTUM] += angular.x;
+        result[STAT_ANGULAR_MOMENTUM + 1] += angular.y;
+        result[STAT_ANGULAR_MOMENTUM + 2] += angular.z;
+        result[STAT_LIVE_PARTICLES] += 1;
+        result[STAT_MAX_VELOCITY] =
+            fmax(result[STAT_MAX_VELOCITY], squaredVelocity);
+
+        // every pair once, with the cutoff of the vortex kernel
+        for (uint j = i + 1; j < last; j++) {
+            float4 other = pos[j];
+            float3 distance = other.xyz - p.xyz;
+            float qdistance = dot(distance, distance);
+            if (other.w == 0 || qdistance <= 0.01f)
+                continue;
+            result[STAT_POTENTIAL_ENERGY] -=
+                GRAVITY * p.w * other.w * rsqrt(qdistance);
+        }
+    }
+
+    float mass = result[STAT_MASS];
+    for (int k = STAT_CENTER_OF_MASS; k < STAT_CENTER_OF_MASS + 3; k++)
+        result[k] = mass > 0 ? result[k] / mass : 0;
+
+    result[STAT_MAX_VELOCITY] = sqrt(result[STAT_MAX_VELOCITY]);
+
+    __global float* out = stats + system * STAT_COUNT;
+    for (int k = 0; k < STAT_COUNT; k++)
+        out[k] = result[k];
+}
@@ -0,0 +1,64 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#version 400
+
+// Draws the impostor of a hierarchy node. The summed mass of the node only
+// sets its brightness, the sprite covers the projected bounds of the node,
+// like the node size the cull shader compares against lodPixels.
+
+// xyz is the center of mass, w the summed mass
+layout(location = 0) in vec4 vp;
+layout(location = 1) in vec4 cp;
+// the node, impostors are static and not interpolated
+layout(location = 2) in vec4 boundsMin;
+layout(location = 3) in vec4 boundsMax;
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+// pixels covered by a unit length at unit distance
+uniform float pixelScale;
+// color.frag mixes towards white by massColor, density.frag weights by mass
+out vec4 color;
+out float massColor;
+out float mass;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+    float gl_PointSize;
+    float gl_ClipDistance[];
+};
+
+void main () {
+  float mp = vp.w;
+  color = mix(cp, vec4(1,1,1,1), clamp(mp / 100, 0, 1));
+  // already part of color
+  massColor = 0;
+  mass = mp;
+  vec4 position = viewMatrix * vec4 (vp.xyz, 1);
+  float distance = max(-position.z, 1e-6);
+  gl_Position = projectionMatrix * position;
+  float diameter = length(boundsMax.xyz - boundsMin.xyz);
+  gl_PointSize = max(diameter * pixelScale / distance, 1);
+};
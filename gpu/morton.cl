@@ -0,0 +1,193 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "storage.cl"
+
+// Spread the lower 21 bits of x so that two zero bits follow each one
+ulong expandBits(ulong x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+__kernel void mortonKeys(
+  __global float4* pos,
+  __global ulong* keys,
+  float4 boundsMin,
+  float boundsSize,
+  uint bitsPerAxis)
+{
+    unsigned int i = get_global_id(0);
+
+    // Sort deleted particles to the end of the arrays. The bit above the
+    // curve is part of the sorted key bits, so no live key reaches it.
+    if (pos[i].w == 0) {
+        keys[i] = 1ul << (3 * bitsPerAxis);
+        return;
+    }
+
+    float cells = (float)((1 << bitsPerAxis) - 1);
+    float3 normalized =
+        clamp((pos[i].xyz - boundsMin.xyz) / boundsSize, 0.0f, 1.0f);
+
+    ulong x = (ulong)(normalized.x * cells);
+    ulong y = (ulong)(normalized.y * cells);
+    ulong z = (ulong)(normalized.z * cells);
+
+    keys[i] = expandBits(x) << 2 | expandBits(y) << 1 | expandBits(z);
+}
+
+// Stable LSD radix sort of the keys, radixBits per pass. Every work item
+// owns a block of consecutive keys and walks it serially, so the scatter
+// keeps the order within a digit without a local sort.
+#define RADIX_BITS 4
+#define RADIX (1 << RADIX_BITS)
+#define SCAN_ITEMS 256
+
+__kernel void identityOrder(
+  __global uint* order)
+{
+    unsigned int i = get_global_id(0);
+    order[i] = i;
+}
+
+__kernel void radixCount(
+  __global ulong* keys,
+  __global uint* counts,
+  uint count,
+  uint blockSize,
+  uint blockCount,
+  uint shift)
+{
+    unsigned int block = get_global_id(0);
+    if (block >= blockCount)
+        return;
+
+    uint histogram[RADIX];
+    for (int digit = 0; digit < RADIX; digit++)
+        histogram[digit] = 0;
+
+    uint end = min(count, (block + 1) * blockSize);
+    for (uint i = block * blockSize; i < end; i++)
+        histogram[(keys[i] >> shift) & (RADIX - 1)]++;
+
+    // digit major, one exclusive scan then gives every block its offsets
+    for (int digit = 0; digit < RADIX; digit++)
+        counts[digit * blockCount + block] = histogram[digit];
+}
+
+// Exclusive scan of all counts by a single work group of SCAN_ITEMS
+__kernel __attribute__((reqd_work_group_size(SCAN_ITEMS, 1, 1)))
+void radixScan(
+  __global uint* counts,
+  uint total)
+{
+    __local uint sums[SCAN_ITEMS];
+    unsigned int item = get_local_id(0);
+
+    uint chunk = (total + SCAN_ITEMS - 1) / SCAN_ITEMS;
+    uint begin = min(total, item * chunk);
+    uint end = min(total, begin + chunk);
+    uint sum = 0;
+    for (uint i = begin; i < end; i++)
+        sum += counts[i];
+    sums[item] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // inclusive scan of the chunk sums
+    for (uint offset = 1; offset < SCAN_ITEMS; offset <<= 1) {
+        uint add = item >= offset ? sums[item - offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        sums[item] += add;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    uint prefix = item > 0 ? sums[item - 1] : 0;
+    for (uint i = begin; i < end; i++) {
+        uint value = counts[i];
+        counts[i] = prefix;
+        prefix += value;
+    }
+}
+
+__kernel void radixScatter(
+  __global ulong* keys,
+  __global uint* order,
+  __global ulong* sortedKeys,
+  __global uint* sortedOrder,
+  __global uint* counts,
+  uint count,
+  uint blockSize,
+  uint blockCount,
+  uint shift)
+{
+    unsigned int block = get_global_id(0);
+    if (block >= blockCount)
+        return;
+
+    uint offsets[RADIX];
+    for (int digit = 0; digit < RADIX; digit++)
+        offsets[digit] = counts[digit * blockCount + block];
+
+    uint end = min(count, (block + 1) * blockSize);
+    for (uint i = block * blockSize; i < end; i++) {
+        ulong key = keys[i];
+        uint slot = offsets[(key >> shift) & (RADIX - 1)]++;
+        sortedKeys[slot] = key;
+        sortedOrder[slot] = order[i];
+    }
+}
+
+// Gather kernels move element order[i] of src to slot i of dst
+__kernel void gatherFloat4(
+  __global float4* src,
+  __global float4* dst,
+  __global uint* order)
+{
+    unsigned int i = get_global_id(0);
+    dst[i] = src[order[i]];
+}
+
+__kernel void gatherVelocity(
+  __global VelocityStorage* src,
+  __global VelocityStorage* dst,
+  __global uint* order)
+{
+    unsigned int i = get_global_id(0);
+    storeVelocity(loadVelocity(order[i], src), i, dst);
+}
+
+__kernel void gatherUint(
+  __global uint* src,
+  __global uint* dst,
+  __global uint* order)
+{
+    unsigned int i = get_global_id(0);
+    dst[i] = src[order[i]];
+}
@@ -0,0 +1,193 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Batched spatial queries over the cluster and group boxes refitted by
+// gpu/bounds.cl. A box is stored as lower (xyz, w = mass) and upper (xyz,
+// w = live particles) corners, boxes without live particles are skipped.
+
+// Must match the QUERY_ types in SpatialQuery.h
+#define QUERY_RANGE 0
+#define QUERY_NEAREST 1
+#define QUERY_MASS 2
+
+// Must match ParticleQuery in SpatialQuery.h
+typedef struct {
+    float x;
+    float y;
+    float z;
+    // distances are measured to the ray along this direction if it is
+    // not zero, the direction has to be normalized
+    float dx;
+    float dy;
+    float dz;
+    float radius;
+    uint type;
+    uint k;
+} Query;
+
+// Must match QueryResult in SpatialQuery.h
+typedef struct {
+    uint count;
+    float mass;
+} QueryResult;
+
+// Must match QueryHit in SpatialQuery.h
+typedef struct {
+    uint id;
+    float distance;
+} QueryHit;
+
+float queryDistance(float3 origin, float3 direction, float3 p) {
+    float3 offset = p - origin;
+    if (all(direction == (float3)(0)))
+        return length(offset);
+    float t = fmax(dot(offset, direction), 0.0f);
+    return length(offset - t * direction);
+}
+
+// no particle in the box is closer to the query than this
+float nearestInBox(float3 origin, float3 direction, float4 lower,
+                   float4 upper) {
+    if (all(direction == (float3)(0))) {
+        float3 outside = fmax(fmax(lower.xyz - origin, origin - upper.xyz),
+                              (float3)(0));
+        return length(outside);
+    }
+    // distances to a ray change at most as fast as the position
+    float3 center = 0.5f * (lower.xyz + upper.xyz);
+    float extent = length(0.5f * (upper.xyz - lower.xyz));
+    return fmax(queryDistance(origin, direction, center) - extent, 0.0f);
+}
+
+// no particle in the box is further from the query than this
+float farthestInBox(float3 origin, float3 direction, float4 lower,
+                    float4 upper) {
+    float3 center = 0.5f * (lower.xyz + upper.xyz);
+    float extent = length(0.5f * (upper.xyz - lower.xyz));
+    return queryDistance(origin, direction, center) + extent;
+}
+
+// One work item per query. Nearest queries keep the k best hits sorted
+// and shrink their search radius to the k-th distance once it is full.
+__kernel void runQueries(
+  __global const float4* pos,
+  __global const uint* ids,
+  unsigned int count,
+  unsigned int clusterSize,
+  __global const float4* clusters,
+  unsigned int clusterCount,
+  unsigned int groupSize,
+  __global const float4* groups,
+  unsigned int groupCount,
+  __global const Query* queries,
+  unsigned int queryCount,
+  __global QueryResult* results,
+  __global QueryHit* hits) {
+    unsigned int q = get_global_id(0);
+    if (q >= queryCount)
+        return;
+
+    Query query = queries[q];
+    float3 origin = (float3)(query.x, query.y, query.z);
+    float3 direction = (float3)(query.dx, query.dy, query.dz);
+    float radius = query.radius;
+    unsigned int k = min(query.k, (unsigned int)QUERY_MAX_RESULTS);
+    __global QueryHit* out = hits + q * QUERY_MAX_RESULTS;
+
+    QueryHit best[QUERY_MAX_RESULTS];
+    unsigned int found = 0;
+    float mass = 0;
+
+    for (unsigned int g = 0; g < groupCount; g++) {
+        float4 groupLower = groups[2 * g];
+        float4 groupUpper = groups[2 * g + 1];
+        if (groupUpper.w == 0
+                || nearestInBox(origin, direction, groupLower, groupUpper)
+                > radius)
+            continue;
+
+        unsigned int lastCluster = min((g + 1) * groupSize, clusterCount);
+        for (unsigned int c = g * groupSize; c < lastCluster; c++) {
+            float4 lower = clusters[2 * c];
+            float4 upper = clusters[2 * c + 1];
+            if (upper.w == 0
+                    || nearestInBox(origin, direction, lower, upper)
+                    > radius)
+                continue;
+
+            // masses of clusters entirely inside are taken as a whole
+            if (query.type == QUERY_MASS
+                    && farthestInBox(origin, direction, lower, upper)
+                    <= radius) {
+                mass += lower.w;
+                found += (unsigned int)upper.w;
+                continue;
+            }
+
+            unsigned int last = min((c + 1) * clusterSize, count);
+            for (unsigned int i = c * clusterSize; i < last; i++) {
+                float4 p = pos[i];
+                if (p.w == 0)
+                    continue;
+                float distance = queryDistance(origin, direction, p.xyz);
+                if (distance > radius)
+                    continue;
+
+                if (query.type == QUERY_MASS) {
+                    mass += p.w;
+                    found++;
+                } else if (query.type == QUERY_RANGE) {
+                    if (found < QUERY_MAX_RESULTS) {
+                        out[found].id = ids[i];
+                        out[found].distance = distance;
+                    }
+                    mass += p.w;
+                    found++;
+                } else if (k > 0) {
+                    // insertion into the sorted k best
+                    unsigned int slot = min(found, k - 1);
+                    if (found == k && distance >= best[slot].distance)
+                        continue;
+                    while (slot > 0 && best[slot - 1].distance > distance) {
+                        best[slot] = best[slot - 1];
+                        slot--;
+                    }
+                    best[slot].id = ids[i];
+                    best[slot].distance = distance;
+                    if (found < k)
+                        found++;
+                    if (found == k)
+                        radius = best[k - 1].distance;
+                }
+            }
+        }
+    }
+
+    if (query.type == QUERY_NEAREST)
+        for (unsigned int i = 0; i < found; i++)
+            out[i] = best[i];
+    results[q].count = found;
+    results[q].mass = mass;
+}
@@ -0,0 +1,47 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#version 400
+
+// Upscales the density buffer to the window, adds bloom from its coarser
+// mip levels and maps the unbounded light to the displayable range.
+
+in vec2 uv;
+uniform sampler2D density;
+uniform float exposure;
+uniform float bloom;
+
+out vec4 frag_colour;
+
+void main () {
+  vec3 light = texture(density, uv).rgb;
+
+  vec3 glow = vec3(0);
+  for (int level = 1; level <= 4; level++)
+    glow += textureLod(density, uv, level).rgb / level;
+
+  vec3 hdr = (light + bloom * glow) * exposure;
+  frag_colour = vec4(vec3(1) - exp(-hdr), 1);
+};
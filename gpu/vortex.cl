@@ -26,35 +26,50 @@
 
 // #pragma OPENCL EXTENSION cl_khr_fp64 : enable
 
-__constant float GRAVITY = 0.000000000066742;
+#include "storage.cl"
 
-__kernel void vortex(
-  __global float4* pos,
-  __global float4* color,
-  __global float* masses,
-  __global float4* vel,
-  float dt)
-{
-    unsigned int i = get_global_id(0);
-    unsigned int particle_count = get_global_size(0);
+// the same binary must round every sum the same way, see DETERMINISTIC
+#ifdef DETERMINISTIC
+#pragma OPENCL FP_CONTRACT OFF
+#endif
 
-    float4 p = pos[i];
-    float4 v = vel[i];
-    float mass = masses[i];
+__constant float GRAVITY = 0.000000000066742;
 
-    float4 accelerationDirection = (float4)(0, 0, 0, 0);
+// A merge of absorbed into survivor, must match MergeEvent in MergeLog.h
+typedef struct {
+    uint step;
+    uint survivor;
+    uint absorbed;
+    float absorbedMass;
+    float survivorMass;
+    float x;
+    float y;
+    float z;
+} MergeEvent;
 
-    // Ignore deleted particles
-    if (mass == 0)
-      return;
+// Sums the acceleration of particle i at p by the particles in
+// [first, last) in index order. Stops at the first heavier particle close
+// enough to absorb it and returns that one, otherwise -1.
+int accelerate(
+  __global const float4* pos,
+  unsigned int i,
+  float4 p,
+  unsigned int first,
+  unsigned int last,
+  float3* accelerationDirection)
+{
+    float mass = p.w;
+    *accelerationDirection = (float3)(0, 0, 0);
 
     // Calculate gravitational force for all particles
-    for (int j = 0; j < particle_count; j++) {
+    for (int j = first; j < last; j++) {
+        float4 other = pos[j];
+
         // Ignore deleted masses, ignore gravitation to self
-        if (masses[j] == 0  || j == i)
+        if (other.w == 0  || j == i)
           continue;
 
-        float4 distance = pos[j] - p;
+        float3 distance = other.xyz - p.xyz;
         float qdistance = dot(distance, distance);
 
         // Ignore 0 distances
@@ -62,33 +77,311 @@ __kernel void vortex(
             continue;
 
         if (qdistance > 0.01) {
-          float acceleration = GRAVITY * masses[j] / qdistance;
-          accelerationDirection += normalize(distance) * acceleration;
+          float acceleration = GRAVITY * other.w / qdistance;
+          *accelerationDirection += normalize(distance) * acceleration;
         }
 
         // Merge small particle into big if distance is short enough
         if (
-            //length(distance) < (masses[j]+masses[i]) * 0.00015 &&
+            //length(distance) < (other.w+mass) * 0.00015 &&
             qdistance < 0.0001 &&
-            masses[i] < masses[j]) {
-                  masses[j] += masses[i];
-                  // Use small particle velocity on big
-                  vel[j] += vel[i] * masses[i] / masses[j];
-                  // Delete small particle
-                  masses[i] = 0;
-                  return;
-        }
+            mass < other.w)
+                  return j;
+    }
+    return -1;
+}
+
+// pos.w holds the particle mass, velocities are packed triples.
+// Particle i interacts with the particles in [first, last). Returns the
+// particle i merged into, or -1.
+int integrate(
+  __global float4* pos,
+  __global VelocityStorage* vel,
+  unsigned int i,
+  unsigned int first,
+  unsigned int last,
+  float dt)
+{
+    float4 p = pos[i];
+    float3 v = loadVelocity(i, vel);
+    float mass = p.w;
+
+    float3 accelerationDirection;
+
+    // Ignore deleted particles
+    if (mass == 0)
+      return -1;
+
+    int j = accelerate(pos, i, p, first, last, &accelerationDirection);
+    if (j >= 0) {
+        pos[j].w += mass;
+        // Use small particle velocity on big
+        storeVelocity(loadVelocity(j, vel) + v * mass / pos[j].w, j, vel);
+        // Delete small particle
+        pos[i].w = 0;
+        return j;
     }
 
     // Calculate new velocity with acceleration
     v += accelerationDirection*dt;
-    v.w = 1;
 
     // Calculate new position with velocity
-    p += v*dt;
-    p.w = 1;
+    p.xyz += v*dt;
+
+    // Update positions and velocities, the mass may have grown by merges
+    pos[i].xyz = p.xyz;
+    storeVelocity(v, i, vel);
+    return -1;
+}
+
+// Merges are appended to mergeEvents until mergeCapacity is reached,
+// mergeCount keeps counting so the host can detect the overflow
+__kernel void vortex(
+  __global float4* pos,
+  __global VelocityStorage* vel,
+  float dt,
+  __global const uint* ids,
+  __global uint* mergeCount,
+  __global MergeEvent* mergeEvents,
+  uint mergeCapacity,
+  uint step)
+{
+    unsigned int i = get_global_id(0);
+    float4 p = pos[i];
+
+    int survivor = integrate(pos, vel, i, 0, get_global_size(0), dt);
+    if (survivor < 0)
+      return;
+
+    uint slot = atomic_inc(mergeCount);
+    if (slot >= mergeCapacity)
+      return;
+
+    MergeEvent event;
+    event.step = step;
+    event.survivor = ids[survivor];
+    event.absorbed = ids[i];
+    event.absorbedMass = p.w;
+    // Approximate. Other work items may still be merging into or out of
+    // the survivor, and the merge itself is not atomic.
+    event.survivorMass = pos[survivor].w;
+    event.x = p.x;
+    event.y = p.y;
+    event.z = p.z;
+    mergeEvents[slot] = event;
+}
+
+// Deterministic mode: forces are computed from previous, a copy of the
+// positions before the step, so no work item sees another one's update.
+// Merges are only recorded in targets and the absorbed list, and applied
+// by resolveMerges in a fixed order. The result depends neither on the
+// scheduling nor on the work group size, count has to be passed because
+// the global size is rounded up to whole work groups.
+__kernel void vortexDeterministic(
+  __global float4* pos,
+  __global VelocityStorage* vel,
+  float dt,
+  uint count,
+  __global const float4* previous,
+  __global int* targets,
+  __global uint* absorbed,
+  __global uint* absorbedCount,
+  uint absorbedCapacity)
+{
+    unsigned int i = get_global_id(0);
+    if (i >= count)
+      return;
+
+    targets[i] = -1;
+    float4 p = previous[i];
+    if (p.w == 0)
+      return;
+
+    float3 accelerationDirection;
+    int j = accelerate(previous, i, p, 0, count, &accelerationDirection);
+    if (j >= 0) {
+        targets[i] = j;
+        // the order of the list is not, resolveMerges sorts it
+        uint slot = atomic_inc(absorbedCount);
+        if (slot < absorbedCapacity)
+            absorbed[slot] = i;
+        return;
+    }
+
+    float3 v = loadVelocity(i, vel) + accelerationDirection * dt;
+    pos[i].xyz = p.xyz + v * dt;
+    storeVelocity(v, i, vel);
+}
+
+// A single work item applies the merges of a step in ascending order of
+// the absorbed particle. A survivor that was absorbed itself passes the
+// mass on along the chain, which ends because masses strictly grow.
+__kernel void resolveMerges(
+  __global float4* pos,
+  __global VelocityStorage* vel,
+  uint count,
+  __global const int* targets,
+  __global uint* absorbed,
+  __global uint* absorbedCount,
+  uint absorbedCapacity,
+  __global const uint* ids,
+  __global uint* mergeCount,
+  __global MergeEvent* mergeEvents,
+  uint mergeCapacity,
+  uint step)
+{
+    uint n = *absorbedCount;
+    // an overflowing list is incomplete, all targets are scanned instead
+    bool scan = n > absorbedCapacity;
+    if (scan)
+        n = count;
+
+    // insertion sort, merges per step are few
+    for (uint k = 1; k < n && !scan; k++) {
+        uint i = absorbed[k];
+        uint l = k;
+        for (; l > 0 && absorbed[l - 1] > i; l--)
+            absorbed[l] = absorbed[l - 1];
+        absorbed[l] = i;
+    }
+
+    for (uint k = 0; k < n; k++) {
+        uint i = scan ? k : absorbed[k];
+        int j = targets[i];
+        if (j < 0)
+            continue;
+        while (targets[j] >= 0)
+            j = targets[j];
+
+        float4 p = pos[i];
+        pos[j].w += p.w;
+        storeVelocity(loadVelocity(j, vel)
+                      + loadVelocity(i, vel) * p.w / pos[j].w, j, vel);
+        pos[i].w = 0;
+
+        uint slot = (*mergeCount)++;
+        if (slot >= mergeCapacity)
+            continue;
+        MergeEvent event;
+        event.step = step;
+        event.survivor = ids[j];
+        event.absorbed = ids[i];
+        event.absorbedMass = p.w;
+        event.survivorMass = pos[j].w;
+        event.x = p.x;
+        event.y = p.y;
+        event.z = p.z;
+        mergeEvents[slot] = event;
+    }
+    *absorbedCount = 0;
+}
+
+// Lists up to capacity slots of merged particles, in no particular order
+__kernel void collectFreeSlots(
+  __global const float4* pos,
+  uint count,
+  __global uint* slots,
+  __global uint* slotCount,
+  uint capacity)
+{
+    unsigned int i = get_global_id(0);
+    if (i >= count || pos[i].w != 0)
+      return;
+
+    uint slot = atomic_inc(slotCount);
+    if (slot < capacity)
+      slots[slot] = i;
+}
+
+// Moves staged particles into the slots listed in targets
+__kernel void scatterParticles(
+  __global float4* pos,
+  __global VelocityStorage* vel,
+  __global uint* colors,
+  __global uint* ids,
+  __global const float4* stagedPos,
+  __global const VelocityStorage* stagedVel,
+  __global const uint* stagedColors,
+  __global const uint* stagedIds,
+  __global const uint* targets,
+  uint count)
+{
+    unsigned int i = get_global_id(0);
+    if (i >= count)
+      return;
+
+    uint target = targets[i];
+    pos[target] = stagedPos[i];
+    storeVelocity(loadVelocity(i, stagedVel), target, vel);
+    colors[target] = stagedColors[i];
+    ids[target] = stagedIds[i];
+}
+
+// Many independent systems packed into one buffer. systems holds the
+// offset and count of every system, systemOf the system of every particle.
+__kernel void vortexEnsemble(
+  __global float4* pos,
+  __global VelocityStorage* vel,
+  __global const uint2* systems,
+  __global const uint* systemOf,
+  uint particleCount,
+  float dt)
+{
+    unsigned int i = get_global_id(0);
+    if (i >= particleCount)
+      return;
+
+    uint2 system = systems[systemOf[i]];
+    integrate(pos, vel, i, system.x, system.x + system.y, dt);
+}
+
+// Out-of-core streaming: the acceleration of an i-block by one j-tile.
+// The first tile of a block overwrites the acceleration, later ones add.
+// Merges would need the j-tile to be written back and are not applied.
+__kernel void accumulateTile(
+  __global const float4* block,
+  uint blockOffset,
+  __global const float4* tile,
+  uint tileOffset,
+  uint tileCount,
+  uint firstTile,
+  __global float4* acceleration)
+{
+    unsigned int i = get_global_id(0);
+    float4 p = block[i];
+    float3 a = firstTile ? (float3)(0, 0, 0) : acceleration[i].xyz;
+
+    if (p.w != 0) {
+        for (uint k = 0; k < tileCount; k++) {
+            float4 other = tile[k];
+            if (other.w == 0 || tileOffset + k == blockOffset + i)
+              continue;
+
+            float3 distance = other.xyz - p.xyz;
+            float qdistance = dot(distance, distance);
+            if (qdistance > 0.01)
+                a += normalize(distance) * GRAVITY * other.w / qdistance;
+        }
+    }
+
+    acceleration[i] = (float4)(a, 0);
+}
+
+// Integrates an i-block once all j-tiles were accumulated
+__kernel void advanceBlock(
+  __global float4* block,
+  __global float* vel,
+  __global const float4* acceleration,
+  float dt)
+{
+    unsigned int i = get_global_id(0);
+    float4 p = block[i];
+    if (p.w == 0)
+      return;
+
+    float3 v = vload3(i, vel) + acceleration[i].xyz * dt;
+    p.xyz += v * dt;
 
-    // Update positions and velocities
-    pos[i] = p;
-    vel[i] = v;
+    block[i] = p;
+    vstore3(v, i, vel);
 }
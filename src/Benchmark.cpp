@@ -0,0 +1,253 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "Benchmark.h"
+#include "ReferenceSolver.h"
+#include "options.h"
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count() / 1000.0;
+}
+
+// Mean absolute difference of the angle around the z axis for particles
+// that are still alive in both states
+static double phaseError(const ReferenceSolver& reference,
+                         const std::vector<glm::vec4>& pos) {
+    double sum = 0;
+    int count = 0;
+    for (size_t i = 0; i < pos.size(); i++) {
+        if (pos[i].w == 0 || reference.mass[i] == 0)
+            continue;
+        double difference = atan2(pos[i].y, pos[i].x)
+                - atan2(reference.pos[i].y, reference.pos[i].x);
+        sum += fabs(remainder(difference, 2 * M_PI));
+        count++;
+    }
+    return count > 0 ? sum / count : 0;
+}
+
+Benchmark::Benchmark(Simulator* simulator, std::string kernelSource)
+    : simulator(simulator), kernelSource(kernelSource), reproducible(false) {
+    configs.push_back({"default", "", 1, false, false});
+    configs.push_back({"mad", "-cl-mad-enable", 1, false, false});
+    configs.push_back({"fast-math", "-cl-fast-relaxed-math", 1, false,
+                       false});
+    configs.push_back({"dt x2", "", 2, false, false});
+    configs.push_back({"dt x10", "", 10, false, false});
+    configs.push_back({"half velocity", "", 1, true, false});
+    configs.push_back({"deterministic", "", 1, false, true});
+}
+
+void Benchmark::run() {
+    // the bigger scenario goes first, later loads reuse its buffers
+    ParticleData galaxy = generateGalaxy(benchmarkParticles, benchmarkSeed);
+    runScenario("galaxy", galaxy);
+    runScenario("solar system", generateSolarSystem());
+    checkReproducibility(galaxy);
+    print();
+}
+
+void Benchmark::runScenario(const std::string& name,
+                            const ParticleData& data) {
+    size_t count = data.pos.size();
+    size_t first = results.size();
+    double duration = benchmarkSteps * slowDt;
+
+    printf("Benchmark %s: %zu particles, %d steps\n",
+           name.c_str(), count, benchmarkSteps);
+
+    // reference accelerations and trajectory
+    ReferenceSolver reference;
+    reference.load(data.pos, data.vel);
+    double initialEnergy = reference.energy();
+    std::vector<glm::dvec3> referenceAccelerations(count);
+    for (size_t i = 0; i < count; i++)
+        referenceAccelerations[i] = reference.acceleration(i);
+
+    std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+    for (int step = 0; step < benchmarkSteps; step++)
+        reference.step(slowDt);
+    double referenceMs = elapsedMs(start);
+
+    results.push_back({name, "reference (double)", referenceMs, 0,
+                       fabs(reference.energy() - initialEnergy)
+                       / fabs(initialEnergy),
+                       0, false});
+
+    std::vector<glm::vec4> pos;
+    std::vector<glm::vec3> vel;
+    ReferenceSolver evaluation;
+
+    for (const BenchmarkConfig& config : configs) {
+        simulator->setHalfVelocities(config.halfVelocities);
+        simulator->setDeterministic(config.deterministic);
+        simulator->loadProgram(kernelSource, config.buildOptions);
+        simulator->loadData(data.pos, data.vel, data.color);
+        simulator->initKernel();
+
+        // forces from the velocity change of a single step
+        simulator->dt = slowDt;
+        simulator->runKernel();
+        simulator->readState(&pos, &vel);
+
+        double errorSum = 0;
+        double referenceSum = 0;
+        for (size_t i = 0; i < count; i++) {
+            // merged particles do not follow the force law
+            if (pos[i].w != data.pos[i].w)
+                continue;
+            glm::dvec3 measured =
+                    (glm::dvec3(vel[i].x, vel[i].y, vel[i].z)
+                     - glm::dvec3(data.vel[i].x, data.vel[i].y,
+                                  data.vel[i].z)) / static_cast<double>(slowDt);
+            glm::dvec3 error = measured - referenceAccelerations[i];
+            errorSum += glm::dot(error, error);
+            referenceSum += glm::dot(referenceAccelerations[i],
+                                     referenceAccelerations[i]);
+        }
+
+        // the same simulated time span with bigger steps
+        simulator->loadData(data.pos, data.vel, data.color);
+        simulator->dt = config.dtScale * slowDt;
+        int steps = duration / simulator->dt;
+
+        start = std::chrono::steady_clock::now();
+        for (int step = 0; step < steps; step++)
+            simulator->runKernel();
+        double wallMs = elapsedMs(start);
+
+        simulator->readState(&pos, &vel);
+        evaluation.load(pos, vel);
+
+        results.push_back({name, config.name, wallMs,
+                           referenceSum > 0 ? sqrt(errorSum / referenceSum) : 0,
+                           fabs(evaluation.energy() - initialEnergy)
+                           / fabs(initialEnergy),
+                           phaseError(reference, pos), false});
+    }
+
+    simulator->dt = slowDt;
+    simulator->setHalfVelocities(storeHalfVelocities);
+    simulator->setDeterministic(deterministicSimulation);
+    markPareto(first);
+}
+
+// Runs the deterministic kernel once for every entry of
+// reproducibilityGroupSizes and compares the final states bit by bit
+void Benchmark::checkReproducibility(const ParticleData& data) {
+    size_t runs = sizeof(reproducibilityGroupSizes)
+            / sizeof(reproducibilityGroupSizes[0]);
+    std::vector<glm::vec4> firstPos, pos;
+    std::vector<glm::vec3> firstVel, vel;
+
+    printf("Reproducibility: %zu deterministic runs of %d steps\n",
+           runs, benchmarkSteps);
+    simulator->setDeterministic(true);
+    simulator->loadProgram(kernelSource);
+    reproducible = true;
+    for (size_t run = 0; run < runs; run++) {
+        simulator->workGroupSize = reproducibilityGroupSizes[run];
+        simulator->loadData(data.pos, data.vel, data.color);
+        simulator->initKernel();
+        simulator->dt = slowDt;
+        for (int step = 0; step < benchmarkSteps; step++)
+            simulator->runKernel();
+        simulator->readState(&pos, &vel);
+
+        if (run == 0) {
+            firstPos = pos;
+            firstVel = vel;
+            continue;
+        }
+        bool identical =
+                memcmp(pos.data(), firstPos.data(),
+                       pos.size() * sizeof(glm::vec4)) == 0
+                && memcmp(vel.data(), firstVel.data(),
+                          vel.size() * sizeof(glm::vec3)) == 0;
+        printf("work group size %zu: %s\n", reproducibilityGroupSizes[run],
+               identical ? "identical" : "differs");
+        reproducible = reproducible && identical;
+    }
+
+    simulator->workGroupSize = 0;
+    simulator->setDeterministic(deterministicSimulation);
+}
+
+// A result is on the Pareto front if no other result of the same
+// scenario is at least as fast and at least as accurate in every metric
+void Benchmark::markPareto(size_t first) {
+    for (size_t i = first; i < results.size(); i++) {
+        const BenchmarkResult& a = results[i];
+        bool dominated = false;
+        for (size_t j = first; j < results.size() && !dominated; j++) {
+            const BenchmarkResult& b = results[j];
+            if (i == j)
+                continue;
+            bool noWorse = b.wallMs <= a.wallMs
+                    && b.forceError <= a.forceError
+                    && b.energyDrift <= a.energyDrift
+                    && b.phaseError <= a.phaseError;
+            bool better = b.wallMs < a.wallMs
+                    || b.forceError < a.forceError
+                    || b.energyDrift < a.energyDrift
+                    || b.phaseError < a.phaseError;
+            dominated = noWorse && better;
+        }
+        results[i].pareto = !dominated;
+    }
+}
+
+void Benchmark::print() {
+    printf("\n%-14s %-20s %12s %12s %12s %12s %s\n",
+           "scenario", "config", "wall ms", "force rms", "energy drift",
+           "phase", "pareto");
+    for (const BenchmarkResult& result : results) {
+        printf("%-14s %-20s %12.3f %12.3e %12.3e %12.3e %s\n",
+               result.scenario.c_str(), result.config.c_str(),
+               result.wallMs, result.forceError, result.energyDrift,
+               result.phaseError, result.pareto ? "*" : "");
+    }
+
+    // the cost of the deterministic mode next to the default one
+    for (const BenchmarkResult& result : results) {
+        if (result.config != "deterministic")
+            continue;
+        for (const BenchmarkResult& fast : results)
+            if (fast.scenario == result.scenario && fast.config == "default")
+                printf("%s: deterministic mode takes %.2fx the time\n",
+                       result.scenario.c_str(), result.wallMs / fast.wallMs);
+    }
+    printf("deterministic runs are %s\n",
+           reproducible ? "bit identical" : "NOT bit identical");
+}
@@ -0,0 +1,83 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_BENCHMARK_H_
+#define SRC_BENCHMARK_H_
+
+#include <string>
+#include <vector>
+
+#include "Simulator.h"
+#include "Scenarios.h"
+
+// A faster way of running the simulation whose accuracy is measured
+struct BenchmarkConfig {
+    std::string name;
+    // passed to the OpenCL compiler
+    std::string buildOptions;
+    // multiple of slowDt per step, the simulated time span stays the same
+    int dtScale;
+    // see Simulator::halfVelocities
+    bool halfVelocities;
+    // see Simulator::deterministic
+    bool deterministic;
+};
+
+struct BenchmarkResult {
+    std::string scenario;
+    std::string config;
+    double wallMs;
+    // relative RMS error of the accelerations in the first step
+    double forceError;
+    // relative change of the total energy over the run
+    double energyDrift;
+    // mean absolute difference of the orbit angle to the reference
+    double phaseError;
+    bool pareto;
+};
+
+// Runs fixed seed scenarios through every config and compares them
+// against a double precision direct summation.
+class Benchmark {
+ public:
+    Simulator* simulator;
+    std::string kernelSource;
+    std::vector<BenchmarkConfig> configs;
+    std::vector<BenchmarkResult> results;
+    // deterministic runs were bit identical for all work group sizes
+    bool reproducible;
+
+    Benchmark(Simulator* simulator, std::string kernelSource);
+
+    void run();
+    void runScenario(const std::string& name, const ParticleData& data);
+    void checkReproducibility(const ParticleData& data);
+    void print();
+
+ private:
+    void markPareto(size_t first);
+};
+
+#endif  // SRC_BENCHMARK_H_
@@ -0,0 +1,482 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "Catalogue.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/gtc/packing.hpp>
+
+#include "util.h"
+#include "options.h"
+
+// Header record of a Gadget format 1 snapshot, 256 bytes on disk
+struct GadgetHeader {
+    int32_t count[6];
+    double mass[6];
+    double time;
+    double redshift;
+    int32_t starFormation;
+    int32_t feedback;
+    uint32_t totalCount[6];
+    int32_t cooling;
+    int32_t fileCount;
+    double boxSize;
+};
+
+static const uint32_t gadgetHeaderSize = 256;
+// parsing a chunk smaller than this is not worth a thread
+static const size_t minimumChunkBytes = 1 << 20;
+
+double CatalogueStats::bandwidth() const {
+    return seconds > 0 ? bytes / seconds / 1.0e6 : 0;
+}
+
+// Calls work(i) for every chunk i on a thread of its own
+static void parallelChunks(int chunks, const std::function<void(int)>& work) {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < chunks; i++)
+        workers.emplace_back(work, i);
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+static int chunkCount(size_t bytes) {
+    int threads = importThreads;
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    return static_cast<int>(std::min<size_t>(
+                threads, bytes / minimumChunkBytes + 1));
+}
+
+// the same gradient generateGalaxy() colors its particles with
+static GLuint radiusColor(const glm::vec4& pos) {
+    float radius = glm::length(glm::vec2(pos.x, pos.y));
+    return glm::packUnorm4x8(glm::mix(glm::vec4(.9, .1, .1, 1),
+                                      glm::vec4(.1, .1, .9, 1),
+                                      glm::clamp(radius / 30.0f, 0.0f,
+                                                 1.0f)));
+}
+
+// Reads the length marker of the Fortran record at offset and moves
+// offset past it, 0 if the file ends first
+static uint32_t recordSize(const char* file, size_t size, size_t* offset) {
+    uint32_t marker = 0;
+    if (*offset + sizeof(marker) > size)
+        return 0;
+    memcpy(&marker, file + *offset, sizeof(marker));
+    *offset += sizeof(marker);
+    return marker;
+}
+
+// Start of the record payload at offset, which has to be expected bytes
+// long, NULL otherwise
+static const char* record(const char* file, size_t size, size_t* offset,
+                          size_t expected) {
+    size_t start = *offset;
+    uint32_t marker = recordSize(file, size, offset);
+    if (marker != expected || *offset + marker + sizeof(marker) > size) {
+        *offset = start;
+        return NULL;
+    }
+    const char* payload = file + *offset;
+    *offset += marker + sizeof(marker);
+    return payload;
+}
+
+static bool readGadget(const char* file, size_t size, ParticleData* data,
+                       CatalogueStats* stats, const CatalogueCheck& fits) {
+    size_t offset = 0;
+    const char* headerRecord = record(file, size, &offset, gadgetHeaderSize);
+    if (!headerRecord) {
+        printf("ERROR: Truncated Gadget header\n");
+        return false;
+    }
+    GadgetHeader header;
+    memcpy(&header, headerRecord, sizeof(header));
+    if (header.fileCount > 1)
+        printf("Only this file of a %d file snapshot is loaded\n",
+               header.fileCount);
+
+    // particles are sorted by type, per particle masses are only stored
+    // for the types without a fixed one
+    size_t typeFirst[7] = {0};
+    size_t massFirst[7] = {0};
+    for (int type = 0; type < 6; type++) {
+        size_t count = std::max(header.count[type], 0);
+        typeFirst[type + 1] = typeFirst[type] + count;
+        massFirst[type + 1] = massFirst[type]
+                + (header.mass[type] == 0 ? count : 0);
+    }
+    size_t count = typeFirst[6];
+
+    const char* positions = record(file, size, &offset,
+                                   count * 3 * sizeof(float));
+    const char* velocities = record(file, size, &offset,
+                                    count * 3 * sizeof(float));
+    if (!positions || !velocities) {
+        printf("ERROR: Gadget position or velocity block does not match "
+               "the %zu particles of the header\n", count);
+        return false;
+    }
+    // ids are 32 or 64 bit, the particles keep their order instead
+    size_t idOffset = offset;
+    uint32_t idBytes = recordSize(file, size, &idOffset);
+    if (idBytes == count * sizeof(uint32_t)
+            || idBytes == count * sizeof(uint64_t))
+        offset = idOffset + idBytes + sizeof(idBytes);
+    const char* masses = NULL;
+    if (massFirst[6]) {
+        masses = record(file, size, &offset, massFirst[6] * sizeof(float));
+        if (!masses) {
+            printf("ERROR: Gadget mass block missing\n");
+            return false;
+        }
+    }
+
+    static const glm::vec4 typeColors[6] = {
+        glm::vec4(.3, .5, .9, 1), glm::vec4(.9, .3, .2, 1),
+        glm::vec4(.9, .6, .2, 1), glm::vec4(.7, .7, .7, 1),
+        glm::vec4(.9, .9, .5, 1), glm::vec4(1, 1, 1, 1)
+    };
+
+    if (fits && !fits(count))
+        return false;
+    data->pos.resize(count);
+    data->vel.resize(count);
+    data->color.resize(count);
+    int chunks = chunkCount(size);
+    stats->threads = chunks;
+    parallelChunks(chunks, [&](int chunk) {
+        size_t first = count * chunk / chunks;
+        size_t last = count * (chunk + 1) / chunks;
+        int type = 0;
+        for (size_t i = first; i < last; i++) {
+            while (i >= typeFirst[type + 1])
+                type++;
+            float values[6];
+            memcpy(values, positions + i * 3 * sizeof(float),
+                   3 * sizeof(float));
+            memcpy(values + 3, velocities + i * 3 * sizeof(float),
+                   3 * sizeof(float));
+            float mass = header.mass[type];
+            if (mass == 0)
+                memcpy(&mass, masses + (massFirst[type] + i
+                                        - typeFirst[type]) * sizeof(float),
+                       sizeof(float));
+            data->pos[i] = glm::vec4(glm::vec3(values[0], values[1],
+                                               values[2])
+                                     * importPositionScale,
+                                     mass * importMassScale);
+            data->vel[i] = glm::vec3(values[3], values[4], values[5])
+                    * importVelocityScale;
+            data->color[i] = glm::packUnorm4x8(typeColors[type]);
+        }
+    });
+    stats->format = "Gadget";
+    return true;
+}
+
+static bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == ',' || c == ';' || c == '\r';
+}
+
+static bool startsRecord(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+}
+
+// Decimal number without going through the locale or needing a
+// terminating zero. Up to 19 significant digits are kept, plenty for a
+// float. Returns the end of the number or NULL.
+static const char* parseFloat(const char* p, const char* end, float* value) {
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa)
+                digits++;
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa)
+                    digits++;
+                exponent--;
+            }
+        }
+    }
+    if (!any)
+        return NULL;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool negativeExponent = false;
+        if (e < end && (*e == '-' || *e == '+'))
+            negativeExponent = *e++ == '-';
+        int written = 0;
+        bool exponentDigits = false;
+        for (; e < end && *e >= '0' && *e <= '9'; e++) {
+            exponentDigits = true;
+            written = std::min(written * 10 + (*e - '0'), 1000);
+        }
+        if (exponentDigits) {
+            exponent += negativeExponent ? -written : written;
+            p = e;
+        }
+    }
+
+    double result = static_cast<double>(mantissa);
+    if (exponent >= 0 && exponent <= 22)
+        result *= powers[exponent];
+    else if (exponent < 0 && exponent >= -22)
+        result /= powers[-exponent];
+    else
+        result *= std::pow(10.0, exponent);
+    *value = static_cast<float>(negative ? -result : result);
+    return p;
+}
+
+// Parses up to capacity values of the line starting at p, moves p to the
+// start of the next line and returns the number of values
+static int parseLine(const char** line, const char* end, float* values,
+                     int capacity) {
+    const char* p = *line;
+    int count = 0;
+    while (p < end && *p != '\n') {
+        if (isSeparator(*p)) {
+            p++;
+            continue;
+        }
+        const char* next = count < capacity
+                ? parseFloat(p, end, &values[count]) : NULL;
+        if (next) {
+            count++;
+            p = next;
+        } else {
+            // trailing columns and anything unparsable are skipped
+            while (p < end && *p != '\n' && !isSeparator(*p))
+                p++;
+        }
+    }
+    *line = p < end ? p + 1 : end;
+    return count;
+}
+
+// First character of the next line with a record in [p, end)
+static const char* nextRecord(const char* p, const char* end) {
+    while (p < end) {
+        const char* start = p;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p < end && startsRecord(*p))
+            return start;
+        while (p < end && *p != '\n')
+            p++;
+        if (p < end)
+            p++;
+    }
+    return end;
+}
+
+static bool readText(const char* file, size_t size, ParticleData* data,
+                     CatalogueStats* stats, const CatalogueCheck& fits) {
+    const char* end = file + size;
+
+    // every chunk starts at a line, so no record is split between two
+    int chunks = chunkCount(size);
+    std::vector<const char*> bounds(chunks + 1, end);
+    bounds[0] = file;
+    for (int i = 1; i < chunks; i++) {
+        const char* p = std::max(file + size * i / chunks, bounds[i - 1]);
+        while (p < end && p[-1] != '\n')
+            p++;
+        bounds[i] = p;
+    }
+    stats->threads = chunks;
+
+    // count first, so every chunk knows where its particles go
+    std::vector<size_t> first(chunks + 1, 0);
+    parallelChunks(chunks, [&](int chunk) {
+        size_t records = 0;
+        const char* chunkEnd = bounds[chunk + 1];
+        for (const char* p = nextRecord(bounds[chunk], chunkEnd);
+             p < chunkEnd; p = nextRecord(p, chunkEnd)) {
+            records++;
+            while (p < chunkEnd && *p != '\n')
+                p++;
+        }
+        first[chunk + 1] = records;
+    });
+    for (int i = 0; i < chunks; i++)
+        first[i + 1] += first[i];
+    size_t count = first[chunks];
+    if (count == 0) {
+        printf("ERROR: No particles found\n");
+        return false;
+    }
+
+    // the first record decides the columns
+    float values[7];
+    const char* firstLine = nextRecord(file, end);
+    int columns = parseLine(&firstLine, end, values, 7);
+    if (columns != 3 && columns != 4 && columns != 6 && columns != 7) {
+        printf("ERROR: Expected x y z [vx vy vz] [mass], found %d "
+               "columns\n", columns);
+        return false;
+    }
+    bool hasVelocity = columns >= 6;
+    bool hasMass = columns == 4 || columns == 7;
+    int massColumn = columns - 1;
+
+    if (fits && !fits(count))
+        return false;
+    data->pos.resize(count);
+    data->vel.resize(count);
+    data->color.resize(count);
+    // records with missing values are skipped, every chunk packs its
+    // particles to the front of its range
+    std::vector<size_t> malformed(chunks, 0);
+    parallelChunks(chunks, [&](int chunk) {
+        const char* chunkEnd = bounds[chunk + 1];
+        size_t i = first[chunk];
+        for (const char* p = nextRecord(bounds[chunk], chunkEnd);
+             p < chunkEnd; p = nextRecord(p, chunkEnd)) {
+            float line[7] = {0};
+            if (parseLine(&p, chunkEnd, line, columns) < columns) {
+                malformed[chunk]++;
+                continue;
+            }
+            glm::vec4 pos(glm::vec3(line[0], line[1], line[2])
+                          * importPositionScale,
+                          hasMass ? line[massColumn] * importMassScale
+                                  : importDefaultMass);
+            data->pos[i] = pos;
+            data->vel[i] = hasVelocity
+                    ? glm::vec3(line[3], line[4], line[5])
+                      * importVelocityScale
+                    : glm::vec3(0);
+            data->color[i] = radiusColor(pos);
+            i++;
+        }
+    });
+
+    // close the gaps the skipped records left
+    size_t loaded = 0;
+    for (int chunk = 0; chunk < chunks; chunk++) {
+        size_t begin = first[chunk];
+        size_t last = first[chunk + 1] - malformed[chunk];
+        if (loaded != begin) {
+            std::move(data->pos.begin() + begin, data->pos.begin() + last,
+                      data->pos.begin() + loaded);
+            std::move(data->vel.begin() + begin, data->vel.begin() + last,
+                      data->vel.begin() + loaded);
+            std::move(data->color.begin() + begin,
+                      data->color.begin() + last,
+                      data->color.begin() + loaded);
+        }
+        loaded += last - begin;
+        stats->malformed += malformed[chunk];
+    }
+    data->pos.resize(loaded);
+    data->vel.resize(loaded);
+    data->color.resize(loaded);
+    stats->format = "text";
+    return true;
+}
+
+bool loadCatalogue(const char* fileName, ParticleData* data,
+                   CatalogueStats* stats, const CatalogueCheck& fits) {
+    double start = currentTime();
+    *stats = CatalogueStats();
+
+    int file = open(fileName, O_RDONLY);
+    struct stat info;
+    if (file < 0 || fstat(file, &info) != 0) {
+        printf("ERROR: Could not open %s. %s\n", fileName, strerror(errno));
+        if (file >= 0)
+            close(file);
+        return false;
+    }
+    size_t size = info.st_size;
+    if (size == 0) {
+        printf("ERROR: %s is empty\n", fileName);
+        close(file);
+        return false;
+    }
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) {
+        printf("ERROR: Could not map %s. %s\n", fileName, strerror(errno));
+        return false;
+    }
+    // every chunk is read front to back, let the kernel read ahead
+    madvise(mapping, size, MADV_WILLNEED);
+
+    const char* contents = static_cast<const char*>(mapping);
+    uint32_t marker = 0;
+    if (size >= sizeof(marker))
+        memcpy(&marker, contents, sizeof(marker));
+    bool loaded = marker == gadgetHeaderSize
+            ? readGadget(contents, size, data, stats, fits)
+            : readText(contents, size, data, stats, fits);
+    munmap(mapping, size);
+
+    stats->bytes = size;
+    stats->particles = data->pos.size();
+    stats->seconds = currentTime() - start;
+    return loaded;
+}
@@ -0,0 +1,65 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_CATALOGUE_H_
+#define SRC_CATALOGUE_H_
+
+#include <stddef.h>
+
+#include <functional>
+
+#include "Scenarios.h"
+
+// How the last import went
+struct CatalogueStats {
+    const char* format = "";
+    size_t bytes = 0;
+    size_t particles = 0;
+    // lines with fewer values than the first record, they are skipped
+    size_t malformed = 0;
+    int threads = 0;
+    double seconds = 0;
+
+    // MB per second of file read and parsed
+    double bandwidth() const;
+};
+
+// Decides from the particle count of the file whether its particles may be
+// allocated at all, an empty one accepts every count
+typedef std::function<bool(size_t count)> CatalogueCheck;
+
+// Initial conditions from an external file. A Gadget format 1 snapshot is
+// recognised by its 256 byte header record, anything else is read as text
+// with x y z [vx vy vz] [mass] per line, separated by whitespace or
+// commas, skipping lines that do not start with a number. The file is
+// memory mapped and parsed in chunks on importThreads threads, each
+// writing straight into its range of the arrays handed to loadData. fits
+// runs on the count from the Gadget header or the counting pass over the
+// text, before any particle is allocated.
+bool loadCatalogue(const char* fileName, ParticleData* data,
+                   CatalogueStats* stats,
+                   const CatalogueCheck& fits = CatalogueCheck());
+
+#endif  // SRC_CATALOGUE_H_
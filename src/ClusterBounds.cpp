@@ -0,0 +1,169 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "ClusterBounds.h"
+
+#include <stdio.h>
+#include <string>
+
+#include "MemoryTracker.h"
+#include "util.h"
+#include "options.h"
+
+ClusterBounds::ClusterBounds(Simulator* simulator)
+    : clusterCount(0),
+      groupCount(0),
+      baselineSpread(0),
+      spread(0),
+      simulator(simulator),
+      capacity(0),
+      pending(false),
+      baselineGeneration(~0ul) {
+    program = simulator->buildProgram(readFile("gpu/bounds.cl"));
+    try {
+        refitClustersKernel = cl::Kernel(program, "refitClusters");
+        refitGroupsKernel = cl::Kernel(program, "refitGroups");
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+}
+
+ClusterBounds::~ClusterBounds() {}
+
+void ClusterBounds::allocateBuffers() {
+    if (simulator->particleCount <= capacity)
+        return;
+
+    capacity = simulator->particleCount;
+    int clusters = (capacity + boundsClusterSize - 1) / boundsClusterSize;
+    int groups = (clusters + boundsGroupSize - 1) / boundsGroupSize;
+    clusterBuffer = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                               2 * clusters * sizeof(cl_float4));
+    groupBuffer = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                             2 * groups * sizeof(cl_float4));
+    spreadBuffer = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                              groups * sizeof(cl_float2));
+    spreads.resize(groups);
+    memoryTracker.track("cluster bounds", CL_MEMORY,
+                        2 * (clusters + groups) * sizeof(cl_float4)
+                        + groups * sizeof(cl_float2));
+}
+
+void ClusterBounds::afterStep(Simulator* simulator) {
+    cl_uint particleCount = simulator->particleCount;
+    if (particleCount == 0)
+        return;
+
+    try {
+        // the spread buffer may still be read from
+        if (pending && particleCount > static_cast<cl_uint>(capacity))
+            readSpread();
+        allocateBuffers();
+        clusterCount = (particleCount + boundsClusterSize - 1)
+                / boundsClusterSize;
+        groupCount = (clusterCount + boundsGroupSize - 1) / boundsGroupSize;
+
+        refitClustersKernel.setArg(0, simulator->positionBuffer);
+        refitClustersKernel.setArg(1, particleCount);
+        refitClustersKernel.setArg(2, boundsClusterSize);
+        refitClustersKernel.setArg(3, clusterBuffer);
+        simulator->queue.enqueueNDRangeKernel(
+                    refitClustersKernel, cl::NullRange,
+                    cl::NDRange(clusterCount), cl::NullRange);
+
+        refitGroupsKernel.setArg(0, clusterBuffer);
+        refitGroupsKernel.setArg(1, clusterCount);
+        refitGroupsKernel.setArg(2, boundsGroupSize);
+        refitGroupsKernel.setArg(3, groupBuffer);
+        refitGroupsKernel.setArg(4, spreadBuffer);
+        simulator->queue.enqueueNDRangeKernel(
+                    refitGroupsKernel, cl::NullRange,
+                    cl::NDRange(groupCount), cl::NullRange);
+
+        if (!pending && simulator->stepCount % boundsCheckInterval == 0) {
+            simulator->queue.enqueueReadBuffer(
+                        spreadBuffer, CL_FALSE, 0,
+                        groupCount * sizeof(cl_float2), spreads.data(),
+                        NULL, &readEvent);
+            pending = true;
+        }
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+}
+
+void ClusterBounds::readSpread() {
+    readEvent.wait();
+    pending = false;
+
+    double diagonals = 0;
+    double clusters = 0;
+    for (cl_uint i = 0; i < groupCount; i++) {
+        diagonals += spreads[i].s[0];
+        clusters += spreads[i].s[1];
+    }
+    if (clusters == 0)
+        return;
+    spread = diagonals / clusters;
+    if (baselineSpread == 0)
+        baselineSpread = spread;
+}
+
+bool ClusterBounds::needsRebuild() {
+    if (simulator->orderGeneration != baselineGeneration)
+        return true;
+
+    if (!pending)
+        return false;
+    // the reorder changes the summation order, so a deterministic run has
+    // to decide at the step the spread was measured
+    if (simulator->deterministic)
+        readEvent.wait();
+    else if (readEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>()
+             != CL_COMPLETE)
+        return false;
+    readSpread();
+    if (spread <= reorderSpreadThreshold * baselineSpread)
+        return false;
+
+    printf("step %lu: mean cluster diagonal grew from %g to %g, "
+           "reordering\n", simulator->stepCount, baselineSpread, spread);
+    return true;
+}
+
+void ClusterBounds::rebuilt() {
+    // a read still in flight measured the old order
+    if (pending) {
+        readEvent.wait();
+        pending = false;
+    }
+    // the next measurement becomes the baseline
+    baselineSpread = 0;
+    baselineGeneration = simulator->orderGeneration;
+}
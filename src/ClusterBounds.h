@@ -0,0 +1,79 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_CLUSTERBOUNDS_H_
+#define SRC_CLUSTERBOUNDS_H_
+
+#include <vector>
+
+#include "Simulator.h"
+
+// Bounding boxes and masses of clusters of consecutive particles and of
+// groups of clusters, see gpu/bounds.cl. They are refitted on the
+// simulation queue after every step in O(N) instead of being rebuilt.
+// The mean cluster diagonal is read back every boundsCheckInterval steps
+// and compared with the one right after the last Morton reorder, a full
+// reorder is only asked for once it grew past reorderSpreadThreshold.
+class ClusterBounds : public SimulationStage {
+ public:
+    cl::Program program;
+    cl::Kernel refitClustersKernel;
+    cl::Kernel refitGroupsKernel;
+
+    // a lower and an upper corner per box
+    cl::Buffer clusterBuffer;
+    cl::Buffer groupBuffer;
+    cl::Buffer spreadBuffer;
+
+    cl_uint clusterCount;
+    cl_uint groupCount;
+
+    // mean cluster diagonal after the last reorder and now
+    float baselineSpread;
+    float spread;
+
+    explicit ClusterBounds(Simulator* simulator);
+    ~ClusterBounds();
+
+    void afterStep(Simulator* simulator) override;
+    // the order changed since the last reorder or the clusters got loose
+    bool needsRebuild();
+    // call after reordering the particles
+    void rebuilt();
+
+ private:
+    Simulator* simulator;
+    int capacity;
+    std::vector<cl_float2> spreads;
+    cl::Event readEvent;
+    bool pending;
+    // the order the baseline was measured for
+    unsigned long baselineGeneration;
+
+    void allocateBuffers();
+    void readSpread();
+};
+
+#endif  // SRC_CLUSTERBOUNDS_H_
@@ -0,0 +1,336 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "CpuForces.h"
+
+#include <math.h>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_FORCES_X86
+#endif
+
+#include "options.h"
+
+static const float GRAVITY = 0.000000000066742;
+// squared distances of the force cutoff and the merge radius in vortex.cl
+static const float MIN_QDISTANCE = 0.01f;
+static const float MERGE_QDISTANCE = 0.0001f;
+
+void ParticleArrays::load(const std::vector<glm::vec4>& pos) {
+    count = pos.size();
+    paddedCount = (count + cpuForcePadding - 1)
+            / cpuForcePadding * cpuForcePadding;
+    x.assign(paddedCount, 0);
+    y.assign(paddedCount, 0);
+    z.assign(paddedCount, 0);
+    mass.assign(paddedCount, 0);
+    for (int i = 0; i < count; i++) {
+        x[i] = pos[i].x;
+        y[i] = pos[i].y;
+        z[i] = pos[i].z;
+        mass[i] = pos[i].w;
+    }
+}
+
+void ForceResult::resize(int count) {
+    ax.resize(count);
+    ay.resize(count);
+    az.resize(count);
+    mergeInto.resize(count);
+}
+
+static bool alwaysSupported() {
+    return true;
+}
+
+// Same operations as integrate() in vortex.cl, without the early exit
+static void computeScalar(const ParticleArrays& p, int first, int last,
+                          ForceResult* result) {
+    for (int i = first; i < last; i++) {
+        float ax = 0;
+        float ay = 0;
+        float az = 0;
+        int merge = -1;
+
+        for (int j = 0; j < p.paddedCount && p.mass[i] != 0; j++) {
+            float dx = p.x[j] - p.x[i];
+            float dy = p.y[j] - p.y[i];
+            float dz = p.z[j] - p.z[i];
+            float qdistance = dx * dx + dy * dy + dz * dz;
+            if (qdistance <= 0)
+                continue;
+
+            if (qdistance > MIN_QDISTANCE) {
+                float f = GRAVITY * p.mass[j]
+                        / (qdistance * sqrtf(qdistance));
+                ax += dx * f;
+                ay += dy * f;
+                az += dz * f;
+            }
+            if (merge < 0 && qdistance < MERGE_QDISTANCE
+                    && p.mass[i] < p.mass[j])
+                merge = j;
+        }
+
+        result->ax[i] = ax;
+        result->ay[i] = ay;
+        result->az[i] = az;
+        result->mergeInto[i] = merge;
+    }
+}
+
+#ifdef CPU_FORCES_X86
+// the vector kernels are dispatched at run time and only built for x86,
+// other architectures use the scalar kernel
+static bool sse42Supported() {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("sse4.2")))
+static void computeSse42(const ParticleArrays& p, int first, int last,
+                         ForceResult* result) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 threeHalves = _mm_set1_ps(1.5f);
+    const __m128 minQDistance = _mm_set1_ps(MIN_QDISTANCE);
+    const __m128 mergeQDistance = _mm_set1_ps(MERGE_QDISTANCE);
+    const __m128i none = _mm_set1_epi32(-1);
+
+    for (int i = first; i < last; i += 4) {
+        __m128 xi = _mm_loadu_ps(&p.x[i]);
+        __m128 yi = _mm_loadu_ps(&p.y[i]);
+        __m128 zi = _mm_loadu_ps(&p.z[i]);
+        __m128 mi = _mm_loadu_ps(&p.mass[i]);
+        __m128 alive = _mm_cmpneq_ps(mi, zero);
+        __m128 ax = zero;
+        __m128 ay = zero;
+        __m128 az = zero;
+        __m128i merge = none;
+
+        for (int j = 0; j < p.paddedCount; j++) {
+            __m128 mj = _mm_set1_ps(p.mass[j]);
+            __m128 dx = _mm_sub_ps(_mm_set1_ps(p.x[j]), xi);
+            __m128 dy = _mm_sub_ps(_mm_set1_ps(p.y[j]), yi);
+            __m128 dz = _mm_sub_ps(_mm_set1_ps(p.z[j]), zi);
+            __m128 q = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+                                             _mm_mul_ps(dy, dy)),
+                                  _mm_mul_ps(dz, dz));
+
+            // r = rsqrt(q) * (1.5 - 0.5 * q * rsqrt(q)^2)
+            __m128 r = _mm_rsqrt_ps(q);
+            r = _mm_mul_ps(r, _mm_sub_ps(
+                               threeHalves,
+                               _mm_mul_ps(_mm_mul_ps(half, q),
+                                          _mm_mul_ps(r, r))));
+            __m128 f = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(GRAVITY), mj),
+                                  _mm_mul_ps(r, _mm_mul_ps(r, r)));
+            // also clears the infinities of q = 0
+            f = _mm_and_ps(f, _mm_cmpgt_ps(q, minQDistance));
+            ax = _mm_add_ps(ax, _mm_mul_ps(dx, f));
+            ay = _mm_add_ps(ay, _mm_mul_ps(dy, f));
+            az = _mm_add_ps(az, _mm_mul_ps(dz, f));
+
+            __m128 near = _mm_and_ps(
+                        _mm_and_ps(_mm_cmpgt_ps(q, zero),
+                                   _mm_cmplt_ps(q, mergeQDistance)),
+                        _mm_and_ps(_mm_cmplt_ps(mi, mj), alive));
+            near = _mm_and_ps(near, _mm_castsi128_ps(
+                                  _mm_cmpeq_epi32(merge, none)));
+            merge = _mm_castps_si128(_mm_blendv_ps(
+                        _mm_castsi128_ps(merge),
+                        _mm_castsi128_ps(_mm_set1_epi32(j)), near));
+        }
+
+        _mm_storeu_ps(&result->ax[i], _mm_and_ps(ax, alive));
+        _mm_storeu_ps(&result->ay[i], _mm_and_ps(ay, alive));
+        _mm_storeu_ps(&result->az[i], _mm_and_ps(az, alive));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&result->mergeInto[i]),
+                         merge);
+    }
+}
+
+static bool avx2Supported() {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+__attribute__((target("avx2,fma")))
+static void computeAvx2(const ParticleArrays& p, int first, int last,
+                        ForceResult* result) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    const __m256 minQDistance = _mm256_set1_ps(MIN_QDISTANCE);
+    const __m256 mergeQDistance = _mm256_set1_ps(MERGE_QDISTANCE);
+    const __m256i none = _mm256_set1_epi32(-1);
+
+    for (int i = first; i < last; i += 8) {
+        __m256 xi = _mm256_loadu_ps(&p.x[i]);
+        __m256 yi = _mm256_loadu_ps(&p.y[i]);
+        __m256 zi = _mm256_loadu_ps(&p.z[i]);
+        __m256 mi = _mm256_loadu_ps(&p.mass[i]);
+        __m256 alive = _mm256_cmp_ps(mi, zero, _CMP_NEQ_OQ);
+        __m256 ax = zero;
+        __m256 ay = zero;
+        __m256 az = zero;
+        __m256i merge = none;
+
+        for (int j = 0; j < p.paddedCount; j++) {
+            __m256 mj = _mm256_set1_ps(p.mass[j]);
+            __m256 dx = _mm256_sub_ps(_mm256_set1_ps(p.x[j]), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_set1_ps(p.y[j]), yi);
+            __m256 dz = _mm256_sub_ps(_mm256_set1_ps(p.z[j]), zi);
+            __m256 q = _mm256_fmadd_ps(
+                        dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+            __m256 r = _mm256_rsqrt_ps(q);
+            r = _mm256_mul_ps(r, _mm256_fnmadd_ps(
+                                  _mm256_mul_ps(half, q), _mm256_mul_ps(r, r),
+                                  threeHalves));
+            __m256 f = _mm256_mul_ps(
+                        _mm256_mul_ps(_mm256_set1_ps(GRAVITY), mj),
+                        _mm256_mul_ps(r, _mm256_mul_ps(r, r)));
+            f = _mm256_and_ps(f, _mm256_cmp_ps(q, minQDistance, _CMP_GT_OQ));
+            ax = _mm256_fmadd_ps(dx, f, ax);
+            ay = _mm256_fmadd_ps(dy, f, ay);
+            az = _mm256_fmadd_ps(dz, f, az);
+
+            __m256 near = _mm256_and_ps(
+                        _mm256_and_ps(
+                            _mm256_cmp_ps(q, zero, _CMP_GT_OQ),
+                            _mm256_cmp_ps(q, mergeQDistance, _CMP_LT_OQ)),
+                        _mm256_and_ps(_mm256_cmp_ps(mi, mj, _CMP_LT_OQ),
+                                      alive));
+            near = _mm256_and_ps(near, _mm256_castsi256_ps(
+                                     _mm256_cmpeq_epi32(merge, none)));
+            merge = _mm256_castps_si256(_mm256_blendv_ps(
+                        _mm256_castsi256_ps(merge),
+                        _mm256_castsi256_ps(_mm256_set1_epi32(j)), near));
+        }
+
+        _mm256_storeu_ps(&result->ax[i], _mm256_and_ps(ax, alive));
+        _mm256_storeu_ps(&result->ay[i], _mm256_and_ps(ay, alive));
+        _mm256_storeu_ps(&result->az[i], _mm256_and_ps(az, alive));
+        _mm256_storeu_si256(
+                    reinterpret_cast<__m256i*>(&result->mergeInto[i]), merge);
+    }
+}
+
+static bool avx512Supported() {
+    return __builtin_cpu_supports("avx512f");
+}
+
+__attribute__((target("avx512f")))
+static void computeAvx512(const ParticleArrays& p, int first, int last,
+                          ForceResult* result) {
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+    const __m512 minQDistance = _mm512_set1_ps(MIN_QDISTANCE);
+    const __m512 mergeQDistance = _mm512_set1_ps(MERGE_QDISTANCE);
+    const __m512i none = _mm512_set1_epi32(-1);
+
+    for (int i = first; i < last; i += 16) {
+        __m512 xi = _mm512_loadu_ps(&p.x[i]);
+        __m512 yi = _mm512_loadu_ps(&p.y[i]);
+        __m512 zi = _mm512_loadu_ps(&p.z[i]);
+        __m512 mi = _mm512_loadu_ps(&p.mass[i]);
+        __mmask16 alive = _mm512_cmp_ps_mask(mi, zero, _CMP_NEQ_OQ);
+        __m512 ax = zero;
+        __m512 ay = zero;
+        __m512 az = zero;
+        __m512i merge = none;
+
+        for (int j = 0; j < p.paddedCount; j++) {
+            __m512 mj = _mm512_set1_ps(p.mass[j]);
+            __m512 dx = _mm512_sub_ps(_mm512_set1_ps(p.x[j]), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_set1_ps(p.y[j]), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_set1_ps(p.z[j]), zi);
+            __m512 q = _mm512_fmadd_ps(
+                        dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+            __m512 r = _mm512_maskz_rsqrt14_ps(0xffff, q);
+            r = _mm512_mul_ps(r, _mm512_fnmadd_ps(
+                                  _mm512_mul_ps(half, q), _mm512_mul_ps(r, r),
+                                  threeHalves));
+            __m512 f = _mm512_maskz_mul_ps(
+                        _mm512_cmp_ps_mask(q, minQDistance, _CMP_GT_OQ),
+                        _mm512_mul_ps(_mm512_set1_ps(GRAVITY), mj),
+                        _mm512_mul_ps(r, _mm512_mul_ps(r, r)));
+            ax = _mm512_fmadd_ps(dx, f, ax);
+            ay = _mm512_fmadd_ps(dy, f, ay);
+            az = _mm512_fmadd_ps(dz, f, az);
+
+            __mmask16 near =
+                    _mm512_cmp_ps_mask(q, zero, _CMP_GT_OQ)
+                    & _mm512_cmp_ps_mask(q, mergeQDistance, _CMP_LT_OQ)
+                    & _mm512_cmp_ps_mask(mi, mj, _CMP_LT_OQ)
+                    & _mm512_cmpeq_epi32_mask(merge, none) & alive;
+            merge = _mm512_mask_mov_epi32(merge, near, _mm512_set1_epi32(j));
+        }
+
+        _mm512_storeu_ps(&result->ax[i], _mm512_maskz_mov_ps(alive, ax));
+        _mm512_storeu_ps(&result->ay[i], _mm512_maskz_mov_ps(alive, ay));
+        _mm512_storeu_ps(&result->az[i], _mm512_maskz_mov_ps(alive, az));
+        _mm512_storeu_si512(&result->mergeInto[i], merge);
+    }
+}
+
+#endif  // CPU_FORCES_X86
+
+const std::vector<CpuForceKernel>& CpuForces::kernels() {
+    static const std::vector<CpuForceKernel> all = {
+#ifdef CPU_FORCES_X86
+        {"avx512", 16, avx512Supported, computeAvx512},
+        {"avx2", 8, avx2Supported, computeAvx2},
+        {"sse4.2", 4, sse42Supported, computeSse42},
+#endif
+        {"scalar", 1, alwaysSupported, computeScalar},
+    };
+    return all;
+}
+
+const CpuForceKernel& CpuForces::scalar() {
+    return kernels().back();
+}
+
+CpuForces::CpuForces() : kernel(&scalar()) {
+#ifdef CPU_FORCES_X86
+    __builtin_cpu_init();
+#endif
+    for (const CpuForceKernel& candidate : kernels()) {
+        if (candidate.supported()) {
+            kernel = &candidate;
+            break;
+        }
+    }
+}
+
+void CpuForces::compute(const ParticleArrays& particles,
+                        ForceResult* result) {
+    result->resize(particles.paddedCount);
+    kernel->compute(particles, 0, particles.paddedCount, result);
+}
@@ -0,0 +1,87 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_CPUFORCES_H_
+#define SRC_CPUFORCES_H_
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Structure of arrays copy of the particles for the CPU kernels. The
+// arrays are padded with massless particles to a multiple of the widest
+// vector, so the kernels never need a scalar tail.
+struct ParticleArrays {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> mass;
+    int count = 0;
+    int paddedCount = 0;
+
+    void load(const std::vector<glm::vec4>& pos);
+};
+
+// Result of one force evaluation, padded like ParticleArrays
+struct ForceResult {
+    std::vector<float> ax;
+    std::vector<float> ay;
+    std::vector<float> az;
+    // the particle each one merges into under the vortex.cl rule, or -1
+    std::vector<int> mergeInto;
+
+    void resize(int count);
+};
+
+// One implementation of the pairwise loop of gpu/vortex.cl
+struct CpuForceKernel {
+    const char* name;
+    // lanes per vector, first and last passed to compute are multiples
+    int width;
+    bool (*supported)();
+    // forces on the particles [first, last) by all particles
+    void (*compute)(const ParticleArrays& particles, int first, int last,
+                    ForceResult* result);
+};
+
+// CPU versions of the gravity loop for SSE4.2, AVX2 and AVX-512. They
+// are vectorized over i, every j is broadcast. 1 / r^3 comes from the
+// approximate reciprocal square root refined by one Newton step, and
+// merges are detected with lane masks.
+class CpuForces {
+ public:
+    // the widest kernel the CPU and OS support, chosen once via CPUID
+    const CpuForceKernel* kernel;
+
+    CpuForces();
+
+    // all kernels, widest first, the scalar reference last
+    static const std::vector<CpuForceKernel>& kernels();
+    static const CpuForceKernel& scalar();
+
+    void compute(const ParticleArrays& particles, ForceResult* result);
+};
+
+#endif  // SRC_CPUFORCES_H_
@@ -0,0 +1,176 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "DensityRenderer.h"
+
+#include <algorithm>
+
+#include "PointHierarchy.h"
+#include "options.h"
+#include "MemoryTracker.h"
+
+// the unit the density buffer is bound to while tone mapping
+static const int densityTextureUnit = 1;
+
+DensityRenderer::DensityRenderer(int windowWidth, int windowHeight) {
+    accumulateProgram = Renderer::createProgram("gpu/density.vert",
+                                                "gpu/density.frag");
+    impostorProgram = Renderer::createProgram("gpu/impostor.vert",
+                                              "gpu/density.frag");
+    tonemapProgram = Renderer::createProgram("gpu/fullscreen.vert",
+                                             "gpu/tonemap.frag");
+    framebuffer = 0;
+    densityTexture = 0;
+    emptyVertexArray = 0;
+    resize(windowWidth, windowHeight);
+}
+
+DensityRenderer::~DensityRenderer() {
+    release();
+    glDeleteProgram(accumulateProgram);
+    glDeleteProgram(impostorProgram);
+    glDeleteProgram(tonemapProgram);
+}
+
+void DensityRenderer::release() {
+    if (!framebuffer)
+        return;
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(1, &densityTexture);
+    glDeleteVertexArrays(1, &emptyVertexArray);
+    framebuffer = 0;
+    memoryTracker.track("density texture", GL_TEXTURE_MEMORY, 0);
+}
+
+void DensityRenderer::resize(int windowWidth, int windowHeight) {
+    release();
+
+    width = std::max(1, windowWidth / densityDownscale);
+    height = std::max(1, windowHeight / densityDownscale);
+
+    // the coarse mip levels are sampled for bloom
+    GLsizei levels = 1;
+    while ((std::max(width, height) >> levels) > 0)
+        levels++;
+
+    glGenTextures(1, &densityTexture);
+    glBindTexture(GL_TEXTURE_2D, densityTexture);
+    glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA16F, width, height);
+    // RGBA16F texels, 8 bytes each
+    size_t textureBytes = 0;
+    for (GLsizei level = 0; level < levels; level++)
+        textureBytes += static_cast<size_t>(std::max(1, width >> level))
+                * std::max(1, height >> level) * 8;
+    memoryTracker.track("density texture", GL_TEXTURE_MEMORY, textureBytes);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, densityTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        printf("Density framebuffer is incomplete\n");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenVertexArrays(1, &emptyVertexArray);
+
+    glUseProgram(accumulateProgram);
+    glUniform1f(glGetUniformLocation(accumulateProgram, "resolutionScale"),
+                1.0f / densityDownscale);
+    glUniform1f(glGetUniformLocation(accumulateProgram, "maxPointSize"),
+                densityMaxPointSize);
+
+    glUseProgram(tonemapProgram);
+    glUniform1i(glGetUniformLocation(tonemapProgram, "density"),
+                densityTextureUnit);
+    glUniform1f(glGetUniformLocation(tonemapProgram, "exposure"),
+                densityExposure);
+    glUniform1f(glGetUniformLocation(tonemapProgram, "bloom"),
+                densityBloom);
+}
+
+void DensityRenderer::draw(Renderer* renderer, PointHierarchy* hierarchy,
+                           int particleCount) {
+    if (hierarchy)
+        hierarchy->cull(renderer->view, renderer->projection,
+                        renderer->viewportHeight / densityDownscale);
+
+    // accumulate
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    glUseProgram(accumulateProgram);
+    glUniformMatrix4fv(
+                glGetUniformLocation(accumulateProgram, "viewMatrix"),
+                1, GL_FALSE, &renderer->view[0][0]);
+    glUniformMatrix4fv(
+                glGetUniformLocation(accumulateProgram, "projectionMatrix"),
+                1, GL_FALSE, &renderer->projection[0][0]);
+    glUniform1f(glGetUniformLocation(accumulateProgram, "interpolation"),
+                renderer->interpolation);
+
+    if (hierarchy) {
+        glUseProgram(impostorProgram);
+        glUniformMatrix4fv(
+                    glGetUniformLocation(impostorProgram, "viewMatrix"),
+                    1, GL_FALSE, &renderer->view[0][0]);
+        glUniformMatrix4fv(
+                    glGetUniformLocation(impostorProgram, "projectionMatrix"),
+                    1, GL_FALSE, &renderer->projection[0][0]);
+        glUseProgram(accumulateProgram);
+        hierarchy->draw(renderer->vao, impostorProgram);
+    } else {
+        glBindVertexArray(renderer->vao);
+        glDrawArrays(GL_POINTS, 0, particleCount);
+    }
+
+    // tone map to the window
+    glBindFramebuffer(GL_FRAMEBUFFER, renderer->targetFramebuffer);
+    glViewport(0, 0, renderer->viewportWidth, renderer->viewportHeight);
+    glDisable(GL_BLEND);
+
+    glActiveTexture(GL_TEXTURE0 + densityTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, densityTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glUseProgram(tonemapProgram);
+    glBindVertexArray(emptyVertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // back to the state of the sprite renderer
+    glActiveTexture(GL_TEXTURE0);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glUseProgram(renderer->shader_programm);
+    glBindVertexArray(renderer->vao);
+}
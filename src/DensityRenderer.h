@@ -0,0 +1,65 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_DENSITYRENDERER_H_
+#define SRC_DENSITYRENDERER_H_
+
+#include "Renderer.h"
+
+// Alternative to the blended point sprites. Particles are splatted as
+// small additive points into a reduced resolution floating point buffer,
+// which one pass tone maps, blooms and upscales to the window. The fill
+// cost is bounded by the buffer size and maxPointSize, independent of the
+// zoom and the mass of the particles.
+class DensityRenderer {
+ public:
+    GLuint accumulateProgram;
+    // the hierarchy impostors into the same buffer
+    GLuint impostorProgram;
+    GLuint tonemapProgram;
+
+    GLuint framebuffer;
+    GLuint densityTexture;
+    // the fullscreen triangle needs a bound, but empty vertex array
+    GLuint emptyVertexArray;
+
+    int width;
+    int height;
+
+    DensityRenderer(int windowWidth, int windowHeight);
+    ~DensityRenderer();
+
+    // recreates the buffer, also needed after switching the GL context
+    void resize(int windowWidth, int windowHeight);
+
+    // the hierarchy can be NULL to draw all particles
+    void draw(Renderer* renderer, PointHierarchy* hierarchy,
+              int particleCount);
+
+ private:
+    void release();
+};
+
+#endif  // SRC_DENSITYRENDERER_H_
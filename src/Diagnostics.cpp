@@ -0,0 +1,197 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Diagnostics.h"
+#include "util.h"
+#include "options.h"
+#include "MemoryTracker.h"
+
+Diagnostics::Diagnostics(Simulator* simulator) {
+    pending = false;
+    valid = false;
+    pendingStep = 0;
+    statsStep = 0;
+    capacity = 0;
+    groupSize = 1;
+
+    program = simulator->buildProgram(readFile("gpu/diagnostics.cl"));
+    try {
+        queue = cl::CommandQueue(simulator->context, simulator->currentDevice);
+        reduceKernel = cl::Kernel(program, "reduceStats");
+        potentialKernel = cl::Kernel(program, "samplePotential");
+        finalizeKernel = cl::Kernel(program, "finalizeStats");
+
+        // the tree reduction needs a power of two work group size
+        size_t maxGroupSize =
+                reduceKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(
+                    simulator->currentDevice);
+        maxGroupSize = std::min(maxGroupSize, diagnosticsGroupSize);
+        while (groupSize * 2 <= maxGroupSize)
+            groupSize *= 2;
+
+        partialBuffer = cl::Buffer(
+                    simulator->context, CL_MEM_READ_WRITE,
+                    diagnosticsGroups * sizeof(SimulationStats));
+        potentialBuffer = cl::Buffer(
+                    simulator->context, CL_MEM_READ_WRITE,
+                    potentialSamples * sizeof(cl_float));
+        statsBuffer = cl::Buffer(
+                    simulator->context, CL_MEM_READ_WRITE,
+                    sizeof(SimulationStats));
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+}
+
+Diagnostics::~Diagnostics() {}
+
+void Diagnostics::allocateBuffers(Simulator* simulator) {
+    if (simulator->particleCount <= capacity)
+        return;
+
+    capacity = simulator->particleCount;
+    positionSnapshot = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                                  capacity * sizeof(cl_float4));
+    velocitySnapshot = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                                  capacity * simulator->velocitySize());
+    memoryTracker.track("diagnostics snapshots", CL_MEMORY,
+                        capacity * (sizeof(cl_float4)
+                                    + simulator->velocitySize()));
+}
+
+void Diagnostics::afterStep(Simulator* simulator) {
+    // never queue up more than one evaluation
+    if (pending || simulator->stepCount % diagnosticsInterval != 0)
+        return;
+
+    cl_uint particleCount = simulator->particleCount;
+    if (particleCount == 0)
+        return;
+
+    // rounded up, so there are never more samples than the buffer holds
+    cl_uint sampleStride =
+            (particleCount + potentialSamples - 1) / potentialSamples;
+    cl_uint sampleCount = (particleCount + sampleStride - 1) / sampleStride;
+    cl_float sampleScale = static_cast<float>(particleCount) / sampleCount;
+
+    try {
+        allocateBuffers(simulator);
+
+        // the only work on the simulation queue is a device side copy
+        std::vector<cl::Event> copies(2);
+        simulator->queue.enqueueCopyBuffer(
+                    simulator->positionBuffer, positionSnapshot, 0, 0,
+                    particleCount * sizeof(cl_float4), NULL, &copies[0]);
+        simulator->queue.enqueueCopyBuffer(
+                    simulator->velocityBuffer, velocitySnapshot, 0, 0,
+                    particleCount * simulator->velocitySize(), NULL,
+                    &copies[1]);
+
+        reduceKernel.setArg(0, positionSnapshot);
+        reduceKernel.setArg(1, velocitySnapshot);
+        reduceKernel.setArg(2, particleCount);
+        reduceKernel.setArg(3, partialBuffer);
+        reduceKernel.setArg(4, cl::Local(groupSize * sizeof(cl_float)));
+        queue.enqueueNDRangeKernel(
+                    reduceKernel, cl::NullRange,
+                    cl::NDRange(diagnosticsGroups * groupSize),
+                    cl::NDRange(groupSize), &copies);
+
+        potentialKernel.setArg(0, positionSnapshot);
+        potentialKernel.setArg(1, particleCount);
+        potentialKernel.setArg(2, sampleStride);
+        potentialKernel.setArg(3, potentialBuffer);
+        queue.enqueueNDRangeKernel(
+                    potentialKernel, cl::NullRange,
+                    cl::NDRange(sampleCount), cl::NullRange);
+
+        finalizeKernel.setArg(0, partialBuffer);
+        finalizeKernel.setArg(1, static_cast<cl_uint>(diagnosticsGroups));
+        finalizeKernel.setArg(2, potentialBuffer);
+        finalizeKernel.setArg(3, sampleCount);
+        finalizeKernel.setArg(4, sampleScale);
+        finalizeKernel.setArg(5, statsBuffer);
+        queue.enqueueNDRangeKernel(
+                    finalizeKernel, cl::NullRange,
+                    cl::NDRange(1), cl::NullRange);
+
+        queue.enqueueReadBuffer(statsBuffer, CL_FALSE, 0,
+                                sizeof(SimulationStats), &pendingStats,
+                                NULL, &readEvent);
+        queue.flush();
+
+        pending = true;
+        pendingStep = simulator->stepCount;
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+}
+
+bool Diagnostics::poll() {
+    if (!pending)
+        return false;
+
+    cl_int status =
+            readEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
+    if (status != CL_COMPLETE)
+        return false;
+
+    stats = pendingStats;
+    statsStep = pendingStep;
+    pending = false;
+    valid = true;
+    return true;
+}
+
+void Diagnostics::print() {
+    if (!valid)
+        return;
+
+    printf("step %lu: %.0f particles, mass %g, max velocity %g\n",
+           statsStep, stats.liveParticles, stats.totalMass,
+           stats.maxVelocity);
+    printf("energy: kinetic %g potential %g total %g\n",
+           stats.kineticEnergy, stats.potentialEnergy,
+           stats.kineticEnergy + stats.potentialEnergy);
+    printf("momentum: (%g, %g, %g) angular (%g, %g, %g)\n",
+           stats.momentum[0], stats.momentum[1], stats.momentum[2],
+           stats.angularMomentum[0], stats.angularMomentum[1],
+           stats.angularMomentum[2]);
+    printf("center of mass: (%g, %g, %g) bounds (%g, %g, %g) - "
+           "(%g, %g, %g)\n",
+           stats.centerOfMass[0], stats.centerOfMass[1],
+           stats.centerOfMass[2],
+           stats.boundsMin[0], stats.boundsMin[1], stats.boundsMin[2],
+           stats.boundsMax[0], stats.boundsMax[1], stats.boundsMax[2]);
+}
@@ -0,0 +1,89 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_DIAGNOSTICS_H_
+#define SRC_DIAGNOSTICS_H_
+
+#include "Simulator.h"
+
+// Must match the STAT_ layout in gpu/diagnostics.cl
+struct SimulationStats {
+    cl_float kineticEnergy;
+    // estimated from potentialSamples particles
+    cl_float potentialEnergy;
+    cl_float totalMass;
+    cl_float momentum[3];
+    cl_float angularMomentum[3];
+    cl_float centerOfMass[3];
+    cl_float boundsMin[3];
+    cl_float boundsMax[3];
+    cl_float liveParticles;
+    cl_float maxVelocity;
+};
+
+// Reduces the particle state to a few physical quantities on the device.
+// Runs on its own command queue from a snapshot of the state, so the
+// simulation never waits for it.
+class Diagnostics : public SimulationStage {
+ public:
+    cl::CommandQueue queue;
+    cl::Program program;
+    cl::Kernel reduceKernel;
+    cl::Kernel potentialKernel;
+    cl::Kernel finalizeKernel;
+
+    cl::Buffer positionSnapshot;
+    cl::Buffer velocitySnapshot;
+    cl::Buffer partialBuffer;
+    cl::Buffer potentialBuffer;
+    cl::Buffer statsBuffer;
+
+    cl::Event readEvent;
+
+    // target of the pending non-blocking read
+    SimulationStats pendingStats;
+    // the most recent completed result
+    SimulationStats stats;
+
+    bool pending;
+    bool valid;
+    unsigned long pendingStep;
+    unsigned long statsStep;
+
+    int capacity;
+    size_t groupSize;
+
+    explicit Diagnostics(Simulator* simulator);
+    ~Diagnostics();
+
+    void afterStep(Simulator* simulator) override;
+    bool poll();
+    void print();
+
+ private:
+    void allocateBuffers(Simulator* simulator);
+};
+
+#endif  // SRC_DIAGNOSTICS_H_
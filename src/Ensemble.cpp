@@ -0,0 +1,147 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "Ensemble.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util.h"
+
+Ensemble::Ensemble(Simulator* simulator, std::string kernelSource)
+    : simulator(simulator), particleCount(0) {
+    program = simulator->buildProgram(kernelSource);
+    diagnosticsProgram = simulator->buildProgram(
+                readFile("gpu/diagnostics.cl"));
+    try {
+        kernel = cl::Kernel(program, "vortexEnsemble");
+        statsKernel = cl::Kernel(diagnosticsProgram, "systemStats");
+    } catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n", er.what(),
+               Simulator::oclErrorString(er.err()));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Ensemble::load(const std::vector<ParticleData>& members) {
+    std::vector<glm::vec4> pos;
+    std::vector<glm::vec3> vel;
+    std::vector<cl_uint> systemOf;
+
+    systems.clear();
+    for (const ParticleData& member : members) {
+        EnsembleSystem system = {static_cast<cl_uint>(pos.size()),
+                                 static_cast<cl_uint>(member.pos.size())};
+        pos.insert(pos.end(), member.pos.begin(), member.pos.end());
+        vel.insert(vel.end(), member.vel.begin(), member.vel.end());
+        systemOf.insert(systemOf.end(), system.count, systems.size());
+        systems.push_back(system);
+    }
+    particleCount = pos.size();
+
+    try {
+        cl::Context& context = simulator->context;
+        positionBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                    pos.size() * sizeof(glm::vec4));
+        velocityBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                    vel.size() * sizeof(glm::vec3));
+        systemBuffer = cl::Buffer(context, CL_MEM_READ_ONLY,
+                                  systems.size() * sizeof(EnsembleSystem));
+        systemOfBuffer = cl::Buffer(context, CL_MEM_READ_ONLY,
+                                    systemOf.size() * sizeof(cl_uint));
+        statsBuffer = cl::Buffer(context, CL_MEM_WRITE_ONLY,
+                                 systems.size() * sizeof(SimulationStats));
+
+        cl::CommandQueue& queue = simulator->queue;
+        queue.enqueueWriteBuffer(positionBuffer, CL_FALSE, 0,
+                                 pos.size() * sizeof(glm::vec4), pos.data());
+        queue.enqueueWriteBuffer(velocityBuffer, CL_FALSE, 0,
+                                 vel.size() * sizeof(glm::vec3), vel.data());
+        queue.enqueueWriteBuffer(systemBuffer, CL_FALSE, 0,
+                                 systems.size() * sizeof(EnsembleSystem),
+                                 systems.data());
+        queue.enqueueWriteBuffer(systemOfBuffer, CL_FALSE, 0,
+                                 systemOf.size() * sizeof(cl_uint),
+                                 systemOf.data());
+        queue.finish();
+
+        kernel.setArg(0, positionBuffer);
+        kernel.setArg(1, velocityBuffer);
+        kernel.setArg(2, systemBuffer);
+        kernel.setArg(3, systemOfBuffer);
+        kernel.setArg(4, static_cast<cl_uint>(particleCount));
+
+        statsKernel.setArg(0, positionBuffer);
+        statsKernel.setArg(1, velocityBuffer);
+        statsKernel.setArg(2, systemBuffer);
+        statsKernel.setArg(3, static_cast<cl_uint>(systems.size()));
+        statsKernel.setArg(4, statsBuffer);
+    } catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n", er.what(),
+               Simulator::oclErrorString(er.err()));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Ensemble::run(int steps, float dt) {
+    try {
+        kernel.setArg(5, dt);
+        for (int step = 0; step < steps; step++)
+            simulator->queue.enqueueNDRangeKernel(
+                        kernel, cl::NullRange, cl::NDRange(particleCount),
+                        cl::NullRange);
+        simulator->queue.finish();
+    } catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n", er.what(),
+               Simulator::oclErrorString(er.err()));
+        exit(EXIT_FAILURE);
+    }
+}
+
+std::vector<SimulationStats> Ensemble::stats() {
+    std::vector<SimulationStats> result(systems.size());
+    simulator->queue.enqueueNDRangeKernel(
+                statsKernel, cl::NullRange, cl::NDRange(systems.size()),
+                cl::NullRange);
+    simulator->queue.enqueueReadBuffer(
+                statsBuffer, CL_TRUE, 0,
+                result.size() * sizeof(SimulationStats), result.data());
+    return result;
+}
+
+void Ensemble::readSystem(size_t system,
+                          std::vector<glm::vec4>* pos,
+                          std::vector<glm::vec3>* vel) {
+    const EnsembleSystem& range = systems[system];
+    pos->resize(range.count);
+    vel->resize(range.count);
+    simulator->queue.enqueueReadBuffer(
+                positionBuffer, CL_FALSE, range.offset * sizeof(glm::vec4),
+                range.count * sizeof(glm::vec4), pos->data());
+    simulator->queue.enqueueReadBuffer(
+                velocityBuffer, CL_FALSE, range.offset * sizeof(glm::vec3),
+                range.count * sizeof(glm::vec3), vel->data());
+    simulator->queue.finish();
+}
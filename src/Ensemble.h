@@ -0,0 +1,77 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_ENSEMBLE_H_
+#define SRC_ENSEMBLE_H_
+
+#include <string>
+#include <vector>
+
+#include "Simulator.h"
+#include "Diagnostics.h"
+#include "Scenarios.h"
+
+// Must match the uint2 system records in gpu/vortex.cl
+struct EnsembleSystem {
+    cl_uint offset;
+    cl_uint count;
+};
+
+// Many small independent systems packed into one set of buffers. One
+// launch steps all of them, each particle only interacts with the
+// particles of its own system.
+class Ensemble {
+ public:
+    Simulator* simulator;
+
+    cl::Program program;
+    cl::Program diagnosticsProgram;
+    cl::Kernel kernel;
+    cl::Kernel statsKernel;
+
+    cl::Buffer positionBuffer;
+    cl::Buffer velocityBuffer;
+    cl::Buffer systemBuffer;
+    cl::Buffer systemOfBuffer;
+    cl::Buffer statsBuffer;
+
+    std::vector<EnsembleSystem> systems;
+    int particleCount;
+
+    // only uses the context and queue of the simulator
+    Ensemble(Simulator* simulator, std::string kernelSource);
+
+    void load(const std::vector<ParticleData>& members);
+    void run(int steps, float dt);
+
+    // one record per system, computed on the device
+    std::vector<SimulationStats> stats();
+    // the state of a single system
+    void readSystem(size_t system,
+                    std::vector<glm::vec4>* pos,
+                    std::vector<glm::vec3>* vel);
+};
+
+#endif  // SRC_ENSEMBLE_H_
@@ -0,0 +1,178 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "FrameCapture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ImageWriter.h"
+#include "MemoryTracker.h"
+
+FrameCapture::FrameCapture(const std::string& directory,
+                           int width, int height)
+    : width(width),
+      height(height),
+      directory(directory),
+      frameCount(0),
+      nextSlot(0),
+      stopping(false) {
+    glGenRenderbuffers(1, &colorRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, colorRenderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        printf("Capture framebuffer is incomplete\n");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(captureRingSize, pixelBuffers);
+    for (int i = 0; i < captureRingSize; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL,
+                     GL_STREAM_READ);
+        fences[i] = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    // the renderbuffer and every pixel buffer hold one RGBA8 frame
+    memoryTracker.track("capture frames", GL_BUFFER_MEMORY,
+                        (captureRingSize + 1) * width * height * 4);
+
+    writer = std::thread(&FrameCapture::writeFrames, this);
+}
+
+FrameCapture::~FrameCapture() {
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    writer.join();
+
+    glDeleteBuffers(captureRingSize, pixelBuffers);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colorRenderbuffer);
+    memoryTracker.track("capture frames", GL_BUFFER_MEMORY, 0);
+    printf("Captured %lu frames to %s\n", frameCount, directory.c_str());
+}
+
+void FrameCapture::bind(Renderer* renderer) {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    renderer->targetFramebuffer = framebuffer;
+}
+
+void FrameCapture::capture() {
+    // the oldest readback has had captureRingSize frames to complete
+    if (fences[nextSlot] && !collect(nextSlot, true)) {
+        printf("Capture of frame %lu timed out\n", slotFrames[nextSlot]);
+        glDeleteSync(fences[nextSlot]);
+        fences[nextSlot] = 0;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[nextSlot]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[nextSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slotFrames[nextSlot] = frameCount++;
+
+    nextSlot = (nextSlot + 1) % captureRingSize;
+
+    // pick up everything else that is already done
+    for (int i = 0; i < captureRingSize; i++)
+        if (fences[i])
+            collect(i, false);
+}
+
+void FrameCapture::finish() {
+    // oldest first, so the writer receives the frames in order
+    for (int i = 0; i < captureRingSize; i++) {
+        int slot = (nextSlot + i) % captureRingSize;
+        if (fences[slot])
+            collect(slot, true);
+    }
+}
+
+bool FrameCapture::collect(int slot, bool wait) {
+    GLuint64 timeout = wait ? captureTimeout : 0;
+    GLenum status = glClientWaitSync(
+                fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+    glDeleteSync(fences[slot]);
+    fences[slot] = 0;
+
+    CapturedFrame frame;
+    frame.number = slotFrames[slot];
+    frame.pixels.resize(width * height * 4);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[slot]);
+    void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                    frame.pixels.size(), GL_MAP_READ_BIT);
+    if (pixels) {
+        memcpy(frame.pixels.data(), pixels, frame.pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    // bound the memory held by frames waiting for the disk
+    condition.wait(lock, [this]() {
+        return frames.size() < captureQueueLimit;
+    });
+    frames.push_back(std::move(frame));
+    condition.notify_all();
+    return true;
+}
+
+void FrameCapture::writeFrames() {
+    while (true) {
+        CapturedFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() {
+                return stopping || !frames.empty();
+            });
+            if (frames.empty())
+                return;
+            frame = std::move(frames.front());
+            frames.pop_front();
+        }
+        condition.notify_all();
+
+        char name[32];
+        snprintf(name, sizeof(name), "/frame_%06lu.%s",
+                 frame.number, captureFormat);
+        std::string fileName = directory + name;
+        if (strcmp(captureFormat, "ppm") == 0)
+            writePpm(fileName, width, height, frame.pixels.data());
+        else
+            writePng(fileName, width, height, frame.pixels.data());
+    }
+}
@@ -0,0 +1,87 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_FRAMECAPTURE_H_
+#define SRC_FRAMECAPTURE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Renderer.h"
+#include "options.h"
+
+struct CapturedFrame {
+    unsigned long number;
+    std::vector<unsigned char> pixels;
+};
+
+// Renders into an offscreen framebuffer and writes every frame to an
+// image sequence. Pixels are read back asynchronously through a ring of
+// pixel buffer objects guarded by fences, and encoded on a writer thread,
+// so neither the renderer nor the simulation waits for the disk.
+class FrameCapture {
+ public:
+    GLuint framebuffer;
+    GLuint colorRenderbuffer;
+
+    GLuint pixelBuffers[captureRingSize];
+    GLsync fences[captureRingSize];
+    unsigned long slotFrames[captureRingSize];
+
+    int width;
+    int height;
+    std::string directory;
+    unsigned long frameCount;
+
+    FrameCapture(const std::string& directory, int width, int height);
+    // writes all pending frames
+    ~FrameCapture();
+
+    // makes the offscreen framebuffer the render target
+    void bind(Renderer* renderer);
+    // starts the readback of the frame rendered since bind()
+    void capture();
+    // waits for all readbacks and hands them to the writer
+    void finish();
+
+ private:
+    int nextSlot;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<CapturedFrame> frames;
+    bool stopping;
+
+    // blocks on the fence unless wait is false
+    bool collect(int slot, bool wait);
+    void writeFrames();
+};
+
+#endif  // SRC_FRAMECAPTURE_H_
@@ -0,0 +1,121 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "FrameGovernor.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+
+#include "options.h"
+
+FrameGovernor::FrameGovernor(double targetMs, float maxDtScale)
+    : stepLevel(0), detailLevel(0), targetMs(targetMs),
+      averageRenderMs(0), averageStepMs(0), averageMs(0),
+      overFrames(0), underFrames(0), cooldown(0) {
+    GovernorLevel next = {governorSubsteps, 1, lodPixels};
+    stepLevels.push_back(next);
+    while (next.substeps > 1) {
+        // keep the simulated time per frame while the floor allows it
+        next.substeps /= 2;
+        if (2 * next.dtScale <= maxDtScale)
+            next.dtScale *= 2;
+        stepLevels.push_back(next);
+    }
+
+    float maxDetailPixels = lodPixels * governorMaxDetailScale;
+    detailLevels.push_back(lodPixels);
+    while (detailLevels.back() < maxDetailPixels)
+        detailLevels.push_back(std::min(2 * detailLevels.back(),
+                                        maxDetailPixels));
+    level = current();
+}
+
+const GovernorLevel& FrameGovernor::current() const {
+    return level;
+}
+
+static double smooth(double average, double value) {
+    return average == 0
+            ? value : average + governorSmoothing * (value - average);
+}
+
+bool FrameGovernor::update(double renderMs, double stepMs) {
+    // the simulation thread runs in parallel, the slower one sets the pace
+    averageRenderMs = smooth(averageRenderMs, renderMs);
+    averageStepMs = smooth(averageStepMs, level.substeps * stepMs);
+    averageMs = std::max(averageRenderMs, averageStepMs);
+
+    if (cooldown > 0) {
+        cooldown--;
+        return false;
+    }
+
+    if (averageMs > targetMs * governorUpperBand) {
+        overFrames++;
+        underFrames = 0;
+    } else if (averageMs < targetMs * governorLowerBand) {
+        underFrames++;
+        overFrames = 0;
+    } else {
+        overFrames = 0;
+        underFrames = 0;
+    }
+
+    bool stepBound = averageStepMs >= averageRenderMs;
+    bool canLowerSteps = stepLevel + 1 < stepLevels.size();
+    bool canLowerDetail = detailLevel + 1 < detailLevels.size();
+    size_t previousStep = stepLevel;
+    size_t previousDetail = detailLevel;
+    if (overFrames >= governorPatience) {
+        // the bottleneck first, the other one if it is exhausted
+        if (canLowerSteps && (stepBound || !canLowerDetail))
+            stepLevel++;
+        else if (canLowerDetail)
+            detailLevel++;
+    } else if (underFrames >= governorPatience) {
+        if (detailLevel > 0 && (stepBound || stepLevel == 0))
+            detailLevel--;
+        else if (stepLevel > 0)
+            stepLevel--;
+    }
+    if (stepLevel == previousStep && detailLevel == previousDetail)
+        return false;
+
+    level = stepLevels[stepLevel];
+    level.detailPixels = detailLevels[detailLevel];
+    overFrames = 0;
+    underFrames = 0;
+    cooldown = governorCooldown;
+    return true;
+}
+
+void FrameGovernor::print() const {
+    printf("governor: render %.2fms, simulation %.2fms, step level "
+           "%zu/%zu with %d substeps and dt x%.0f, detail level %zu/%zu "
+           "with lod %.0fpx\n", averageRenderMs, averageStepMs,
+           stepLevel, stepLevels.size() - 1, level.substeps, level.dtScale,
+           detailLevel, detailLevels.size() - 1, level.detailPixels);
+}
@@ -0,0 +1,81 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_FRAMEGOVERNOR_H_
+#define SRC_FRAMEGOVERNOR_H_
+
+#include <stddef.h>
+#include <vector>
+
+// The settings the governor hands out
+struct GovernorLevel {
+    // simulation steps per rendered frame
+    int substeps;
+    // multiple of the dt set by the user, bigger steps are less accurate
+    float dtScale;
+    // impostor threshold of the point hierarchy
+    float detailPixels;
+};
+
+// Holds a target frame time with two ladders, one for the render detail
+// and one trading substeps for bigger steps until the accuracy floor is
+// reached. The render time and the simulation time per frame are smoothed
+// separately, and the ladder of the slower one is walked down when the
+// frame is too slow. With time to spare the faster one, which costs less
+// to raise, gets its detail back first. The smoothed frame time has to
+// leave a band around the target for a number of frames before a level
+// changes, and the next change waits for a cooldown, so the levels do not
+// oscillate.
+class FrameGovernor {
+ public:
+    // the substeps and dtScale of stepLevels, the detailPixels of
+    // detailLevels are used
+    std::vector<GovernorLevel> stepLevels;
+    std::vector<float> detailLevels;
+    size_t stepLevel;
+    size_t detailLevel;
+    double targetMs;
+    // exponentially smoothed
+    double averageRenderMs;
+    double averageStepMs;
+    double averageMs;
+
+    // maxDtScale is the accuracy floor
+    FrameGovernor(double targetMs, float maxDtScale);
+
+    // the render time and the simulation time per step of the last frame,
+    // true if the level changed
+    bool update(double renderMs, double stepMs);
+    const GovernorLevel& current() const;
+    void print() const;
+
+ private:
+    GovernorLevel level;
+    int overFrames;
+    int underFrames;
+    int cooldown;
+};
+
+#endif  // SRC_FRAMEGOVERNOR_H_
@@ -0,0 +1,157 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "ImageWriter.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+static uint32_t crc32(const unsigned char* data, size_t length,
+                      uint32_t crc = 0) {
+    static uint32_t table[256];
+    static bool initialized = false;
+    if (!initialized) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        initialized = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void appendUint32(std::vector<unsigned char>* out, uint32_t value) {
+    out->push_back(value >> 24);
+    out->push_back(value >> 16);
+    out->push_back(value >> 8);
+    out->push_back(value);
+}
+
+static void writeChunk(FILE* file, const char* type,
+                       const std::vector<unsigned char>& data) {
+    std::vector<unsigned char> chunk(type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+
+    std::vector<unsigned char> length;
+    appendUint32(&length, data.size());
+    std::vector<unsigned char> crc;
+    appendUint32(&crc, crc32(chunk.data(), chunk.size()));
+
+    fwrite(length.data(), 1, length.size(), file);
+    fwrite(chunk.data(), 1, chunk.size(), file);
+    fwrite(crc.data(), 1, crc.size(), file);
+}
+
+bool writePng(const std::string& fileName, int width, int height,
+              const unsigned char* pixels) {
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (!file) {
+        printf("Could not open %s\n", fileName.c_str());
+        return false;
+    }
+
+    static const unsigned char signature[] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+    };
+    fwrite(signature, 1, sizeof(signature), file);
+
+    std::vector<unsigned char> header;
+    appendUint32(&header, width);
+    appendUint32(&header, height);
+    // 8 bit RGB, deflate, adaptive filters, no interlacing
+    const unsigned char format[] = {8, 2, 0, 0, 0};
+    header.insert(header.end(), format, format + sizeof(format));
+    writeChunk(file, "IHDR", header);
+
+    // every row starts with filter type 0, rows are flipped to top first
+    size_t rowSize = width * 4;
+    std::vector<unsigned char> raw;
+    raw.reserve((width * 3 + 1) * height);
+    for (int y = height - 1; y >= 0; y--) {
+        raw.push_back(0);
+        const unsigned char* row = pixels + y * rowSize;
+        for (int x = 0; x < width; x++)
+            raw.insert(raw.end(), row + x * 4, row + x * 4 + 3);
+    }
+
+    // zlib stream of stored blocks, each at most 65535 bytes
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    size_t offset = 0;
+    bool last = false;
+    while (!last) {
+        size_t length = std::min<size_t>(raw.size() - offset, 65535);
+        last = offset + length == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(length & 0xFF);
+        zlib.push_back(length >> 8);
+        zlib.push_back(~length & 0xFF);
+        zlib.push_back((~length >> 8) & 0xFF);
+        zlib.insert(zlib.end(), raw.begin() + offset,
+                    raw.begin() + offset + length);
+        for (size_t i = offset; i < offset + length; i++) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        offset += length;
+    }
+    appendUint32(&zlib, (b << 16) | a);
+    writeChunk(file, "IDAT", zlib);
+
+    writeChunk(file, "IEND", std::vector<unsigned char>());
+    fclose(file);
+    return true;
+}
+
+bool writePpm(const std::string& fileName, int width, int height,
+              const unsigned char* pixels) {
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (!file) {
+        printf("Could not open %s\n", fileName.c_str());
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(width * 3);
+    for (int y = height - 1; y >= 0; y--) {
+        const unsigned char* rgba = pixels + y * width * 4;
+        for (int x = 0; x < width; x++) {
+            row[x * 3] = rgba[x * 4];
+            row[x * 3 + 1] = rgba[x * 4 + 1];
+            row[x * 3 + 2] = rgba[x * 4 + 2];
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    fclose(file);
+    return true;
+}
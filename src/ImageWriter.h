@@ -0,0 +1,42 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_IMAGEWRITER_H_
+#define SRC_IMAGEWRITER_H_
+
+#include <string>
+
+// Minimal image encoders without external dependencies. Both take RGBA8
+// pixels with the bottom row first, as returned by glReadPixels.
+
+// uncompressed RGB PNG, deflate stored blocks only. The alpha channel is
+// dropped, blending leaves it below 1 under the sprites.
+bool writePng(const std::string& fileName, int width, int height,
+              const unsigned char* pixels);
+// binary PPM, the alpha channel is dropped
+bool writePpm(const std::string& fileName, int width, int height,
+              const unsigned char* pixels);
+
+#endif  // SRC_IMAGEWRITER_H_
@@ -0,0 +1,86 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "MemoryTracker.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "Metrics.h"
+
+MemoryTracker memoryTracker;
+
+static const char* kindNames[MEMORY_KIND_COUNT] = {
+    "host", "cl buffer", "gl buffer", "gl texture"
+};
+
+MemoryTracker::MemoryTracker() : devicePeak(0) {
+    std::fill(totals, totals + MEMORY_KIND_COUNT, 0);
+    std::fill(peaks, peaks + MEMORY_KIND_COUNT, 0);
+}
+
+void MemoryTracker::track(const std::string& label, MemoryKind kind,
+                          size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto previous = allocations.find(label);
+    if (previous != allocations.end()) {
+        totals[previous->second.kind] -= previous->second.bytes;
+        allocations.erase(previous);
+    }
+    if (bytes)
+        allocations[label] = {kind, bytes};
+
+    totals[kind] += bytes;
+    peaks[kind] = std::max(peaks[kind], totals[kind]);
+    size_t device = totals[CL_MEMORY] + totals[GL_BUFFER_MEMORY]
+            + totals[GL_TEXTURE_MEMORY];
+    devicePeak = std::max(devicePeak, device);
+    metrics.deviceMemoryBytes.set(device);
+}
+
+size_t MemoryTracker::current(MemoryKind kind) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return totals[kind];
+}
+
+size_t MemoryTracker::deviceBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return totals[CL_MEMORY] + totals[GL_BUFFER_MEMORY]
+            + totals[GL_TEXTURE_MEMORY];
+}
+
+void MemoryTracker::print() {
+    std::lock_guard<std::mutex> lock(mutex);
+    printf("%-28s %-10s %12s\n", "allocation", "kind", "MB");
+    for (const auto& allocation : allocations)
+        printf("%-28s %-10s %12.2f\n", allocation.first.c_str(),
+               kindNames[allocation.second.kind],
+               allocation.second.bytes / 1.0e6);
+    for (int kind = 0; kind < MEMORY_KIND_COUNT; kind++)
+        printf("%-28s %-10s %12.2f (peak %.2f)\n", "total",
+               kindNames[kind], totals[kind] / 1.0e6, peaks[kind] / 1.0e6);
+    printf("%-28s %-10s %12s (peak %.2f)\n", "total", "device", "",
+           devicePeak / 1.0e6);
+}
@@ -0,0 +1,71 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_MEMORYTRACKER_H_
+#define SRC_MEMORYTRACKER_H_
+
+#include <stddef.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+enum MemoryKind {
+    HOST_MEMORY,
+    CL_MEMORY,
+    GL_BUFFER_MEMORY,
+    GL_TEXTURE_MEMORY,
+    MEMORY_KIND_COUNT
+};
+
+// Size of every large allocation under a label, with current and peak
+// totals per kind. Allocations happen outside the hot path, so a mutex
+// is fine here.
+class MemoryTracker {
+ public:
+    MemoryTracker();
+
+    // sets the size of a labelled allocation, 0 releases it
+    void track(const std::string& label, MemoryKind kind, size_t bytes);
+    size_t current(MemoryKind kind);
+    // GL and CL memory together
+    size_t deviceBytes();
+    void print();
+
+ private:
+    struct Allocation {
+        MemoryKind kind;
+        size_t bytes;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Allocation> allocations;
+    size_t totals[MEMORY_KIND_COUNT];
+    size_t peaks[MEMORY_KIND_COUNT];
+    size_t devicePeak;
+};
+
+extern MemoryTracker memoryTracker;
+
+#endif  // SRC_MEMORYTRACKER_H_
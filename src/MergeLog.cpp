@@ -0,0 +1,148 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "MergeLog.h"
+#include "Metrics.h"
+#include "MemoryTracker.h"
+
+static const cl_uint zero = 0;
+
+static bool complete(const cl::Event& event) {
+    return event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE;
+}
+
+MergeLog::MergeLog(Simulator* simulator, const std::string& fileName)
+    : active(0), recorded(0), dropped(0), simulator(simulator) {
+    for (Slot& slot : slots) {
+        slot.countBuffer = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                                      sizeof(cl_uint));
+        slot.eventBuffer = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                                      mergeLogCapacity * sizeof(MergeEvent));
+        slot.events.resize(mergeLogCapacity);
+        slot.count = 0;
+        slot.state = FREE;
+    }
+    size_t slotBytes = sizeof(cl_uint) + mergeLogCapacity * sizeof(MergeEvent);
+    memoryTracker.track("merge log", CL_MEMORY, mergeLogSlots * slotBytes);
+    memoryTracker.track("merge log events", HOST_MEMORY,
+                        mergeLogSlots * mergeLogCapacity * sizeof(MergeEvent));
+
+    file = fopen(fileName.c_str(), "w");
+    if (!file)
+        printf("Could not open merge log %s\n", fileName.c_str());
+    else
+        fprintf(file, "step,survivor,absorbed,absorbed_mass,survivor_mass,"
+                "x,y,z\n");
+
+    activate(0);
+    simulator->queue.finish();
+}
+
+MergeLog::~MergeLog() {
+    // the active slot is drained like a rotated one
+    Slot& current = slots[active];
+    simulator->queue.enqueueReadBuffer(current.countBuffer, CL_FALSE, 0,
+                                       sizeof(cl_uint), &current.count,
+                                       NULL, &current.countRead);
+    current.state = COUNTING;
+    drain(true);
+
+    if (file)
+        fclose(file);
+    print();
+}
+
+void MergeLog::activate(int slot) {
+    simulator->queue.enqueueWriteBuffer(slots[slot].countBuffer, CL_FALSE,
+                                        0, sizeof(cl_uint), &zero);
+    simulator->setMergeLog(slots[slot].countBuffer, slots[slot].eventBuffer,
+                           mergeLogCapacity);
+    slots[slot].state = ACTIVE;
+    active = slot;
+}
+
+void MergeLog::drain(bool wait) {
+    for (Slot& slot : slots) {
+        if (slot.state == COUNTING && (wait || complete(slot.countRead))) {
+            slot.countRead.wait();
+            metrics.merges.add(slot.count);
+            if (slot.count > mergeLogCapacity) {
+                printf("Merge log overflow: %u events dropped\n",
+                       slot.count - mergeLogCapacity);
+                dropped += slot.count - mergeLogCapacity;
+                metrics.mergesDropped.add(slot.count - mergeLogCapacity);
+                slot.count = mergeLogCapacity;
+            }
+            if (slot.count == 0) {
+                slot.state = FREE;
+                continue;
+            }
+            simulator->queue.enqueueReadBuffer(
+                        slot.eventBuffer, CL_FALSE, 0,
+                        slot.count * sizeof(MergeEvent), slot.events.data(),
+                        NULL, &slot.eventsRead);
+            slot.state = READING;
+        }
+
+        if (slot.state == READING && (wait || complete(slot.eventsRead))) {
+            slot.eventsRead.wait();
+            for (cl_uint i = 0; file && i < slot.count; i++) {
+                const MergeEvent& event = slot.events[i];
+                fprintf(file, "%u,%u,%u,%g,%g,%g,%g,%g\n",
+                        event.step, event.survivor, event.absorbed,
+                        event.absorbedMass, event.survivorMass,
+                        event.position[0], event.position[1],
+                        event.position[2]);
+            }
+            recorded += slot.count;
+            slot.state = FREE;
+        }
+    }
+}
+
+void MergeLog::afterStep(Simulator* simulator) {
+    drain(false);
+
+    if (simulator->stepCount % mergeLogInterval != 0)
+        return;
+
+    // hand the active slot over to the host, the counter read is
+    // enqueued after the step that wrote to it
+    Slot& current = slots[active];
+    simulator->queue.enqueueReadBuffer(current.countBuffer, CL_FALSE, 0,
+                                       sizeof(cl_uint), &current.count,
+                                       NULL, &current.countRead);
+    current.state = COUNTING;
+
+    int next = (active + 1) % mergeLogSlots;
+    // only happens if the host falls behind by mergeLogSlots intervals
+    if (slots[next].state != FREE)
+        drain(true);
+    activate(next);
+}
+
+void MergeLog::print() {
+    printf("Merges: %lu recorded, %lu dropped\n", recorded, dropped);
+}
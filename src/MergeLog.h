@@ -0,0 +1,98 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_MERGELOG_H_
+#define SRC_MERGELOG_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "Simulator.h"
+#include "options.h"
+
+// Must match MergeEvent in gpu/vortex.cl
+struct MergeEvent {
+    cl_uint step;
+    // stable particle ids, see Simulator::particleIds
+    cl_uint survivor;
+    cl_uint absorbed;
+    cl_float absorbedMass;
+    // after the merge, approximate for the parallel kernel, which does not
+    // order concurrent merges into the same survivor
+    cl_float survivorMass;
+    // of the absorbed particle
+    cl_float position[3];
+};
+
+// Collects the merges appended by the vortex kernel and writes them to a
+// CSV file. The kernel writes into one of a few device buffers, which are
+// rotated every mergeLogInterval steps and drained with small
+// non-blocking reads of exactly the recorded events.
+class MergeLog : public SimulationStage {
+ public:
+    enum SlotState {
+        FREE,
+        // the kernel appends to it
+        ACTIVE,
+        // the event counter is being read
+        COUNTING,
+        // the events are being read
+        READING
+    };
+
+    struct Slot {
+        cl::Buffer countBuffer;
+        cl::Buffer eventBuffer;
+        cl::Event countRead;
+        cl::Event eventsRead;
+        cl_uint count;
+        std::vector<MergeEvent> events;
+        SlotState state;
+    };
+
+    Slot slots[mergeLogSlots];
+    int active;
+
+    FILE* file;
+    unsigned long recorded;
+    unsigned long dropped;
+
+    MergeLog(Simulator* simulator, const std::string& fileName);
+    // writes all pending events
+    ~MergeLog();
+
+    void afterStep(Simulator* simulator) override;
+    void print();
+
+ private:
+    Simulator* simulator;
+
+    void activate(int slot);
+    // advances the slots whose reads completed, or all of them if wait
+    void drain(bool wait);
+};
+
+#endif  // SRC_MERGELOG_H_
@@ -0,0 +1,135 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "Metrics.h"
+
+#include <stdio.h>
+
+Metrics metrics;
+
+static void renderHeader(std::string* out, const char* name,
+                         const char* help, const char* type) {
+    *out += std::string("# HELP ") + name + " " + help + "\n";
+    *out += std::string("# TYPE ") + name + " " + type + "\n";
+}
+
+// bucket bounds are short, values keep their full precision
+static std::string format(double value, int precision = 17) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+    return buffer;
+}
+
+Counter::Counter(const char* name, const char* help)
+    : name(name), help(help), value(0) {}
+
+void Counter::render(std::string* out) const {
+    renderHeader(out, name, help, "counter");
+    *out += std::string(name) + " "
+            + std::to_string(value.load(std::memory_order_relaxed)) + "\n";
+}
+
+Gauge::Gauge(const char* name, const char* help)
+    : name(name), help(help), value(0) {}
+
+void Gauge::render(std::string* out) const {
+    renderHeader(out, name, help, "gauge");
+    *out += std::string(name) + " "
+            + format(value.load(std::memory_order_relaxed)) + "\n";
+}
+
+Histogram::Histogram(const char* name, const char* help,
+                     std::vector<double> bounds)
+    : name(name), help(help), bounds(bounds),
+      buckets(new std::atomic<uint64_t>[bounds.size() + 1]),
+      count(0), sum(0) {
+    for (size_t i = 0; i <= bounds.size(); i++)
+        buckets[i] = 0;
+}
+
+void Histogram::observe(double amount) {
+    size_t bucket = 0;
+    while (bucket < bounds.size() && amount > bounds[bucket])
+        bucket++;
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+
+    // only retries while another thread observes at the same time
+    double current = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(current, current + amount,
+                                      std::memory_order_relaxed)) {}
+}
+
+void Histogram::render(std::string* out) const {
+    renderHeader(out, name, help, "histogram");
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= bounds.size(); i++) {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        std::string bound = i < bounds.size()
+                ? format(bounds[i], 6) : "+Inf";
+        *out += std::string(name) + "_bucket{le=\"" + bound + "\"} "
+                + std::to_string(cumulative) + "\n";
+    }
+    *out += std::string(name) + "_sum "
+            + format(sum.load(std::memory_order_relaxed)) + "\n";
+    *out += std::string(name) + "_count "
+            + std::to_string(count.load(std::memory_order_relaxed)) + "\n";
+}
+
+Metrics::Metrics()
+    : stepSeconds("universe_step_seconds",
+                  "Duration of a simulation step including the publish copy.",
+                  {0.0005, 0.001, 0.002, 0.004, 0.008, 0.016, 0.032, 0.064,
+                   0.128, 0.256, 0.512, 1.024}),
+      steps("universe_steps_total", "Simulation steps run."),
+      interactions("universe_interactions_total",
+                   "Pairwise particle interactions evaluated."),
+      liveParticles("universe_live_particles",
+                    "Particles with a mass at the last diagnostics step."),
+      merges("universe_merges_total", "Particles merged into another one."),
+      mergesDropped("universe_merges_dropped_total",
+                    "Merges that did not fit into the merge log."),
+      deviceMemoryBytes("universe_device_memory_bytes",
+                        "Device memory allocated for the particles."),
+      commandQueueDepth("universe_command_queue_depth",
+                        "Commands waiting for the simulation thread."),
+      frames("universe_frames_total", "Frames rendered."),
+      droppedFrames("universe_dropped_frames_total",
+                    "Frames that missed the governor target frame time.") {}
+
+std::string Metrics::render() const {
+    std::string out;
+    stepSeconds.render(&out);
+    steps.render(&out);
+    interactions.render(&out);
+    liveParticles.render(&out);
+    merges.render(&out);
+    mergesDropped.render(&out);
+    deviceMemoryBytes.render(&out);
+    commandQueueDepth.render(&out);
+    frames.render(&out);
+    droppedFrames.render(&out);
+    return out;
+}
@@ -0,0 +1,107 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_METRICS_H_
+#define SRC_METRICS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Metrics are updated with relaxed atomics only, so the simulation and
+// render threads never wait for each other or for a scrape. A scrape may
+// see a histogram whose count is one ahead of its buckets.
+
+// A value that only goes up
+class Counter {
+ public:
+    Counter(const char* name, const char* help);
+    void add(uint64_t amount = 1) {
+        value.fetch_add(amount, std::memory_order_relaxed);
+    }
+    void render(std::string* out) const;
+
+ private:
+    const char* name;
+    const char* help;
+    std::atomic<uint64_t> value;
+};
+
+// A value that goes up and down
+class Gauge {
+ public:
+    Gauge(const char* name, const char* help);
+    void set(double amount) {
+        value.store(amount, std::memory_order_relaxed);
+    }
+    void render(std::string* out) const;
+
+ private:
+    const char* name;
+    const char* help;
+    std::atomic<double> value;
+};
+
+// Observations counted into fixed buckets given by their upper bounds
+class Histogram {
+ public:
+    Histogram(const char* name, const char* help,
+              std::vector<double> bounds);
+    void observe(double amount);
+    void render(std::string* out) const;
+
+ private:
+    const char* name;
+    const char* help;
+    std::vector<double> bounds;
+    // one more than bounds for the observations above the last one
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+    std::atomic<uint64_t> count;
+    std::atomic<double> sum;
+};
+
+// Every metric of the simulator, rendered in the Prometheus text format
+struct Metrics {
+    Histogram stepSeconds;
+    Counter steps;
+    Counter interactions;
+    Gauge liveParticles;
+    Counter merges;
+    Counter mergesDropped;
+    Gauge deviceMemoryBytes;
+    Gauge commandQueueDepth;
+    Counter frames;
+    // frames that took longer than governorTargetMs
+    Counter droppedFrames;
+
+    Metrics();
+    std::string render() const;
+};
+
+extern Metrics metrics;
+
+#endif  // SRC_METRICS_H_
@@ -0,0 +1,146 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "MetricsServer.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Metrics.h"
+#include "options.h"
+
+MetricsServer::MetricsServer(int port, const std::string& socketPath)
+    : listener(-1), socketPath(socketPath), running(false) {
+    int result;
+    if (socketPath.empty()) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR,
+                   &reuse, sizeof(reuse));
+
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        result = bind(listener, reinterpret_cast<sockaddr*>(&address),
+                      sizeof(address));
+    } else {
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socketPath.c_str(),
+                sizeof(address.sun_path) - 1);
+        unlink(socketPath.c_str());
+        result = bind(listener, reinterpret_cast<sockaddr*>(&address),
+                      sizeof(address));
+    }
+
+    if (listener < 0 || result != 0 || listen(listener, 4) != 0) {
+        printf("Metrics endpoint unavailable: %s\n", strerror(errno));
+        if (listener >= 0)
+            close(listener);
+        listener = -1;
+        return;
+    }
+
+    if (socketPath.empty())
+        printf("Metrics on http://127.0.0.1:%d/metrics\n", port);
+    else
+        printf("Metrics on unix:%s\n", socketPath.c_str());
+
+    running = true;
+    thread = std::thread(&MetricsServer::run, this);
+}
+
+MetricsServer::~MetricsServer() {
+    running = false;
+    if (thread.joinable())
+        thread.join();
+    if (listener >= 0)
+        close(listener);
+    if (!socketPath.empty())
+        unlink(socketPath.c_str());
+}
+
+void MetricsServer::run() {
+    pollfd waiting = {listener, POLLIN, 0};
+    while (running) {
+        // wakes up regularly to notice the shutdown
+        if (poll(&waiting, 1, metricsPollMilliseconds) <= 0)
+            continue;
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+            continue;
+        respond(client);
+        close(client);
+    }
+}
+
+void MetricsServer::respond(int client) {
+    // a slow client must not keep the thread from shutting down
+    timeval timeout = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos
+           && request.size() < sizeof(buffer) * 8) {
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+            break;
+        request.append(buffer, received);
+    }
+
+    std::string status = "200 OK";
+    std::string body;
+    if (request.compare(0, 13, "GET /metrics ") == 0) {
+        body = metrics.render();
+    } else {
+        status = "404 Not Found";
+        body = "Not found, try /metrics\n";
+    }
+
+    std::string response = "HTTP/1.0 " + status + "\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t written = send(client, response.data() + sent,
+                               response.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0)
+            break;
+        sent += written;
+    }
+}
@@ -0,0 +1,51 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_METRICSSERVER_H_
+#define SRC_METRICSSERVER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+// Answers GET /metrics with the Prometheus text format from its own
+// thread. Listens on 127.0.0.1 only, or on a Unix socket if a path is
+// given, and never touches the simulation beyond reading the metrics.
+class MetricsServer {
+ public:
+    MetricsServer(int port, const std::string& socketPath = "");
+    ~MetricsServer();
+
+ private:
+    int listener;
+    std::string socketPath;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    void run();
+    void respond(int client);
+};
+
+#endif  // SRC_METRICSSERVER_H_
@@ -0,0 +1,218 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "MortonOrder.h"
+#include "util.h"
+#include "options.h"
+#include "MemoryTracker.h"
+
+// must match RADIX_BITS and SCAN_ITEMS in gpu/morton.cl
+static const int radixBits = 4;
+static const int radixScanItems = 256;
+static const int radixDigits = 1 << radixBits;
+
+MortonOrder::MortonOrder(Simulator* simulator) : simulator(simulator) {
+    capacity = 0;
+    boundsMin = glm::vec4(mortonBoundsMin, mortonBoundsMin,
+                          mortonBoundsMin, 0);
+    boundsSize = mortonBoundsSize;
+    bitsPerAxis = mortonBitsPerAxis;
+
+    program = simulator->buildProgram(readFile("gpu/morton.cl"));
+    try {
+        keyKernel = cl::Kernel(program, "mortonKeys");
+        gatherFloat4Kernel = cl::Kernel(program, "gatherFloat4");
+        gatherVelocityKernel = cl::Kernel(program, "gatherVelocity");
+        gatherUintKernel = cl::Kernel(program, "gatherUint");
+        identityKernel = cl::Kernel(program, "identityOrder");
+        countKernel = cl::Kernel(program, "radixCount");
+        scanKernel = cl::Kernel(program, "radixScan");
+        scatterKernel = cl::Kernel(program, "radixScatter");
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+}
+
+MortonOrder::~MortonOrder() {}
+
+void MortonOrder::allocateBuffers(int particleCount) {
+    if (particleCount <= capacity)
+        return;
+
+    cl::Context& context = simulator->context;
+    int blocks = (particleCount + mortonSortBlockSize - 1)
+            / mortonSortBlockSize;
+    keyBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                           particleCount * sizeof(cl_ulong));
+    orderBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                             particleCount * sizeof(cl_uint));
+    swapOrderBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                 particleCount * sizeof(cl_uint));
+    countBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                             blocks * radixDigits * sizeof(cl_uint));
+    // large enough for the widest per particle attribute, the sort also
+    // swaps its keys through it
+    scratchBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                               particleCount * sizeof(cl_float4));
+    capacity = particleCount;
+    memoryTracker.track("morton buffers", CL_MEMORY,
+                        particleCount * (sizeof(cl_ulong) + 2 * sizeof(cl_uint)
+                                         + sizeof(cl_float4))
+                        + blocks * radixDigits * sizeof(cl_uint));
+}
+
+void MortonOrder::gather(cl::Kernel* kernel, const cl::Buffer& buffer,
+                         size_t elementSize) {
+    cl::CommandQueue& queue = simulator->queue;
+    int particleCount = simulator->particleCount;
+
+    kernel->setArg(0, buffer);
+    kernel->setArg(1, scratchBuffer);
+    kernel->setArg(2, orderBuffer);
+    queue.enqueueNDRangeKernel(*kernel, cl::NullRange,
+                               cl::NDRange(particleCount), cl::NullRange);
+    queue.enqueueCopyBuffer(scratchBuffer, buffer, 0, 0,
+                            particleCount * elementSize);
+}
+
+void MortonOrder::fitBounds(const float* min, const float* max) {
+    float size = std::max(max[0] - min[0],
+                          std::max(max[1] - min[1], max[2] - min[2]));
+    if (!(size > 0))
+        return;
+
+    // leave some room for particles moving outwards until the next fit
+    float margin = 0.05 * size;
+    boundsMin = glm::vec4(min[0] - margin, min[1] - margin,
+                          min[2] - margin, 0);
+    boundsSize = size + 2 * margin;
+}
+
+void MortonOrder::reorder() {
+    cl::CommandQueue& queue = simulator->queue;
+    int particleCount = simulator->particleCount;
+
+    allocateBuffers(particleCount);
+
+    try {
+        // compute one key per particle on the device
+        keyKernel.setArg(0, simulator->positionBuffer);
+        keyKernel.setArg(1, keyBuffer);
+        keyKernel.setArg(2, boundsMin);
+        keyKernel.setArg(3, boundsSize);
+        keyKernel.setArg(4, bitsPerAxis);
+        queue.enqueueNDRangeKernel(keyKernel, cl::NullRange,
+                                   cl::NDRange(particleCount), cl::NullRange);
+
+        // the keys never leave the device, the extra bit is the one of
+        // the deleted particles
+        sortKeys(particleCount, 3 * bitsPerAxis + 1);
+
+        gather(&gatherFloat4Kernel, simulator->positionBuffer,
+               sizeof(cl_float4));
+        gather(&gatherUintKernel, simulator->colorBuffer,
+               sizeof(cl_uint));
+        gather(&gatherVelocityKernel, simulator->velocityBuffer,
+               simulator->velocitySize());
+        gather(&gatherUintKernel, simulator->idBuffer, sizeof(cl_uint));
+
+        // keep the host side id table in the same order as the device
+        simulator->particleIds.resize(particleCount);
+        queue.enqueueReadBuffer(simulator->idBuffer, CL_FALSE, 0,
+                                particleCount * sizeof(cl_uint),
+                                simulator->particleIds.data());
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+
+    queue.finish();
+    // the renderer must not interpolate across the new order
+    simulator->orderGeneration++;
+    simulator->slotGeneration++;
+}
+
+void MortonOrder::sortKeys(int count, int keyBits) {
+    cl::CommandQueue& queue = simulator->queue;
+    cl_uint keyCount = count;
+    cl_uint blockSize = mortonSortBlockSize;
+    cl_uint blocks = (keyCount + blockSize - 1) / blockSize;
+    cl_uint countTotal = blocks * radixDigits;
+    // whole work groups, the kernels skip the blocks past the end
+    size_t items = (blocks + radixScanItems - 1) / radixScanItems
+            * radixScanItems;
+
+    identityKernel.setArg(0, orderBuffer);
+    queue.enqueueNDRangeKernel(identityKernel, cl::NullRange,
+                               cl::NDRange(count), cl::NullRange);
+
+    cl::Buffer* keysIn = &keyBuffer;
+    cl::Buffer* keysOut = &scratchBuffer;
+    cl::Buffer* orderIn = &orderBuffer;
+    cl::Buffer* orderOut = &swapOrderBuffer;
+    for (cl_uint shift = 0; shift < cl_uint(keyBits); shift += radixBits) {
+        countKernel.setArg(0, *keysIn);
+        countKernel.setArg(1, countBuffer);
+        countKernel.setArg(2, keyCount);
+        countKernel.setArg(3, blockSize);
+        countKernel.setArg(4, blocks);
+        countKernel.setArg(5, shift);
+        queue.enqueueNDRangeKernel(countKernel, cl::NullRange,
+                                   cl::NDRange(items), cl::NullRange);
+
+        scanKernel.setArg(0, countBuffer);
+        scanKernel.setArg(1, countTotal);
+        queue.enqueueNDRangeKernel(scanKernel, cl::NullRange,
+                                   cl::NDRange(radixScanItems),
+                                   cl::NDRange(radixScanItems));
+
+        scatterKernel.setArg(0, *keysIn);
+        scatterKernel.setArg(1, *orderIn);
+        scatterKernel.setArg(2, *keysOut);
+        scatterKernel.setArg(3, *orderOut);
+        scatterKernel.setArg(4, countBuffer);
+        scatterKernel.setArg(5, keyCount);
+        scatterKernel.setArg(6, blockSize);
+        scatterKernel.setArg(7, blocks);
+        scatterKernel.setArg(8, shift);
+        queue.enqueueNDRangeKernel(scatterKernel, cl::NullRange,
+                                   cl::NDRange(items), cl::NullRange);
+
+        std::swap(keysIn, keysOut);
+        std::swap(orderIn, orderOut);
+    }
+
+    // the gathers read orderBuffer
+    if (orderIn != &orderBuffer)
+        std::swap(orderBuffer, swapOrderBuffer);
+}
@@ -0,0 +1,76 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_MORTONORDER_H_
+#define SRC_MORTONORDER_H_
+
+#include "Simulator.h"
+
+// Sorts the particle buffers along a Z-order curve so that particles
+// close in space are also close in memory.
+class MortonOrder {
+ public:
+    Simulator* simulator;
+
+    cl::Program program;
+    cl::Kernel keyKernel;
+    cl::Kernel gatherFloat4Kernel;
+    cl::Kernel gatherVelocityKernel;
+    cl::Kernel gatherUintKernel;
+    cl::Kernel identityKernel;
+    cl::Kernel countKernel;
+    cl::Kernel scanKernel;
+    cl::Kernel scatterKernel;
+
+    cl::Buffer keyBuffer;
+    cl::Buffer orderBuffer;
+    cl::Buffer swapOrderBuffer;
+    // per block digit counts, then their offsets
+    cl::Buffer countBuffer;
+    cl::Buffer scratchBuffer;
+
+    int capacity;
+
+    glm::vec4 boundsMin;
+    float boundsSize;
+    unsigned int bitsPerAxis;
+
+    explicit MortonOrder(Simulator* simulator);
+    ~MortonOrder();
+
+    void reorder();
+    void fitBounds(const float* min, const float* max);
+
+
+ private:
+    void allocateBuffers(int particleCount);
+    // stable device radix sort of keyBuffer, leaves the permutation in
+    // orderBuffer
+    void sortKeys(int count, int keyBits);
+    void gather(cl::Kernel* kernel, const cl::Buffer& buffer,
+                size_t elementSize);
+};
+
+#endif  // SRC_MORTONORDER_H_
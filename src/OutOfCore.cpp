@@ -0,0 +1,287 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "OutOfCore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "Scenarios.h"
+#include "options.h"
+
+double StreamingStats::overlap() const {
+    double shorter = std::min(transferMs, computeMs);
+    if (shorter <= 0)
+        return 0;
+    double hidden = transferMs + computeMs - spanMs;
+    return std::max(0.0, std::min(1.0, hidden / shorter));
+}
+
+double StreamingStats::bandwidth() const {
+    return transferMs > 0 ? transferBytes / (transferMs * 1.0e6) : 0;
+}
+
+// the commands that have to complete first, none for an unset event
+static std::vector<cl::Event> after(const cl::Event& event) {
+    std::vector<cl::Event> events;
+    if (event())
+        events.push_back(event);
+    return events;
+}
+
+static double durationMs(const std::vector<cl::Event>& events,
+                         cl_ulong* first, cl_ulong* last) {
+    cl_ulong sum = 0;
+    for (const cl::Event& event : events) {
+        cl_ulong start =
+                event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+        sum += end - start;
+        *first = std::min(*first, start);
+        *last = std::max(*last, end);
+    }
+    return sum / 1.0e6;
+}
+
+OutOfCore::OutOfCore(Simulator* simulator, std::string kernelSource,
+                     size_t particleCount, const char* storageFile)
+    : simulator(simulator), particleCount(particleCount),
+      blockSize(std::min(streamBlockSize, particleCount)),
+      tileSize(std::min(streamTileSize, particleCount)) {
+    // two copies of the positions and the packed velocities
+    storageSize = particleCount * (2 * sizeof(glm::vec4) + sizeof(glm::vec3));
+
+    void* mapping;
+    if (storageFile) {
+        int file = open(storageFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (file < 0 || ftruncate(file, storageSize) != 0) {
+            printf("ERROR: Could not create %s. %s\n",
+                   storageFile, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        mapping = mmap(NULL, storageSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, file, 0);
+        close(file);
+    } else {
+        mapping = mmap(NULL, storageSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        printf("ERROR: Could not map %zu bytes. %s\n",
+               storageSize, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    storage = static_cast<char*>(mapping);
+    positions = reinterpret_cast<glm::vec4*>(storage);
+    nextPositions = positions + particleCount;
+    velocities = reinterpret_cast<glm::vec3*>(nextPositions + particleCount);
+
+    program = simulator->buildProgram(kernelSource);
+    try {
+        accumulateKernel = cl::Kernel(program, "accumulateTile");
+        advanceKernel = cl::Kernel(program, "advanceBlock");
+
+        cl::Context& context = simulator->context;
+        cl::Device& device = simulator->currentDevice;
+        uploadQueue = cl::CommandQueue(context, device,
+                                       CL_QUEUE_PROFILING_ENABLE);
+        computeQueue = cl::CommandQueue(context, device,
+                                        CL_QUEUE_PROFILING_ENABLE);
+        downloadQueue = cl::CommandQueue(context, device,
+                                         CL_QUEUE_PROFILING_ENABLE);
+
+        for (int i = 0; i < 2; i++) {
+            blockBuffers[i] = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                         blockSize * sizeof(glm::vec4));
+            velocityBuffers[i] = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                            blockSize * sizeof(glm::vec3));
+            accelerationBuffers[i] = cl::Buffer(
+                        context, CL_MEM_READ_WRITE,
+                        blockSize * sizeof(glm::vec4));
+            tileBuffers[i] = cl::Buffer(context, CL_MEM_READ_ONLY,
+                                        tileSize * sizeof(glm::vec4));
+        }
+    } catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n", er.what(),
+               Simulator::oclErrorString(er.err()));
+        exit(EXIT_FAILURE);
+    }
+}
+
+OutOfCore::~OutOfCore() {
+    munmap(storage, storageSize);
+}
+
+size_t OutOfCore::deviceBytes() {
+    return 2 * (blockSize * (2 * sizeof(glm::vec4) + sizeof(glm::vec3))
+                + tileSize * sizeof(glm::vec4));
+}
+
+void OutOfCore::generate(unsigned int seed) {
+    // one galaxy at a time, so the host never holds a second full copy
+    for (size_t offset = 0; offset < particleCount; offset += blockSize) {
+        size_t count = std::min(blockSize, particleCount - offset);
+        ParticleData data = generateGalaxy(static_cast<int>(count),
+                                           seed++);
+        std::copy(data.pos.begin(), data.pos.end(), positions + offset);
+        std::copy(data.vel.begin(), data.vel.end(), velocities + offset);
+    }
+}
+
+void OutOfCore::step(float dt) {
+    std::chrono::time_point<std::chrono::system_clock> start =
+            std::chrono::system_clock::now();
+
+    transferEvents.clear();
+    kernelEvents.clear();
+    stats.transferBytes = 0;
+
+    // the last commands reading each of the double buffers
+    cl::Event blockRead[2];
+    cl::Event tileUsed[2];
+    size_t tileIndex = 0;
+
+    try {
+        for (size_t blockOffset = 0, block = 0; blockOffset < particleCount;
+             blockOffset += blockSize, block++) {
+            int slot = block % 2;
+            size_t count = std::min(blockSize, particleCount - blockOffset);
+
+            std::vector<cl::Event> waits = after(blockRead[slot]);
+            cl::Event positionsWritten;
+            cl::Event velocitiesWritten;
+            uploadQueue.enqueueWriteBuffer(
+                        blockBuffers[slot], CL_FALSE, 0,
+                        count * sizeof(glm::vec4), positions + blockOffset,
+                        &waits, &positionsWritten);
+            uploadQueue.enqueueWriteBuffer(
+                        velocityBuffers[slot], CL_FALSE, 0,
+                        count * sizeof(glm::vec3), velocities + blockOffset,
+                        &waits, &velocitiesWritten);
+            transferEvents.push_back(positionsWritten);
+            transferEvents.push_back(velocitiesWritten);
+            stats.transferBytes += count * sizeof(glm::vec4)
+                    + count * sizeof(glm::vec3);
+
+            for (size_t tileOffset = 0; tileOffset < particleCount;
+                 tileOffset += tileSize, tileIndex++) {
+                int tileSlot = tileIndex % 2;
+                size_t tileCount = std::min(tileSize,
+                                            particleCount - tileOffset);
+
+                waits = after(tileUsed[tileSlot]);
+                cl::Event tileWritten;
+                uploadQueue.enqueueWriteBuffer(
+                            tileBuffers[tileSlot], CL_FALSE, 0,
+                            tileCount * sizeof(glm::vec4),
+                            positions + tileOffset, &waits, &tileWritten);
+                transferEvents.push_back(tileWritten);
+                stats.transferBytes += tileCount * sizeof(glm::vec4);
+
+                accumulateKernel.setArg(0, blockBuffers[slot]);
+                accumulateKernel.setArg(
+                            1, static_cast<cl_uint>(blockOffset));
+                accumulateKernel.setArg(2, tileBuffers[tileSlot]);
+                accumulateKernel.setArg(3, static_cast<cl_uint>(tileOffset));
+                accumulateKernel.setArg(4, static_cast<cl_uint>(tileCount));
+                accumulateKernel.setArg(
+                            5, static_cast<cl_uint>(tileOffset == 0));
+                accumulateKernel.setArg(6, accelerationBuffers[slot]);
+
+                waits = {positionsWritten, tileWritten};
+                computeQueue.enqueueNDRangeKernel(
+                            accumulateKernel, cl::NullRange,
+                            cl::NDRange(count), cl::NullRange,
+                            &waits, &tileUsed[tileSlot]);
+                kernelEvents.push_back(tileUsed[tileSlot]);
+            }
+
+            advanceKernel.setArg(0, blockBuffers[slot]);
+            advanceKernel.setArg(1, velocityBuffers[slot]);
+            advanceKernel.setArg(2, accelerationBuffers[slot]);
+            advanceKernel.setArg(3, dt);
+
+            waits = {velocitiesWritten};
+            cl::Event advanced;
+            computeQueue.enqueueNDRangeKernel(
+                        advanceKernel, cl::NullRange, cl::NDRange(count),
+                        cl::NullRange, &waits, &advanced);
+            kernelEvents.push_back(advanced);
+
+            // the download queue is in order, so the velocity readback
+            // completes last and frees the block buffers
+            waits = {advanced};
+            cl::Event positionsRead;
+            downloadQueue.enqueueReadBuffer(
+                        blockBuffers[slot], CL_FALSE, 0,
+                        count * sizeof(glm::vec4),
+                        nextPositions + blockOffset, &waits, &positionsRead);
+            downloadQueue.enqueueReadBuffer(
+                        velocityBuffers[slot], CL_FALSE, 0,
+                        count * sizeof(glm::vec3), velocities + blockOffset,
+                        &waits, &blockRead[slot]);
+            transferEvents.push_back(positionsRead);
+            transferEvents.push_back(blockRead[slot]);
+            stats.transferBytes += count * sizeof(glm::vec4)
+                    + count * sizeof(glm::vec3);
+
+            // start the queued transfers without waiting for them
+            uploadQueue.flush();
+            computeQueue.flush();
+            downloadQueue.flush();
+        }
+
+        uploadQueue.finish();
+        computeQueue.finish();
+        downloadQueue.finish();
+        collectStats();
+    } catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n", er.what(),
+               Simulator::oclErrorString(er.err()));
+        exit(EXIT_FAILURE);
+    }
+
+    std::swap(positions, nextPositions);
+
+    stats.wallMs = std::chrono::duration_cast<std::chrono::microseconds>
+            (std::chrono::system_clock::now() - start).count() / 1000.0;
+}
+
+void OutOfCore::collectStats() {
+    cl_ulong first = ~0ul;
+    cl_ulong last = 0;
+    stats.transferMs = durationMs(transferEvents, &first, &last);
+    stats.computeMs = durationMs(kernelEvents, &first, &last);
+    stats.spanMs = last > first ? (last - first) / 1.0e6 : 0;
+}
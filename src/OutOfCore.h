@@ -0,0 +1,103 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_OUTOFCORE_H_
+#define SRC_OUTOFCORE_H_
+
+#include <string>
+#include <vector>
+
+#include "Simulator.h"
+
+// Device time spent on one step, from the event profiling counters
+struct StreamingStats {
+    double wallMs = 0;
+    double transferMs = 0;
+    double computeMs = 0;
+    // first start to last end of all commands
+    double spanMs = 0;
+    size_t transferBytes = 0;
+
+    // 1 when the shorter of transfer and compute hid behind the other
+    double overlap() const;
+    double bandwidth() const;
+};
+
+// Direct summation for particle counts that do not fit on the device.
+// The state lives in host memory or a memory mapped file. Every step
+// streams i-blocks and j-tiles through two device buffers each, so the
+// upload of the next tile overlaps the computation on the current one.
+class OutOfCore {
+ public:
+    Simulator* simulator;
+
+    cl::Program program;
+    cl::Kernel accumulateKernel;
+    cl::Kernel advanceKernel;
+
+    // separate queues let uploads, kernels and readbacks run concurrently
+    cl::CommandQueue uploadQueue;
+    cl::CommandQueue computeQueue;
+    cl::CommandQueue downloadQueue;
+
+    cl::Buffer blockBuffers[2];
+    cl::Buffer velocityBuffers[2];
+    cl::Buffer accelerationBuffers[2];
+    cl::Buffer tileBuffers[2];
+
+    size_t particleCount;
+    size_t blockSize;
+    size_t tileSize;
+
+    // blocks read the positions of the last step and write the next ones
+    glm::vec4* positions;
+    glm::vec4* nextPositions;
+    glm::vec3* velocities;
+
+    char* storage;
+    size_t storageSize;
+
+    StreamingStats stats;
+
+    // with a storageFile the state is mapped from disk instead of memory,
+    // only uses the context of the simulator
+    OutOfCore(Simulator* simulator, std::string kernelSource,
+              size_t particleCount, const char* storageFile = NULL);
+    ~OutOfCore();
+
+    // fills the state with galaxies of one block each
+    void generate(unsigned int seed);
+    void step(float dt);
+    // bytes of device memory used, independent of the particle count
+    size_t deviceBytes();
+
+ private:
+    std::vector<cl::Event> transferEvents;
+    std::vector<cl::Event> kernelEvents;
+
+    void collectStats();
+};
+
+#endif  // SRC_OUTOFCORE_H_
@@ -0,0 +1,221 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "PointHierarchy.h"
+
+#include "options.h"
+#include "MemoryTracker.h"
+
+// must match local_size_x in gpu/lod.comp and gpu/cull.comp
+static const int workGroupSize = 64;
+
+// bounds min and max as two vec4
+static const int nodeSize = 8 * sizeof(GLfloat);
+// count, instanceCount, first, baseInstance
+static const int commandSize = 4 * sizeof(GLuint);
+
+static GLuint groups(int items) {
+    return (items + workGroupSize - 1) / workGroupSize;
+}
+
+PointHierarchy::PointHierarchy() {
+    buildProgram = Renderer::createComputeProgram("gpu/lod.comp");
+    cullProgram = Renderer::createComputeProgram("gpu/cull.comp");
+    capacity = 0;
+    particleCount = 0;
+    leafCount = 0;
+    groupCount = 0;
+    detailPixels = lodPixels;
+    pixelScale = 1;
+    impostorVertexArray = 0;
+}
+
+PointHierarchy::~PointHierarchy() {
+    release();
+    glDeleteProgram(buildProgram);
+    glDeleteProgram(cullProgram);
+}
+
+void PointHierarchy::release() {
+    if (!capacity)
+        return;
+    GLuint buffers[] = {nodeBuffer, impostorVBO, impostorColorVBO,
+                        particleCommandBuffer, impostorCommandBuffer};
+    glDeleteBuffers(5, buffers);
+    glDeleteVertexArrays(1, &impostorVertexArray);
+    capacity = 0;
+    memoryTracker.track("point hierarchy", GL_BUFFER_MEMORY, 0);
+}
+
+void PointHierarchy::allocate(int particles) {
+    release();
+
+    int leaves = (particles + lodClusterSize - 1) / lodClusterSize;
+    int nodes = leaves + (leaves + lodGroupSize - 1) / lodGroupSize;
+
+    nodeBuffer = Renderer::createVBO(
+                NULL, nodes * nodeSize,
+                GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    impostorVBO = Renderer::createVBO(
+                NULL, nodes * sizeof(glm::vec4),
+                GL_ARRAY_BUFFER, GL_DYNAMIC_COPY);
+    impostorColorVBO = Renderer::createVBO(
+                NULL, nodes * sizeof(GLuint),
+                GL_ARRAY_BUFFER, GL_DYNAMIC_COPY);
+    particleCommandBuffer = Renderer::createVBO(
+                NULL, leaves * commandSize,
+                GL_DRAW_INDIRECT_BUFFER, GL_DYNAMIC_COPY);
+    impostorCommandBuffer = Renderer::createVBO(
+                NULL, leaves * commandSize,
+                GL_DRAW_INDIRECT_BUFFER, GL_DYNAMIC_COPY);
+
+    capacity = particles;
+    memoryTracker.track("point hierarchy", GL_BUFFER_MEMORY,
+                        nodes * (nodeSize + sizeof(glm::vec4) + sizeof(GLuint))
+                        + 2 * leaves * commandSize);
+    createVertexArray();
+}
+
+void PointHierarchy::createVertexArray() {
+    if (!capacity)
+        return;
+
+    // the layout of gpu/impostor.vert, impostor i belongs to node i
+    glGenVertexArrays(1, &impostorVertexArray);
+    glBindVertexArray(impostorVertexArray);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, impostorVBO);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ARRAY_BUFFER, impostorColorVBO);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
+    glBindBuffer(GL_ARRAY_BUFFER, nodeBuffer);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, nodeSize, NULL);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, nodeSize,
+                          reinterpret_cast<void*>(4 * sizeof(GLfloat)));
+}
+
+void PointHierarchy::build(GLuint positionVBO,
+                           GLuint previousPositionVBO,
+                           GLuint colorVBO,
+                           int count) {
+    if (count > capacity)
+        allocate(count);
+
+    particleCount = count;
+    leafCount = (count + lodClusterSize - 1) / lodClusterSize;
+    groupCount = (leafCount + lodGroupSize - 1) / lodGroupSize;
+
+    glUseProgram(buildProgram);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, positionVBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, previousPositionVBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, colorVBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, nodeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, impostorVBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, impostorColorVBO);
+
+    glUniform1ui(glGetUniformLocation(buildProgram, "particleCount"),
+                 particleCount);
+    glUniform1ui(glGetUniformLocation(buildProgram, "clusterSize"),
+                 lodClusterSize);
+    glUniform1ui(glGetUniformLocation(buildProgram, "groupSize"),
+                 lodGroupSize);
+    glUniform1ui(glGetUniformLocation(buildProgram, "leafCount"),
+                 leafCount);
+
+    // leaves from particles
+    glUniform1ui(glGetUniformLocation(buildProgram, "level"), 0);
+    glUniform1ui(glGetUniformLocation(buildProgram, "nodeCount"),
+                 leafCount);
+    glUniform1ui(glGetUniformLocation(buildProgram, "nodeOffset"), 0);
+    glDispatchCompute(groups(leafCount), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // groups from leaves
+    glUniform1ui(glGetUniformLocation(buildProgram, "level"), 1);
+    glUniform1ui(glGetUniformLocation(buildProgram, "nodeCount"),
+                 groupCount);
+    glUniform1ui(glGetUniformLocation(buildProgram, "nodeOffset"),
+                 leafCount);
+    glDispatchCompute(groups(groupCount), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT
+                    | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void PointHierarchy::cull(const glm::mat4& view,
+                          const glm::mat4& projection,
+                          int viewportHeight) {
+    if (!leafCount)
+        return;
+
+    glUseProgram(cullProgram);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, nodeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, impostorVBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, particleCommandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, impostorCommandBuffer);
+
+    glUniformMatrix4fv(glGetUniformLocation(cullProgram, "viewMatrix"),
+                       1, GL_FALSE, &view[0][0]);
+    glUniformMatrix4fv(glGetUniformLocation(cullProgram, "projectionMatrix"),
+                       1, GL_FALSE, &projection[0][0]);
+    // projection[1][1] is the cotangent of half the vertical field of view
+    pixelScale = projection[1][1] * viewportHeight / 2;
+    glUniform1f(glGetUniformLocation(cullProgram, "pixelScale"), pixelScale);
+    glUniform1f(glGetUniformLocation(cullProgram, "lodPixels"),
+                detailPixels);
+    glUniform1ui(glGetUniformLocation(cullProgram, "particleCount"),
+                 particleCount);
+    glUniform1ui(glGetUniformLocation(cullProgram, "clusterSize"),
+                 lodClusterSize);
+    glUniform1ui(glGetUniformLocation(cullProgram, "groupSize"),
+                 lodGroupSize);
+    glUniform1ui(glGetUniformLocation(cullProgram, "leafCount"),
+                 leafCount);
+
+    glDispatchCompute(groups(leafCount), 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void PointHierarchy::draw(GLuint particleVertexArray,
+                          GLuint impostorProgram) {
+    GLint particleProgram;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &particleProgram);
+
+    glBindVertexArray(particleVertexArray);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, particleCommandBuffer);
+    glMultiDrawArraysIndirect(GL_POINTS, NULL, leafCount, 0);
+
+    glUseProgram(impostorProgram);
+    glUniform1f(glGetUniformLocation(impostorProgram, "pixelScale"),
+                pixelScale);
+    glBindVertexArray(impostorVertexArray);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, impostorCommandBuffer);
+    glMultiDrawArraysIndirect(GL_POINTS, NULL, leafCount, 0);
+
+    glUseProgram(particleProgram);
+    glBindVertexArray(particleVertexArray);
+}
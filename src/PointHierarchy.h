@@ -0,0 +1,84 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_POINTHIERARCHY_H_
+#define SRC_POINTHIERARCHY_H_
+
+#include "Renderer.h"
+
+// Two level bounding hierarchy over the Morton ordered particles, used to
+// cull and simplify the point cloud on the GPU. Leaves are clusters of
+// lodClusterSize consecutive particles, groups combine lodGroupSize
+// leaves. Every node carries an impostor point with the summed mass and
+// the average color of its particles, drawn by gpu/impostor.vert at the
+// projected size of the node.
+class PointHierarchy {
+ public:
+    GLuint buildProgram;
+    GLuint cullProgram;
+
+    // bounds of all leaves followed by all groups
+    GLuint nodeBuffer;
+    GLuint impostorVBO;
+    GLuint impostorColorVBO;
+    GLuint impostorVertexArray;
+    // one DrawArraysIndirectCommand per leaf
+    GLuint particleCommandBuffer;
+    GLuint impostorCommandBuffer;
+
+    int capacity;
+    int particleCount;
+    int leafCount;
+    int groupCount;
+    // nodes smaller than this on screen draw their impostor
+    float detailPixels;
+    // of the last cull, sizes the impostors
+    float pixelScale;
+
+    PointHierarchy();
+    ~PointHierarchy();
+
+    // rebuilds all nodes from the particles of a published state
+    void build(GLuint positionVBO,
+               GLuint previousPositionVBO,
+               GLuint colorVBO,
+               int count);
+    // writes the draw commands for the current camera
+    void cull(const glm::mat4& view,
+              const glm::mat4& projection,
+              int viewportHeight);
+    // particleVertexArray is the vertex array of the built state, drawn
+    // with the current program. impostorProgram links gpu/impostor.vert and
+    // needs the camera matrices set.
+    void draw(GLuint particleVertexArray, GLuint impostorProgram);
+    // vertex arrays are not shared, needed again for a new context
+    void createVertexArray();
+
+ private:
+    void allocate(int capacity);
+    void release();
+};
+
+#endif  // SRC_POINTHIERARCHY_H_
@@ -0,0 +1,128 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <vector>
+
+#include "ReferenceSolver.h"
+
+static const double GRAVITY = 0.000000000066742;
+
+void ReferenceSolver::load(const std::vector<glm::vec4>& pos,
+                           const std::vector<glm::vec3>& vel) {
+    size_t count = pos.size();
+    this->pos.resize(count);
+    this->vel.resize(count);
+    mass.resize(count);
+
+    for (size_t i = 0; i < count; i++) {
+        this->pos[i] = glm::dvec3(pos[i].x, pos[i].y, pos[i].z);
+        this->vel[i] = glm::dvec3(vel[i].x, vel[i].y, vel[i].z);
+        mass[i] = pos[i].w;
+    }
+}
+
+glm::dvec3 ReferenceSolver::acceleration(size_t i) const {
+    KahanSum sum[3];
+
+    for (size_t j = 0; j < pos.size(); j++) {
+        if (mass[j] == 0 || j == i)
+            continue;
+
+        glm::dvec3 distance = pos[j] - pos[i];
+        double qdistance = glm::dot(distance, distance);
+
+        // same softening cutoff as vortex
+        if (qdistance <= 0.01)
+            continue;
+
+        glm::dvec3 force =
+                distance * (GRAVITY * mass[j] / (qdistance * sqrt(qdistance)));
+        for (int k = 0; k < 3; k++)
+            sum[k].add(force[k]);
+    }
+
+    return glm::dvec3(sum[0].sum, sum[1].sum, sum[2].sum);
+}
+
+void ReferenceSolver::step(double dt) {
+    size_t count = pos.size();
+    std::vector<glm::dvec3> accelerations(count);
+    std::vector<bool> merged(count, false);
+
+    // merges happen in index order, all forces use the old positions
+    for (size_t i = 0; i < count; i++) {
+        if (mass[i] == 0)
+            continue;
+
+        for (size_t j = 0; j < count; j++) {
+            if (mass[j] == 0 || j == i)
+                continue;
+
+            glm::dvec3 distance = pos[j] - pos[i];
+            if (glm::dot(distance, distance) < 0.0001 && mass[i] < mass[j]) {
+                mass[j] += mass[i];
+                vel[j] += vel[i] * mass[i] / mass[j];
+                mass[i] = 0;
+                merged[i] = true;
+                break;
+            }
+        }
+
+        if (!merged[i])
+            accelerations[i] = acceleration(i);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (mass[i] == 0)
+            continue;
+        vel[i] += accelerations[i] * dt;
+        pos[i] += vel[i] * dt;
+    }
+}
+
+double ReferenceSolver::energy() const {
+    KahanSum kinetic;
+    KahanSum potential;
+
+    for (size_t i = 0; i < pos.size(); i++) {
+        if (mass[i] == 0)
+            continue;
+
+        kinetic.add(0.5 * mass[i] * glm::dot(vel[i], vel[i]));
+
+        for (size_t j = i + 1; j < pos.size(); j++) {
+            if (mass[j] == 0)
+                continue;
+
+            glm::dvec3 distance = pos[j] - pos[i];
+            double qdistance = glm::dot(distance, distance);
+            if (qdistance > 0.01)
+                potential.add(-GRAVITY * mass[i] * mass[j] / sqrt(qdistance));
+        }
+    }
+
+    return kinetic.sum + potential.sum;
+}
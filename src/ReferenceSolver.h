@@ -0,0 +1,62 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_REFERENCESOLVER_H_
+#define SRC_REFERENCESOLVER_H_
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Compensated summation, keeps the rounding error of every addition
+struct KahanSum {
+    double sum = 0;
+    double compensation = 0;
+
+    void add(double value) {
+        double y = value - compensation;
+        double t = sum + y;
+        compensation = (t - sum) - y;
+        sum = t;
+    }
+};
+
+// Direct summation in double precision with the same force law and merge
+// rule as the vortex kernel, used as ground truth for faster modes.
+class ReferenceSolver {
+ public:
+    std::vector<glm::dvec3> pos;
+    std::vector<glm::dvec3> vel;
+    std::vector<double> mass;
+
+    void load(const std::vector<glm::vec4>& pos,
+              const std::vector<glm::vec3>& vel);
+
+    glm::dvec3 acceleration(size_t i) const;
+    void step(double dt);
+    double energy() const;
+};
+
+#endif  // SRC_REFERENCESOLVER_H_
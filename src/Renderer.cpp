@@ -26,12 +26,16 @@
 
 #include "Renderer.h"
 
+#include "PointHierarchy.h"
 #include "util.h"
 #include "options.h"
+#include "MemoryTracker.h"
 #include <math.h>
-#include <gli/gli.hpp>
 
-Renderer::Renderer(int width, int height) {
+Renderer::Renderer(int width, int height)
+    : Renderer(width, height, loadTexture("media/cloud-big.dds")) {}
+
+Renderer::Renderer(int width, int height, const gli::texture& cloud) {
     scrollPosition = initialScrollPosition;
     theta = initialTheta;
     phi = initialPhi;
@@ -47,7 +51,7 @@ Renderer::Renderer(int width, int height) {
 
     printContextInfo();
     initShaders();
-    tex = initTexture("media/cloud-big.dds");
+    tex = initTexture(cloud);
     int pointSize[2];
     glGetIntegerv(GL_POINT_SIZE_RANGE, pointSize);
     printf("Point Size Min %d Max %d\n", pointSize[0], pointSize[1]);
@@ -78,23 +82,38 @@ Renderer::~Renderer() {
     glDeleteTextures(1, textures);
 }
 
-void Renderer::createVertexArray(GLuint positionVBO,
-                                 GLuint colorVBO,
-                                 GLuint massVBO) {
+GLuint Renderer::createVertexArray(GLuint positionVBO,
+                                   GLuint previousPositionVBO,
+                                   GLuint colorVBO) {
   glGenVertexArrays(1, &vao);
   glBindVertexArray(vao);
 
+  // position in xyz, mass in w
   glEnableVertexAttribArray(0);
   glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
   glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 
+  // RGBA8 color, normalized to [0, 1]
   glEnableVertexAttribArray(1);
   glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-  glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+  glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
 
+  // the same layout as the current position
   glEnableVertexAttribArray(2);
-  glBindBuffer(GL_ARRAY_BUFFER, massVBO);
-  glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, NULL);
+  glBindBuffer(GL_ARRAY_BUFFER, previousPositionVBO);
+  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+
+  return vao;
+}
+
+void Renderer::bindVertexArray(GLuint vertexArray) {
+  vao = vertexArray;
+  glBindVertexArray(vao);
+}
+
+void Renderer::setInterpolation(float alpha) {
+  interpolation = alpha;
+  glUniform1f(glGetUniformLocation(shader_programm, "interpolation"), alpha);
 }
 
 void Renderer::draw(int particleCount) {
@@ -103,6 +122,19 @@ void Renderer::draw(int particleCount) {
   glDrawArrays(GL_POINTS, 0, particleCount);
 }
 
+void Renderer::draw(PointHierarchy* hierarchy) {
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  hierarchy->cull(view, projection, viewportHeight);
+  glUseProgram(impostorProgram);
+  glUniformMatrix4fv(glGetUniformLocation(impostorProgram, "viewMatrix"),
+                     1, GL_FALSE, &view[0][0]);
+  glUniformMatrix4fv(glGetUniformLocation(impostorProgram, "projectionMatrix"),
+                     1, GL_FALSE, &projection[0][0]);
+  glUniform1i(glGetUniformLocation(impostorProgram, "cloud"), tex-1);
+  glUseProgram(shader_programm);
+  hierarchy->draw(vao, impostorProgram);
+}
+
 void Renderer::printContextInfo() {
     printf("GL_RENDERER: %s\n", glGetString(GL_RENDERER));
     printf("GL_VERSION: %s\n", glGetString(GL_VERSION));
@@ -110,8 +142,15 @@ void Renderer::printContextInfo() {
            glGetString(GL_SHADING_LANGUAGE_VERSION));
 }
 
+gli::texture Renderer::loadTexture(char const* Filename) {
+    return gli::load(Filename);
+}
+
 GLuint Renderer::initTexture(char const* Filename) {
-    gli::texture Texture = gli::load(Filename);
+    return initTexture(loadTexture(Filename));
+}
+
+GLuint Renderer::initTexture(const gli::texture& Texture) {
     if (Texture.empty())
         return 0;
 
@@ -168,6 +207,7 @@ GLuint Renderer::initTexture(char const* Filename) {
                                 Format.External, Format.Type,
                                 Texture.data(Layer, Face, Level));
             }
+    memoryTracker.track("cloud texture", GL_TEXTURE_MEMORY, Texture.size());
     return textureId;
 }
 
@@ -201,8 +241,61 @@ void Renderer::initShaders() {
     shader_programm = glCreateProgram();
     glAttachShader(shader_programm, fs);
     glAttachShader(shader_programm, vs);
+    // must match the attributes in createVertexArray
+    glBindAttribLocation(shader_programm, 0, "vp");
+    glBindAttribLocation(shader_programm, 1, "cp");
+    glBindAttribLocation(shader_programm, 2, "vp_prev");
     glLinkProgram(shader_programm);
     printProgramInfoLog(shader_programm);
+
+    impostorProgram = createProgram("gpu/impostor.vert", "gpu/color.frag");
+}
+
+GLuint Renderer::createProgram(const char* vertexFile,
+                               const char* fragmentFile) {
+    std::string vertexSource = readFile(vertexFile);
+    std::string fragmentSource = readFile(fragmentFile);
+    const char* vertex[] = {vertexSource.c_str()};
+    const char* fragment[] = {fragmentSource.c_str()};
+
+    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vs, 1, vertex, NULL);
+    glCompileShader(vs);
+    printShaderInfoLog(vs);
+    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fs, 1, fragment, NULL);
+    glCompileShader(fs);
+    printShaderInfoLog(fs);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, fs);
+    glAttachShader(program, vs);
+    // the same attribute layout as the main program
+    glBindAttribLocation(program, 0, "vp");
+    glBindAttribLocation(program, 1, "cp");
+    glBindAttribLocation(program, 2, "vp_prev");
+    glLinkProgram(program);
+    printProgramInfoLog(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    return program;
+}
+
+GLuint Renderer::createComputeProgram(const char* fileName) {
+    std::string source = readFile(fileName);
+    const char* compute[] = {source.c_str()};
+
+    GLuint cs = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(cs, 1, compute, NULL);
+    glCompileShader(cs);
+    printShaderInfoLog(cs);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, cs);
+    glLinkProgram(program);
+    printProgramInfoLog(program);
+    glDeleteShader(cs);
+    return program;
 }
 
 void Renderer::printShaderInfoLog(GLuint shader) {
@@ -227,7 +320,7 @@ void Renderer::translate(float z) {
     updateView();
 }
 
-void Renderer::updateView() {
+glm::mat4 Renderer::viewMatrix(float scrollPosition, float theta, float phi) {
     float radius = exp(-scrollPosition);
     glm::vec3 center(0, 0, 0);
     glm::vec3 up(0, 0, -1);
@@ -239,7 +332,17 @@ void Renderer::updateView() {
     // printf("theta %f phi %f scrollPosition %f\n",
     //   theta, phi, scrollPosition);
 
-    view = glm::lookAt(eye, center, up);
+    return glm::lookAt(eye, center, up);
+}
+
+glm::mat4 Renderer::projectionMatrix(int width, int height) {
+    float aspect = static_cast<GLfloat>(width)
+            / static_cast<GLfloat>(height);
+    return glm::perspective(fov, aspect, 0.01f, 10000.f);
+}
+
+void Renderer::updateView() {
+    view = viewMatrix(scrollPosition, theta, phi);
 
     glUniformMatrix4fv(
                 glGetUniformLocation(shader_programm, "viewMatrix"),
@@ -248,9 +351,9 @@ void Renderer::updateView() {
 
 void Renderer::updateProjection(int width, int height) {
     glViewport(0, 0, width, height);
-    float aspect = static_cast<GLfloat>(width)
-            / static_cast<GLfloat>(height);
-    projection = glm::perspective(fov, aspect, 0.01f, 10000.f);
+    viewportWidth = width;
+    viewportHeight = height;
+    projection = projectionMatrix(width, height);
     glUniformMatrix4fv(
                 glGetUniformLocation(shader_programm, "projectionMatrix"),
                 1, GL_FALSE, &projection[0][0]);
@@ -39,12 +39,17 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <gli/gli.hpp>
 
 #define glError Renderer::checkGlError(__FILE__, __LINE__)
 
+class PointHierarchy;
+
 class Renderer {
  public:
     GLuint shader_programm;
+    // nodes of a PointHierarchy, sized by their bounds
+    GLuint impostorProgram = 0;
     GLuint vao = 0;
     GLuint tex;
 
@@ -55,35 +60,61 @@ class Renderer {
 
     std::vector<std::string> shaders;
 
+    // the framebuffer the final image is drawn to, 0 for the window
+    GLuint targetFramebuffer = 0;
+    int viewportWidth;
+    int viewportHeight;
+    float interpolation = 1;
+
     float scrollPosition;
     float theta;
     float phi;
 
     Renderer(int width, int height);
+    // takes a cloud texture already loaded from disk
+    Renderer(int width, int height, const gli::texture& cloud);
     ~Renderer();
 
     void printContextInfo();
-    void printShaderInfoLog(GLuint shader);
+    static void printShaderInfoLog(GLuint shader);
     void initShaders();
     void initGL(int width, int height);
     void bindVAO();
 
     void updateView();
     void updateProjection(int width, int height);
+    // the camera matrices, also usable without a GL context
+    static glm::mat4 viewMatrix(float scrollPosition, float theta, float phi);
+    static glm::mat4 projectionMatrix(int width, int height);
 
     void rotate(float x, float y);
     void translate(float z);
 
     void draw(int particleCount);
+    // draws the visible nodes of the hierarchy at their level of detail
+    void draw(PointHierarchy* hierarchy);
     static void checkGlError(const char* file, int line);
 
     GLuint initTexture(char const* Filename);
+    GLuint initTexture(const gli::texture& Texture);
+    // reads and decodes the file, does not need a GL context
+    static gli::texture loadTexture(char const* Filename);
 
     void bindState(int width, int height);
 
-    void createVertexArray(GLuint positionVBO,
-                               GLuint colorVBO,
-                               GLuint massVBO);
+    // previousPositionVBO holds the state before positionVBO
+    GLuint createVertexArray(GLuint positionVBO,
+                             GLuint previousPositionVBO,
+                             GLuint colorVBO);
+    void bindVertexArray(GLuint vertexArray);
+    // 0 draws the previous positions, 1 the current ones
+    void setInterpolation(float alpha);
+
+    // compiles and links a vertex and a fragment shader
+    static GLuint createProgram(const char* vertexFile,
+                                const char* fragmentFile);
+    // compiles and links a single compute shader
+    static GLuint createComputeProgram(const char* fileName);
 
     static GLuint createVBO(
             const void* data,
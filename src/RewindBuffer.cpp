@@ -0,0 +1,432 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "RewindBuffer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <utility>
+
+#include <glm/gtc/packing.hpp>
+
+#include "MemoryTracker.h"
+#include "util.h"
+#include "options.h"
+
+// positions with mass and velocities
+static const int wordsPerParticle = 7;
+
+static uint32_t quantizeFloat(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits >> rewindDroppedBits;
+}
+
+static float restoreFloat(uint32_t word) {
+    uint32_t bits = word << rewindDroppedBits;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+RewindBuffer::RewindBuffer(Simulator* simulator)
+    : simulator(simulator),
+      pending(false),
+      lastCapture(0),
+      readGeneration(~0ul),
+      capacity(0),
+      stopping(false),
+      epoch(0),
+      storedBytes(0),
+      rawBytes(0),
+      keyframeEpoch(~0ul),
+      keyframeOrderGeneration(~0ul),
+      framesSinceKeyframe(0) {
+    try {
+        queue = cl::CommandQueue(simulator->context, simulator->currentDevice);
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+    worker = std::thread(&RewindBuffer::compressCaptures, this);
+}
+
+RewindBuffer::~RewindBuffer() {
+    if (pending)
+        readEvent.wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    worker.join();
+    memoryTracker.track("rewind states", HOST_MEMORY, 0);
+}
+
+void RewindBuffer::allocateBuffers() {
+    if (simulator->particleCount <= capacity)
+        return;
+
+    capacity = simulator->particleCount;
+    cl::Context& context = simulator->context;
+    positionSnapshot = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                  capacity * sizeof(cl_float4));
+    velocitySnapshot = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                  capacity * simulator->velocitySize());
+    colorSnapshot = cl::Buffer(context, CL_MEM_READ_WRITE,
+                               capacity * sizeof(GLuint));
+    idSnapshot = cl::Buffer(context, CL_MEM_READ_WRITE,
+                            capacity * sizeof(cl_uint));
+    memoryTracker.track("rewind snapshots", CL_MEMORY,
+                        capacity * (sizeof(cl_float4)
+                                    + simulator->velocitySize()
+                                    + sizeof(GLuint) + sizeof(cl_uint)));
+}
+
+void RewindBuffer::afterStep(Simulator* simulator) {
+    if (pending && readEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>()
+            == CL_COMPLETE) {
+        pending = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // a busy worker loses states rather than stalling the steps,
+            // a lost order has to be read again with the next state
+            if (captures.size() < rewindQueueLimit)
+                captures.push_back(std::move(reading));
+            else if (reading.order)
+                readGeneration = ~0ul;
+        }
+        condition.notify_all();
+    }
+
+    int count = simulator->particleCount;
+    double now = currentTime();
+    if (pending || count == 0 || now - lastCapture < rewindInterval)
+        return;
+    lastCapture = now;
+
+    try {
+        allocateBuffers();
+
+        reading = RewindCapture();
+        reading.step = simulator->stepCount;
+        reading.time = now;
+        reading.epoch = epoch;
+        reading.count = count;
+        reading.halfVelocities = simulator->halfVelocities;
+        reading.orderGeneration = simulator->orderGeneration;
+        reading.positions.resize(count);
+        reading.velocities.resize(count * simulator->velocitySize());
+        bool orderChanged = simulator->slotGeneration != readGeneration;
+        if (orderChanged) {
+            reading.order = std::make_shared<RewindOrder>();
+            reading.order->generation = simulator->slotGeneration;
+            reading.order->colors.resize(count);
+            reading.order->ids.resize(count);
+            readGeneration = simulator->slotGeneration;
+        }
+
+        // the only work on the simulation queue is a device side copy
+        std::vector<cl::Event> copies(orderChanged ? 4 : 2);
+        simulator->queue.enqueueCopyBuffer(
+                    simulator->positionBuffer, positionSnapshot, 0, 0,
+                    count * sizeof(cl_float4), NULL, &copies[0]);
+        simulator->queue.enqueueCopyBuffer(
+                    simulator->velocityBuffer, velocitySnapshot, 0, 0,
+                    reading.velocities.size(), NULL, &copies[1]);
+        if (orderChanged) {
+            simulator->queue.enqueueCopyBuffer(
+                        simulator->colorBuffer, colorSnapshot, 0, 0,
+                        count * sizeof(GLuint), NULL, &copies[2]);
+            simulator->queue.enqueueCopyBuffer(
+                        simulator->idBuffer, idSnapshot, 0, 0,
+                        count * sizeof(cl_uint), NULL, &copies[3]);
+        }
+        simulator->queue.flush();
+
+        queue.enqueueReadBuffer(positionSnapshot, CL_FALSE, 0,
+                                count * sizeof(cl_float4),
+                                reading.positions.data(), &copies);
+        queue.enqueueReadBuffer(velocitySnapshot, CL_FALSE, 0,
+                                reading.velocities.size(),
+                                reading.velocities.data(), &copies,
+                                &readEvent);
+        if (orderChanged) {
+            queue.enqueueReadBuffer(colorSnapshot, CL_FALSE, 0,
+                                    count * sizeof(GLuint),
+                                    reading.order->colors.data(), &copies);
+            queue.enqueueReadBuffer(idSnapshot, CL_FALSE, 0,
+                                    count * sizeof(cl_uint),
+                                    reading.order->ids.data(), &copies,
+                                    &readEvent);
+        }
+        queue.flush();
+        pending = true;
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+}
+
+void RewindBuffer::quantize(const RewindCapture& capture,
+                            std::vector<uint32_t>* words) {
+    int count = capture.count;
+    words->resize(count * wordsPerParticle);
+    uint32_t* word = words->data();
+    const cl_half* halves =
+            reinterpret_cast<const cl_half*>(capture.velocities.data());
+    const float* floats =
+            reinterpret_cast<const float*>(capture.velocities.data());
+    for (int i = 0; i < count; i++) {
+        for (int c = 0; c < 4; c++)
+            *word++ = quantizeFloat(capture.positions[i][c]);
+        for (int c = 3 * i; c < 3 * i + 3; c++)
+            *word++ = quantizeFloat(capture.halfVelocities
+                                    ? glm::unpackHalf1x16(halves[c])
+                                    : floats[c]);
+    }
+}
+
+// a particle the keyframe does not have yet is XORed with 0
+static uint32_t keyframeWord(const std::vector<uint32_t>* keyframe,
+                             size_t i) {
+    if (!keyframe || i >= keyframe->size())
+        return 0;
+    return (*keyframe)[i];
+}
+
+// Words XORed with the keyframe keep only the bits that changed, written
+// as variable length integers with 7 bits per byte
+void RewindBuffer::encode(const std::vector<uint32_t>& words,
+                          const std::vector<uint32_t>* keyframe,
+                          std::vector<unsigned char>* data) {
+    data->clear();
+    data->reserve(words.size() * 2);
+    for (size_t i = 0; i < words.size(); i++) {
+        uint32_t word = words[i] ^ keyframeWord(keyframe, i);
+        while (word >= 0x80) {
+            data->push_back(static_cast<unsigned char>(word | 0x80));
+            word >>= 7;
+        }
+        data->push_back(static_cast<unsigned char>(word));
+    }
+    data->shrink_to_fit();
+}
+
+void RewindBuffer::decode(const std::vector<unsigned char>& data,
+                          const std::vector<uint32_t>* keyframe,
+                          std::vector<uint32_t>* words) {
+    words->clear();
+    size_t position = 0;
+    while (position < data.size()) {
+        uint32_t word = 0;
+        int shift = 0;
+        unsigned char byte;
+        do {
+            byte = data[position++];
+            word |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        words->push_back(word ^ keyframeWord(keyframe, words->size()));
+    }
+}
+
+void RewindBuffer::compressCaptures() {
+    std::vector<uint32_t> words;
+    while (true) {
+        RewindCapture capture;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() {
+                return stopping || !captures.empty();
+            });
+            if (stopping)
+                return;
+            capture = std::move(captures.front());
+            captures.pop_front();
+        }
+
+        quantize(capture, &words);
+        // spawned particles only change some slots and are encoded
+        // against the keyframe like any other change, a new order moves
+        // all of them
+        bool keyframe = capture.orderGeneration != keyframeOrderGeneration
+                || capture.epoch != keyframeEpoch
+                || framesSinceKeyframe >= rewindKeyframeInterval;
+
+        RewindFrame frame;
+        frame.step = capture.step;
+        frame.time = capture.time;
+        frame.count = capture.count;
+        frame.keyframe = keyframe;
+        frame.order = capture.order ? capture.order : lastOrder;
+        lastOrder = frame.order;
+        encode(words, keyframe ? NULL : &keyframeWords, &frame.data);
+
+        size_t orderBytes = capture.count * (sizeof(GLuint)
+                                             + sizeof(cl_uint));
+        frame.bytes = frame.data.size() + (capture.order ? orderBytes : 0);
+        frame.rawBytes = capture.count * (sizeof(glm::vec4)
+                                          + sizeof(glm::vec3))
+                + orderBytes;
+
+        if (keyframe) {
+            keyframeWords.swap(words);
+            keyframeEpoch = capture.epoch;
+            keyframeOrderGeneration = capture.orderGeneration;
+            framesSinceKeyframe = 0;
+        } else {
+            framesSinceKeyframe++;
+        }
+        store(std::move(frame), capture.epoch);
+    }
+}
+
+void RewindBuffer::store(RewindFrame&& frame, unsigned long frameEpoch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // captured before a rewind, it belongs to the discarded future
+    if (frameEpoch != epoch)
+        return;
+
+    storedBytes += frame.bytes;
+    rawBytes += frame.rawBytes;
+    frames.push_back(std::move(frame));
+
+    // the oldest keyframe goes together with the frames encoded against
+    // it, the newest keyframe is always kept
+    while (storedBytes > rewindMemory) {
+        size_t next = 1;
+        while (next < frames.size() && !frames[next].keyframe)
+            next++;
+        if (next == frames.size())
+            break;
+        for (size_t i = 0; i < next; i++) {
+            storedBytes -= frames.front().bytes;
+            rawBytes -= frames.front().rawBytes;
+            frames.pop_front();
+        }
+    }
+    memoryTracker.track("rewind states", HOST_MEMORY, storedBytes);
+}
+
+bool RewindBuffer::rewind(Simulator* simulator, double seconds) {
+    double start = currentTime();
+    std::vector<glm::vec4> pos;
+    std::vector<glm::vec3> vel;
+    std::shared_ptr<const RewindOrder> order;
+    unsigned long step;
+    double age;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (frames.empty()) {
+            printf("No state to rewind to yet\n");
+            return false;
+        }
+
+        // the newest state old enough, or the oldest one there is
+        size_t index = 0;
+        for (size_t i = 0; i < frames.size(); i++)
+            if (frames[i].time <= start - seconds)
+                index = i;
+        const RewindFrame& frame = frames[index];
+        if (frame.count > simulator->particleCapacity) {
+            printf("Rewind ignored: %d particles exceed capacity %d\n",
+                   frame.count, simulator->particleCapacity);
+            return false;
+        }
+        size_t frameCount = frame.count;
+        if (!frame.order || frame.order->colors.size() != frameCount
+                || frame.order->ids.size() != frameCount) {
+            printf("Rewind ignored: no colors and ids for the %d particles "
+                   "of the state\n", frame.count);
+            return false;
+        }
+
+        size_t key = index;
+        while (!frames[key].keyframe)
+            key--;
+        std::vector<uint32_t> keyWords, words;
+        decode(frames[key].data, NULL, &keyWords);
+        if (key == index)
+            words.swap(keyWords);
+        else
+            decode(frame.data, &keyWords, &words);
+
+        int count = frame.count;
+        pos.resize(count);
+        vel.resize(count);
+        const uint32_t* word = words.data();
+        for (int i = 0; i < count; i++) {
+            for (int c = 0; c < 4; c++)
+                pos[i][c] = restoreFloat(*word++);
+            for (int c = 0; c < 3; c++)
+                vel[i][c] = restoreFloat(*word++);
+        }
+        order = frame.order;
+        step = frame.step;
+        age = start - frame.time;
+
+        // the states after it belong to the future that is discarded
+        while (frames.size() > index + 1) {
+            storedBytes -= frames.back().bytes;
+            rawBytes -= frames.back().rawBytes;
+            frames.pop_back();
+        }
+        captures.clear();
+        // the cleared captures may have carried the current order
+        readGeneration = ~0ul;
+        epoch++;
+        memoryTracker.track("rewind states", HOST_MEMORY, storedBytes);
+    }
+
+    // a readback in flight is from the discarded future as well
+    if (pending) {
+        readEvent.wait();
+        pending = false;
+    }
+
+    simulator->loadData(pos, vel, order->colors, order->ids);
+    simulator->stepCount = step;
+    lastCapture = currentTime();
+    printf("Rewound %.2f s to step %lu in %.1f ms\n", age, step,
+           (lastCapture - start) * 1000);
+    print();
+    return true;
+}
+
+void RewindBuffer::print() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frames.empty())
+        return;
+    printf("Rewind buffer: %zu states over %.1f s, %.1f of %.1f MB, "
+           "compression ratio %.2f\n", frames.size(),
+           frames.back().time - frames.front().time, storedBytes / 1.0e6,
+           rewindMemory / 1.0e6,
+           storedBytes ? static_cast<double>(rawBytes) / storedBytes : 0);
+}
@@ -0,0 +1,148 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_REWINDBUFFER_H_
+#define SRC_REWINDBUFFER_H_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Simulator.h"
+
+// Colors and ids of the particles in their slots, shared by all states
+// captured while no slot changed
+struct RewindOrder {
+    unsigned long generation;
+    std::vector<GLuint> colors;
+    std::vector<cl_uint> ids;
+};
+
+// A state as read back from the device
+struct RewindCapture {
+    unsigned long step;
+    double time;
+    // restores since the start, captures of an older one are dropped
+    unsigned long epoch;
+    int count;
+    bool halfVelocities;
+    // keyframes start with every sort
+    unsigned long orderGeneration;
+    std::vector<glm::vec4> positions;
+    // the device storage, float3 or half3
+    std::vector<unsigned char> velocities;
+    // only read when a slot changed since the last capture
+    std::shared_ptr<RewindOrder> order;
+};
+
+struct RewindFrame {
+    unsigned long step;
+    double time;
+    int count;
+    // keyframes are encoded on their own, the others against the
+    // keyframe before them
+    bool keyframe;
+    std::vector<unsigned char> data;
+    std::shared_ptr<const RewindOrder> order;
+    // held in memory, including an order first used by this frame
+    size_t bytes;
+    // the same state uncompressed
+    size_t rawBytes;
+};
+
+// A bounded ring of recent states in host memory. Every rewindInterval
+// seconds the state is copied on the device and read back on a separate
+// queue, a worker thread quantizes positions, masses and velocities by
+// dropping rewindDroppedBits mantissa bits, XORs them with the last
+// keyframe and stores the result as variable length integers. The oldest
+// keyframes and their frames are dropped to stay below rewindMemory.
+class RewindBuffer : public SimulationStage {
+ public:
+    cl::CommandQueue queue;
+    cl::Buffer positionSnapshot;
+    cl::Buffer velocitySnapshot;
+    cl::Buffer colorSnapshot;
+    cl::Buffer idSnapshot;
+
+    explicit RewindBuffer(Simulator* simulator);
+    // waits for the worker
+    ~RewindBuffer();
+
+    void afterStep(Simulator* simulator) override;
+    // loads the newest state at least seconds old, or the oldest one, and
+    // drops the states after it. Runs on the simulation thread.
+    bool rewind(Simulator* simulator, double seconds);
+    void print();
+
+    // the quantized words of a state, position and velocity of every
+    // particle in turn, so a particle keeps its words when more follow
+    static void quantize(const RewindCapture& capture,
+                         std::vector<uint32_t>* words);
+    static void encode(const std::vector<uint32_t>& words,
+                       const std::vector<uint32_t>* keyframe,
+                       std::vector<unsigned char>* data);
+    static void decode(const std::vector<unsigned char>& data,
+                       const std::vector<uint32_t>* keyframe,
+                       std::vector<uint32_t>* words);
+
+ private:
+    Simulator* simulator;
+
+    // device copy and readback in flight
+    RewindCapture reading;
+    bool pending;
+    cl::Event readEvent;
+    double lastCapture;
+    unsigned long readGeneration;
+    int capacity;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<RewindCapture> captures;
+    std::deque<RewindFrame> frames;
+    bool stopping;
+    unsigned long epoch;
+    size_t storedBytes;
+    // bytes the stored states would take uncompressed
+    size_t rawBytes;
+
+    // only used by the worker
+    std::vector<uint32_t> keyframeWords;
+    std::shared_ptr<const RewindOrder> lastOrder;
+    unsigned long keyframeEpoch;
+    unsigned long keyframeOrderGeneration;
+    int framesSinceKeyframe;
+
+    void allocateBuffers();
+    void compressCaptures();
+    void store(RewindFrame&& frame, unsigned long frameEpoch);
+};
+
+#endif  // SRC_REWINDBUFFER_H_
@@ -0,0 +1,138 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <random>
+
+#include "Scenarios.h"
+#include "options.h"
+#include <glm/gtc/packing.hpp>
+
+ParticleData generateSolarSystem(float radius, float sateliteMass) {
+    ParticleData data;
+
+    float gravity = 0.000000000066742;
+    float centralMass = 1000;
+
+    // create central mass particle
+    data.pos.push_back(glm::vec4(0, 0, 0, centralMass));
+    data.vel.push_back(glm::vec3(0, 0, 0));
+    data.color.push_back(glm::packUnorm4x8(glm::vec4(1, 0, 0, 1)));
+
+    // calculate inertial direction/tangent on circle
+    glm::vec4 tangent =
+            glm::vec4(
+                cos(2 * M_PI * 0.1),
+                -sin(2 * M_PI * 0.1), 0, 1);
+    // normalize tangent
+    glm::vec4 normalizedTanent = glm::normalize(tangent);
+
+    // calculate inertial acceleration of satelite to match a stable orbit
+    float acceleration = sqrt(gravity * centralMass / radius);
+
+    // create satellite particle
+    data.pos.push_back(glm::vec4(0, radius, 0, sateliteMass));
+    data.vel.push_back(glm::vec3(normalizedTanent) * acceleration);
+    data.color.push_back(glm::packUnorm4x8(glm::vec4(0, 1, 0, 1)));
+
+    return data;
+}
+
+ParticleData generateGalaxy(int count, unsigned int seed) {
+    ParticleData data;
+
+    // the mass of each particle is stored in the w component of pos
+    std::vector<glm::vec4>& pos = data.pos;
+    std::vector<glm::vec3>& vel = data.vel;
+    std::vector<GLuint>& color = data.color;
+    pos.resize(count);
+    vel.resize(count);
+    color.resize(count);
+
+    std::mt19937 e2(seed);
+
+    float meanRadius = 20;
+    std::normal_distribution<> radiusDistribution(meanRadius, meanRadius/2.0);
+    std::normal_distribution<> positionDistribution(0.5, 0.5);
+    std::normal_distribution<> heightDistribution(0, .5);
+    std::uniform_real_distribution<> massDistribution(1, 50);
+
+    for (int i = 0; i < count; i++) {
+        // distribute the particles in a circle
+        float radius = radiusDistribution(e2);
+        float arrayPositionRatio = positionDistribution(e2);
+
+        pos[i] = glm::vec4(radius * sin(2 * M_PI * arrayPositionRatio),
+                      radius * cos(2 * M_PI * arrayPositionRatio),
+                      heightDistribution(e2), 0);
+
+        // distribute masses
+        pos[i].w = massDistribution(e2);
+
+        // give initial velocity in circle tangent direction
+        glm::vec4 tangent = glm::vec4(
+                    cos(2 * M_PI * arrayPositionRatio),
+                    -sin(2 * M_PI * arrayPositionRatio), 0, 1);
+        glm::vec4 normalizedTanent = glm::normalize(tangent);
+
+        float acceleration = 0.001 * (radius/meanRadius*0.75);
+        vel[i] = glm::vec3(normalizedTanent) * acceleration;
+
+        // set color. bigger radius blue, closer to center red
+        color[i] = glm::packUnorm4x8(
+                    glm::mix(glm::vec4(.9, .1, .1, 1),
+                             glm::vec4(.1, .1, .9, 1),
+                             radius / 30.0));
+    }
+
+    if (count > 1) {
+        pos[1] = glm::vec4(0, 0, 0, bigMass);
+        vel[1] = glm::vec3(0, 0, 0);
+    }
+
+    return data;
+}
+
+ParticleData generateJet(int count, unsigned int seed) {
+    ParticleData data;
+    data.pos.resize(count);
+    data.vel.resize(count);
+    data.color.resize(count);
+
+    std::mt19937 e2(seed);
+    std::normal_distribution<> spreadDistribution(0, jetSpread);
+    std::uniform_real_distribution<> speedDistribution(0.5, 1);
+
+    for (int i = 0; i < count; i++) {
+        glm::vec3 offset(spreadDistribution(e2), spreadDistribution(e2), 0);
+        data.pos[i] = glm::vec4(offset, jetMass);
+        // slightly diverging, so the jet widens with the distance
+        data.vel[i] = glm::vec3(offset.x, offset.y, 1)
+                * jetSpeed * static_cast<float>(speedDistribution(e2));
+        data.color[i] = glm::packUnorm4x8(glm::vec4(.9, .9, .3, 1));
+    }
+
+    return data;
+}
@@ -0,0 +1,53 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_SCENARIOS_H_
+#define SRC_SCENARIOS_H_
+
+#include <vector>
+
+#include "GL/gl3w.h"
+#include <glm/glm.hpp>
+
+// Initial conditions in the layout Simulator::loadData expects
+struct ParticleData {
+    // xyz is the position, w the mass
+    std::vector<glm::vec4> pos;
+    std::vector<glm::vec3> vel;
+    // packed RGBA8
+    std::vector<GLuint> color;
+};
+
+// A disc of particles orbiting the center, reproducible for a given seed
+ParticleData generateGalaxy(int count, unsigned int seed);
+
+// A satellite on a circular orbit around a central mass
+ParticleData generateSolarSystem(float radius = 20,
+                                 float sateliteMass = 100);
+
+// A burst of particles leaving the center along z, for spawning
+ParticleData generateJet(int count, unsigned int seed);
+
+#endif  // SRC_SCENARIOS_H_
@@ -0,0 +1,194 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "SimulationThread.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "Scenarios.h"
+#include "Metrics.h"
+#include "options.h"
+
+SimulationThread::SimulationThread(Simulator* simulator,
+                                   MortonOrder* mortonOrder,
+                                   Diagnostics* diagnostics,
+                                   ClusterBounds* bounds,
+                                   RewindBuffer* rewindBuffer)
+    : simulator(simulator),
+      mortonOrder(mortonOrder),
+      diagnostics(diagnostics),
+      bounds(bounds),
+      rewindBuffer(rewindBuffer),
+      stepMs(0),
+      substeps(0),
+      dtScale(1),
+      jetRate(0),
+      requiredCapacity(0),
+      running(false),
+      stepCredit(0),
+      grantedFrames(0),
+      completedFrame(0),
+      shownFrame(0),
+      nextPrintStep(0),
+      baseDt(simulator->dt) {}
+
+SimulationThread::~SimulationThread() {
+    stop();
+}
+
+void SimulationThread::start() {
+    running = true;
+    thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop() {
+    running = false;
+    if (thread.joinable())
+        thread.join();
+}
+
+bool SimulationThread::send(const SimulationCommand& command) {
+    return commands.push(command);
+}
+
+void SimulationThread::frame() {
+    // a slow simulation keeps its unused steps, but does not build up
+    // more than a few frames of them
+    int granted = substeps;
+    int credit = stepCredit;
+    while (!stepCredit.compare_exchange_weak(
+               credit, std::min(credit + granted,
+                                granted * substepCreditFrames))) {}
+    grantedFrames++;
+}
+
+void SimulationThread::execute(const SimulationCommand& command) {
+    switch (command.type) {
+        case SimulationCommand::SET_DT:
+            baseDt = command.dt;
+            break;
+        case SimulationCommand::RESET: {
+            ParticleData data = generateGalaxy(NUM_PARTICLES, command.seed);
+            // growing the published VBOs would need the GL context
+            if (static_cast<int>(data.pos.size())
+                    > simulator->particleCapacity) {
+                printf("Reset ignored: %zu particles exceed capacity %d\n",
+                       data.pos.size(), simulator->particleCapacity);
+                break;
+            }
+            simulator->loadData(data.pos, data.vel, data.color);
+            break;
+        }
+        case SimulationCommand::REWIND:
+            rewindBuffer->rewind(simulator, command.seconds);
+            break;
+    }
+}
+
+void SimulationThread::spawnParticles() {
+    int rate = jetRate;
+    // nothing new is emitted until the waiting particles fit
+    if (backlog.pos.empty() && rate > 0)
+        backlog = generateJet(rate, simulator->stepCount);
+    if (backlog.pos.empty())
+        return;
+
+    int spawned = simulator->spawn(backlog.pos, backlog.vel, backlog.color);
+    backlog.pos.erase(backlog.pos.begin(), backlog.pos.begin() + spawned);
+    backlog.vel.erase(backlog.vel.begin(), backlog.vel.begin() + spawned);
+    backlog.color.erase(backlog.color.begin(),
+                        backlog.color.begin() + spawned);
+    requiredCapacity = backlog.pos.empty()
+            ? 0 : simulator->particleCount + backlog.pos.size();
+}
+
+void SimulationThread::run() {
+    while (running) {
+        SimulationCommand command;
+        metrics.commandQueueDepth.set(commands.size());
+        while (commands.pop(&command))
+            execute(command);
+
+        // wait for the next frame once its substeps are done
+        bool paced = substeps > 0;
+        if (paced && stepCredit <= 0) {
+            std::this_thread::sleep_for(
+                        std::chrono::microseconds(simulationIdleMicroseconds));
+            continue;
+        }
+
+        std::chrono::time_point<std::chrono::steady_clock> start =
+                std::chrono::steady_clock::now();
+
+        spawnParticles();
+        simulator->dt = baseDt * dtScale;
+        simulator->runKernel();
+        // the curve follows the bounds of the last evaluated state, which
+        // arrive at a different step every run
+        if (diagnostics->poll()) {
+            if (!simulator->deterministic)
+                mortonOrder->fitBounds(diagnostics->stats.boundsMin,
+                                       diagnostics->stats.boundsMax);
+            metrics.liveParticles.set(diagnostics->stats.liveParticles);
+            // a rewind or reset moves the steps back
+            unsigned long step = diagnostics->statsStep;
+            if (step >= nextPrintStep
+                    || step + diagnosticsPrintInterval < nextPrintStep) {
+                diagnostics->print();
+                nextPrintStep = (step / diagnosticsPrintInterval + 1)
+                        * diagnosticsPrintInterval;
+            }
+        }
+        // the bounds are refitted every step, sorting only pays off once
+        // the clusters got loose
+        if (bounds->needsRebuild()) {
+            mortonOrder->reorder();
+            bounds->rebuilt();
+        }
+
+        // only the last substep of a frame is shown, but when the steps
+        // fall behind the frames every new frame still gets one state
+        unsigned long frame = grantedFrames;
+        bool lastSubstep = !paced || --stepCredit <= 0;
+        if (lastSubstep)
+            completedFrame = frame;
+        bool lateFrame = frame != shownFrame && frame > completedFrame + 1;
+        if (lastSubstep || lateFrame) {
+            simulator->publish();
+            shownFrame = frame;
+        }
+
+        stepMs = std::chrono::duration_cast<std::chrono::microseconds>
+                (std::chrono::steady_clock::now() - start).count() / 1000.0;
+
+        uint64_t particles = simulator->particleCount;
+        metrics.stepSeconds.observe(stepMs / 1000);
+        metrics.steps.add();
+        metrics.interactions.add(particles * particles);
+    }
+}
@@ -0,0 +1,116 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_SIMULATIONTHREAD_H_
+#define SRC_SIMULATIONTHREAD_H_
+
+#include <atomic>
+#include <thread>
+
+#include "Simulator.h"
+#include "MortonOrder.h"
+#include "Diagnostics.h"
+#include "ClusterBounds.h"
+#include "RewindBuffer.h"
+#include "Scenarios.h"
+#include "SpscQueue.h"
+
+// Input sent from the render thread to the simulation thread
+struct SimulationCommand {
+    enum Type {
+        SET_DT,
+        RESET,
+        REWIND
+    };
+    Type type;
+    float dt;
+    unsigned int seed;
+    // how far REWIND goes back
+    double seconds;
+};
+
+// Steps the simulation as fast as the device allows and publishes every
+// step to the renderer, independent of the display rate. With substeps
+// set it runs that many steps per rendered frame and publishes the last,
+// or the current step once the renderer asked for the next frame.
+class SimulationThread {
+ public:
+    Simulator* simulator;
+    MortonOrder* mortonOrder;
+    Diagnostics* diagnostics;
+    // decides when the particles are sorted again
+    ClusterBounds* bounds;
+    RewindBuffer* rewindBuffer;
+
+    // duration of the last step including the publish copy
+    std::atomic<double> stepMs;
+    // steps per frame(), 0 runs freely
+    std::atomic<int> substeps;
+    // multiplies the dt set with SET_DT
+    std::atomic<float> dtScale;
+    // particles the jet spawns every step, 0 turns it off
+    std::atomic<int> jetRate;
+    // capacity the particles waiting to be spawned need, grown by the
+    // render thread with Simulator::reserve() while this one is stopped
+    std::atomic<int> requiredCapacity;
+
+    SimulationThread(Simulator* simulator,
+                     MortonOrder* mortonOrder,
+                     Diagnostics* diagnostics,
+                     ClusterBounds* bounds,
+                     RewindBuffer* rewindBuffer);
+    ~SimulationThread();
+
+    void start();
+    void stop();
+    // called from the render thread, false if the queue is full
+    bool send(const SimulationCommand& command);
+    // called from the render thread once per frame, grants the substeps
+    void frame();
+
+ private:
+    std::thread thread;
+    std::atomic<bool> running;
+    SpscQueue<SimulationCommand, 64> commands;
+    // steps granted and not yet run, at most substepCreditFrames frames
+    std::atomic<int> stepCredit;
+    // frames granted by frame(), the last one whose substeps were all
+    // run and the last one anything was published in
+    std::atomic<unsigned long> grantedFrames;
+    unsigned long completedFrame;
+    unsigned long shownFrame;
+    // the first evaluated step at or after it prints the diagnostics,
+    // evaluations are skipped while one is in flight
+    unsigned long nextPrintStep;
+    float baseDt;
+    // spawned particles that did not fit yet
+    ParticleData backlog;
+
+    void run();
+    void spawnParticles();
+    void execute(const SimulationCommand& command);
+};
+
+#endif  // SRC_SIMULATIONTHREAD_H_
@@ -25,14 +25,20 @@
  */
 
 #include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
 #include <string>
+#include <thread>
 #include <iostream>
 
 #include "Simulator.h"
 #include "Renderer.h"
+#include "MemoryTracker.h"
 #include "util.h"
 #include "options.h"
 #include <GL/glx.h>
+#include <glm/gtc/packing.hpp>
 
 using std::string;
 
@@ -49,16 +55,11 @@ static std::string deviceTypeToString(int type) {
     }
 }
 
-Simulator::Simulator() {
+DeviceSelection Simulator::selectDevice() {
     std::vector<cl::Platform> platforms;
-    cl::Platform currentPlatform;
+    DeviceSelection selection;
     cl_int err = cl::Platform::get(&platforms);
 
-    positionVBO = 0;
-    colorVBO = 0;
-    massVBO = 0;
-
-
     if (err != CL_SUCCESS) {
         printf("Error getting platforms: %s\n", oclErrorString(err));
         exit(0);
@@ -83,8 +84,8 @@ Simulator::Simulator() {
             string deviceName = device.getInfo<CL_DEVICE_NAME>();
             printf("%s: %s\n", type.c_str(), deviceName.c_str());
 
-            currentPlatform = platform;
-            currentDevice = device;
+            selection.platform = platform;
+            selection.device = device;
             /*
             if (deviceName.compare(
              "Intel(R) HD Graphics Haswell Ultrabook GT3 Mobile") == 0) {
@@ -92,6 +93,25 @@ Simulator::Simulator() {
             */
         }
     }
+    return selection;
+}
+
+Simulator::Simulator() : Simulator(selectDevice()) {}
+
+Simulator::Simulator(const DeviceSelection& selection, bool shareGL) {
+    cl::Platform currentPlatform = selection.platform;
+    currentDevice = selection.device;
+    cl_int err;
+
+    particleCapacity = 0;
+    particleCount = 0;
+    halfVelocities = false;
+    deterministic = false;
+    workGroupSize = 0;
+    orderGeneration = 0;
+    slotGeneration = 0;
+    nextParticleId = 0;
+    spawnCapacity = 0;
 
     cl_context_properties props[] = {
         CL_GL_CONTEXT_KHR,
@@ -102,13 +122,32 @@ Simulator::Simulator() {
         reinterpret_cast<cl_context_properties>((currentPlatform)()),
         0
     };
+    cl_context_properties platformProps[] = {
+        CL_CONTEXT_PLATFORM,
+        reinterpret_cast<cl_context_properties>((currentPlatform)()),
+        0
+    };
     // cl_context cxGPUContext =
     // clCreateContext(props, 1, &cdDevices[uiDeviceUsed], NULL, NULL, &err);
-    try {
-        context = cl::Context(CL_DEVICE_TYPE_GPU, props);
-    } catch (cl::Error er) {
-        printf("ERROR: Could not create CL context. %s(%s) %d\n",
-               er.what(), oclErrorString(er.err()), er.err());
+    std::vector<cl::Device> devices = {currentDevice};
+    interop = shareGL && currentDevice.getInfo<CL_DEVICE_EXTENSIONS>().find(
+                "cl_khr_gl_sharing") != string::npos;
+    if (interop) {
+        try {
+            context = cl::Context(devices, props);
+        } catch (cl::Error er) {
+            printf("GL sharing failed, using mapped buffers. %s(%s)\n",
+                   er.what(), oclErrorString(er.err()));
+            interop = false;
+        }
+    }
+    if (!interop) {
+        try {
+            context = cl::Context(devices, platformProps);
+        } catch (cl::Error er) {
+            printf("ERROR: Could not create CL context. %s(%s) %d\n",
+                   er.what(), oclErrorString(er.err()), er.err());
+        }
     }
 
     // create the command queue we will use to execute OpenCL commands
@@ -119,17 +158,144 @@ Simulator::Simulator() {
     }
     // gravities = (float *)malloc(particleCount*sizeof(float));
     dt = slowDt;
+    stepCount = 0;
 }
 
 Simulator::~Simulator() {}
 
+// A VBO the simulation thread writes through a pointer while GL draws
+// from it, coherent so no flush is needed before the draw
+static GLuint createMappedVBO(size_t size, void** mapped) {
+    GLbitfield flags =
+            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLuint id;
+    glGenBuffers(1, &id);
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+    *mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return id;
+}
+
+// fp32 velocities are used as they are, half ones converted into halves
+static const void* packVelocities(const glm::vec3* vel, int count,
+                                  bool half, std::vector<cl_half>* halves) {
+    if (!half)
+        return vel;
+    halves->resize(3 * count);
+    for (int i = 0; i < 3 * count; i++)
+        (*halves)[i] = glm::packHalf1x16(vel[i / 3][i % 3]);
+    return halves->data();
+}
+
+size_t Simulator::velocitySize() const {
+    return halfVelocities ? 3 * sizeof(cl_half) : 3 * sizeof(cl_float);
+}
+
+void Simulator::setHalfVelocities(bool enabled) {
+    if (enabled == halfVelocities)
+        return;
+    halfVelocities = enabled;
+    // the velocity buffer has to be recreated with the new element size
+    particleCapacity = 0;
+}
+
+void Simulator::setDeterministic(bool enabled) {
+    if (enabled == deterministic)
+        return;
+    deterministic = enabled;
+    // the snapshot and merge target buffers are only allocated if needed
+    particleCapacity = 0;
+}
+
+size_t Simulator::simulationBytes() const {
+    size_t bytes = sizeof(glm::vec4) + velocitySize() + sizeof(GLuint)
+            + sizeof(cl_uint);
+    if (deterministic)
+        bytes += sizeof(glm::vec4) + sizeof(cl_int);
+    return bytes;
+}
+
+MemoryFootprint Simulator::projectFootprint(int count) const {
+    MemoryFootprint footprint;
+    // Morton keys, both orders and gather scratch, diagnostics snapshots
+    size_t orderBytes = sizeof(cl_ulong) + 2 * sizeof(cl_uint)
+            + sizeof(cl_float4);
+    size_t snapshotBytes = sizeof(cl_float4) + velocitySize();
+    // three published states and the previous positions
+    size_t drawBytes = 3 * (sizeof(glm::vec4) + sizeof(GLuint))
+            + sizeof(glm::vec4);
+    footprint.deviceBytesPerParticle =
+            simulationBytes() + orderBytes + snapshotBytes + drawBytes;
+
+    // ids stay resident, the generated particles exist twice while they
+    // are loaded
+    size_t residentBytes = sizeof(cl_uint);
+    size_t generatedBytes = sizeof(glm::vec4) + sizeof(glm::vec3)
+            + sizeof(GLuint);
+    footprint.hostBytesPerParticle = residentBytes + 2 * generatedBytes;
+
+    footprint.deviceBytes = count * footprint.deviceBytesPerParticle;
+    footprint.hostBytes = count * footprint.hostBytesPerParticle;
+    footprint.largestBuffer = count * sizeof(cl_float4);
+    return footprint;
+}
+
+bool Simulator::fitMemory(int count) {
+    size_t deviceMemory =
+            currentDevice.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    size_t maxAllocation =
+            currentDevice.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+    size_t hostMemory = static_cast<size_t>(sysconf(_SC_PHYS_PAGES))
+            * sysconf(_SC_PAGE_SIZE);
+    size_t deviceBudget = deviceMemory * memoryBudget;
+    size_t hostBudget = hostMemory * memoryBudget;
+
+    for (;;) {
+        MemoryFootprint footprint = projectFootprint(count);
+        printf("Projected memory for %d particles: %.1f MB device "
+               "(%zu B per particle) of %.1f MB, %.1f MB host "
+               "(%zu B per particle) of %.1f MB\n",
+               count, footprint.deviceBytes / 1.0e6,
+               footprint.deviceBytesPerParticle, deviceBudget / 1.0e6,
+               footprint.hostBytes / 1.0e6,
+               footprint.hostBytesPerParticle, hostBudget / 1.0e6);
+
+        bool fits = footprint.deviceBytes <= deviceBudget
+                && footprint.largestBuffer <= maxAllocation
+                && footprint.hostBytes <= hostBudget;
+        if (fits)
+            return true;
+
+        // half velocities are the only thing that shrinks the footprint
+        // without changing the particle count
+        if (halfVelocities || footprint.hostBytes > hostBudget)
+            break;
+        printf("Storing velocities as half precision to fit\n");
+        setHalfVelocities(true);
+    }
 
-void Simulator::loadProgram(std::string kernel_source) {
+    printf("ERROR: %d particles do not fit into memory, use fewer or "
+           "run them out-of-core with --stream\n", count);
+    return false;
+}
+
+
+cl::Program Simulator::buildProgram(std::string kernel_source,
+                                    std::string options) {
+    cl::Program built;
     int pl = kernel_source.size();
+
+    // the kernels include gpu/storage.cl
+    options += " -I gpu";
+    if (halfVelocities)
+        options += " -DHALF_VELOCITIES";
+    if (deterministic)
+        options += " -DDETERMINISTIC";
     try {
         cl::Program::Sources source(
                     1, std::make_pair(kernel_source.c_str(), pl));
-        program = cl::Program(context, source);
+        built = cl::Program(context, source);
     }
     catch (cl::Error er) {
         printf("ERROR: %s(%s)\n", er.what(), oclErrorString(er.err()));
@@ -141,93 +307,251 @@ void Simulator::loadProgram(std::string kernel_source) {
     try {
         // err = program.build(devices,
         // "-cl-nv-verbose -cl-nv-maxrregcount=100");
-        program.build(devices);
+        built.build(devices, options.c_str());
     }
     catch (cl::Error er) {
         printf("program.build: %s\n", oclErrorString(er.err()));
         exit(0);
     }
     std::cout << "Build Status: "
-              << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(devices[0])
+              << built.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(devices[0])
               << std::endl << "Build Options:\t"
-              << program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(devices[0])
+              << built.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(devices[0])
               << std::endl << "Build Log:\t "
-              << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+              << built.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
               << std::endl;
+    return built;
 }
 
-void Simulator::loadData(std::vector<glm::vec4> pos,
-        std::vector<glm::vec4> vel,
-        std::vector<glm::vec4> col,
-        std::vector<float> mass) {
-    // store the number of particles and the size in bytes of our arrays
+void Simulator::loadProgram(std::string kernel_source, std::string options) {
+    program = buildProgram(kernel_source, options);
+}
+
+void Simulator::allocate(int capacity) {
     cl_int err;
+    size_t position_size = capacity * sizeof(glm::vec4);
+    size_t color_size = capacity * sizeof(GLuint);
+
+    // the simulation state lives in OpenCL only buffers
+    positionBuffer = cl::Buffer(
+                context, CL_MEM_READ_WRITE, position_size, NULL, &err);
+    velocityBuffer = cl::Buffer(
+                context, CL_MEM_READ_WRITE, capacity * velocitySize(),
+                NULL, &err);
+    colorBuffer = cl::Buffer(
+                context, CL_MEM_READ_WRITE, color_size, NULL, &err);
+    idBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                          capacity * sizeof(cl_uint), NULL, &err);
+    if (deterministic) {
+        cl_uint zero = 0;
+        snapshotBuffer = cl::Buffer(
+                    context, CL_MEM_READ_WRITE, position_size, NULL, &err);
+        mergeTargetBuffer = cl::Buffer(
+                    context, CL_MEM_READ_WRITE, capacity * sizeof(cl_int),
+                    NULL, &err);
+        absorbedBuffer = cl::Buffer(
+                    context, CL_MEM_READ_WRITE,
+                    deterministicMergeCapacity * sizeof(cl_uint), NULL, &err);
+        absorbedCountBuffer = cl::Buffer(
+                    context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                    sizeof(cl_uint), &zero, &err);
+    }
 
-    particleCount = pos.size();
-    array_size = particleCount * sizeof(glm::vec4);
+    // gravityBuffer =
+    // cl::Buffer(context, CL_MEM_WRITE_ONLY,
+    // particleCount * sizeof(float), NULL, &err);
+
+    allocatePublished(capacity);
+    particleCapacity = capacity;
+    memoryTracker.track("simulation state", CL_MEMORY,
+                        capacity * simulationBytes());
+
+    printf("Particle storage: %zu bytes per particle, %zu bytes per "
+           "published state, %zu bytes read per interaction\n",
+           sizeof(glm::vec4) + velocitySize() + sizeof(GLuint)
+           + sizeof(cl_uint),
+           sizeof(glm::vec4) + sizeof(GLuint),
+           sizeof(glm::vec4));
+}
+
+void Simulator::allocatePublished(int capacity) {
+    cl_int err;
+    size_t position_size = capacity * sizeof(glm::vec4);
+    size_t color_size = capacity * sizeof(GLuint);
+
+    // three VBOs for the renderer, shared with OpenCL or mapped
+    for (PublishedState& state : published) {
+        if (state.positionVBO) {
+            // deleting a mapped buffer also unmaps it
+            glDeleteBuffers(1, &state.positionVBO);
+            glDeleteBuffers(1, &state.colorVBO);
+        }
+        state.positionBuffer = cl::BufferGL();
+        state.colorBuffer = cl::BufferGL();
+        state.positionObjects.clear();
+        state.allObjects.clear();
+        state.mappedPositions = NULL;
+        state.mappedColors = NULL;
+        state.particleCount = 0;
+        state.slotGeneration = ~0ul;
+        if (state.fence)
+            glDeleteSync(state.fence);
+        state.fence = 0;
+        state.idle = true;
+
+        if (interop) {
+            state.positionVBO = Renderer::createVBO(
+                        NULL, position_size, GL_ARRAY_BUFFER,
+                        GL_DYNAMIC_DRAW);
+            state.colorVBO = Renderer::createVBO(
+                        NULL, color_size, GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW);
+        } else {
+            state.positionVBO = createMappedVBO(position_size,
+                                                &state.mappedPositions);
+            state.colorVBO = createMappedVBO(color_size,
+                                             &state.mappedColors);
+        }
+    }
+    glFinish();
 
-    // If not initialized create buffers
-    if (!positionVBO) {
-        positionVBO = Renderer::createVBO(
-                    &pos[0], array_size, GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW);
-        colorVBO = Renderer::createVBO(
-                    &col[0], array_size, GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW);
-        massVBO = Renderer::createVBO(
-                    mass.data(), particleCount * sizeof(GLfloat),
-                    GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW);
+    for (PublishedState& state : published) {
+        if (!interop)
+            break;
+        state.positionBuffer = cl::BufferGL(
+                    context, CL_MEM_WRITE_ONLY, state.positionVBO, &err);
+        state.colorBuffer = cl::BufferGL(
+                    context, CL_MEM_WRITE_ONLY, state.colorVBO, &err);
+        state.positionObjects = {state.positionBuffer};
+        state.allObjects = {state.positionBuffer, state.colorBuffer};
+    }
 
-        glFinish();
-        // create OpenCL buffer from GL VBO
-        cl_vbos.push_back(cl::BufferGL(
-                              context, CL_MEM_READ_WRITE, positionVBO, &err));
-        cl_vbos.push_back(cl::BufferGL(
-                              context, CL_MEM_READ_WRITE, colorVBO, &err));
+    // mapped VBOs are GL buffers as well
+    memoryTracker.track("published states", GL_BUFFER_MEMORY,
+                        3 * (position_size + color_size));
+}
 
-        cl_vbos.push_back(cl::BufferGL(
-                              context, CL_MEM_READ_WRITE, massVBO, &err));
+void Simulator::reserve(int count) {
+    if (count <= particleCapacity)
+        return;
+
+    int previousCapacity = particleCapacity;
+    int capacity = std::max(
+                count, static_cast<int>(particleCapacity
+                                        * particleGrowthFactor));
+    // the old buffers are released once their contents are copied
+    cl::Buffer positions = positionBuffer;
+    cl::Buffer velocities = velocityBuffer;
+    cl::Buffer colors = colorBuffer;
+    cl::Buffer ids = idBuffer;
+    allocate(capacity);
 
-        // create the OpenCL only arrays
-        velocityBuffer =
-                cl::Buffer(context, CL_MEM_WRITE_ONLY, array_size, NULL, &err);
+    try {
+        if (particleCount > 0) {
+            queue.enqueueCopyBuffer(positions, positionBuffer, 0, 0,
+                                    particleCount * sizeof(glm::vec4));
+            queue.enqueueCopyBuffer(velocities, velocityBuffer, 0, 0,
+                                    particleCount * velocitySize());
+            queue.enqueueCopyBuffer(colors, colorBuffer, 0, 0,
+                                    particleCount * sizeof(GLuint));
+            queue.enqueueCopyBuffer(ids, idBuffer, 0, 0,
+                                    particleCount * sizeof(cl_uint));
+            queue.finish();
+            // the renderer's previous positions are gone with its buffers
+            slotGeneration++;
+        }
+        if (kernel())
+            bindBuffers();
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n", er.what(), oclErrorString(er.err()));
+    }
+    if (previousCapacity)
+        printf("Particle capacity grown from %d to %d\n",
+               previousCapacity, capacity);
+}
 
-        // gravityBuffer =
-        // cl::Buffer(context, CL_MEM_WRITE_ONLY,
-        // particleCount * sizeof(float), NULL, &err);
+void Simulator::loadData(std::vector<glm::vec4> pos,
+        std::vector<glm::vec3> vel,
+        std::vector<GLuint> col,
+        const std::vector<cl_uint>& ids) {
+    if (pos.empty()) {
+        particleCount = 0;
+        orderGeneration++;
+        slotGeneration++;
+        return;
+    }
 
-    } else {
-        // just reupload data if buffers exist
-        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
-        glBufferData(GL_ARRAY_BUFFER, array_size, &pos[0], GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-        glBufferData(GL_ARRAY_BUFFER, array_size, &col[0], GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, massVBO);
-        glBufferData(GL_ARRAY_BUFFER, particleCount * sizeof(GLfloat),
-                     mass.data(), GL_DYNAMIC_DRAW);
+    // If not big enough create buffers, the old particles are replaced
+    if (static_cast<int>(pos.size()) > particleCapacity) {
+        particleCount = 0;
+        reserve(pos.size());
     }
+
+    // store the number of particles and the size in bytes of our arrays
+    particleCount = pos.size();
+    array_size = particleCount * sizeof(glm::vec4);
+    size_t velocity_size = particleCount * velocitySize();
+    size_t color_size = particleCount * sizeof(GLuint);
+
     // push our CPU arrays to the GPU
     // data is tightly packed in std::vector
     // starting with the adress of the first element
-    err = queue.enqueueWriteBuffer(
-                velocityBuffer, CL_TRUE, 0, array_size,
-                &vel[0], NULL, &event);
+    queue.enqueueWriteBuffer(
+                positionBuffer, CL_FALSE, 0, array_size,
+                pos.data(), NULL, &event);
+    std::vector<cl_half> halves;
+    const void* velocities = packVelocities(vel.data(), particleCount,
+                                            halfVelocities, &halves);
+    queue.enqueueWriteBuffer(
+                velocityBuffer, CL_FALSE, 0, velocity_size,
+                velocities, NULL, &event);
+    queue.enqueueWriteBuffer(
+                colorBuffer, CL_FALSE, 0, color_size,
+                col.data(), NULL, &event);
+
+    // fresh particles are numbered in generation order
+    particleIds.resize(particleCount);
+    memoryTracker.track("particle ids", HOST_MEMORY,
+                        particleIds.capacity() * sizeof(cl_uint));
+    nextParticleId = 0;
+    for (int i = 0; i < particleCount; i++) {
+        particleIds[i] = ids.empty() ? i : ids[i];
+        nextParticleId = std::max(nextParticleId, particleIds[i] + 1);
+    }
+    queue.enqueueWriteBuffer(
+                idBuffer, CL_FALSE, 0, particleCount * sizeof(cl_uint),
+                particleIds.data(), NULL, &event);
     queue.finish();
+    orderGeneration++;
+    slotGeneration++;
 }
 
 void Simulator::initKernel() {
     cl_int err;
     try {
-        kernel = cl::Kernel(program, "vortex", &err);
+        kernel = cl::Kernel(
+                    program, deterministic ? "vortexDeterministic" : "vortex",
+                    &err);
+        if (deterministic)
+            resolveKernel = cl::Kernel(program, "resolveMerges", &err);
+        collectKernel = cl::Kernel(program, "collectFreeSlots", &err);
+        scatterKernel = cl::Kernel(program, "scatterParticles", &err);
     }
     catch (cl::Error er) {
         printf("ERROR: %s(%s)\n", er.what(), oclErrorString(er.err()));
     }
 
+    // merges are counted but not recorded until a log is attached
+    if (!discardedMergeCount()) {
+        discardedMergeCount = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                         sizeof(cl_uint));
+        discardedMergeEvents = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                          sizeof(cl_uint));
+    }
+
     try {
-        err = kernel.setArg(0, cl_vbos[0]);
-        err = kernel.setArg(1, cl_vbos[1]);
-        err = kernel.setArg(2, cl_vbos[2]);
-        err = kernel.setArg(3, velocityBuffer);
-        //  err = kernel.setArg(6, gravityBuffer);
+        bindBuffers();
+        setMergeLog(discardedMergeCount, discardedMergeEvents, 0);
     }
     catch (cl::Error er) {
         printf("ERROR: %s(%s)\n", er.what(), oclErrorString(er.err()));
@@ -236,29 +560,255 @@ void Simulator::initKernel() {
     queue.finish();
 }
 
+void Simulator::bindBuffers() {
+    kernel.setArg(0, positionBuffer);
+    kernel.setArg(1, velocityBuffer);
+    //  kernel.setArg(6, gravityBuffer);
+    if (deterministic) {
+        kernel.setArg(4, snapshotBuffer);
+        kernel.setArg(5, mergeTargetBuffer);
+        kernel.setArg(6, absorbedBuffer);
+        kernel.setArg(7, absorbedCountBuffer);
+        kernel.setArg(8, deterministicMergeCapacity);
+        resolveKernel.setArg(0, positionBuffer);
+        resolveKernel.setArg(1, velocityBuffer);
+        resolveKernel.setArg(3, mergeTargetBuffer);
+        resolveKernel.setArg(4, absorbedBuffer);
+        resolveKernel.setArg(5, absorbedCountBuffer);
+        resolveKernel.setArg(6, deterministicMergeCapacity);
+        resolveKernel.setArg(7, idBuffer);
+    } else {
+        kernel.setArg(3, idBuffer);
+    }
 
-void Simulator::runKernel() {
-    // this will update our system by calculating new velocity
-    // and updating the positions of our particles
-    // Make sure OpenGL is done using our VBOs
-    glFinish();
-    // map OpenGL buffer object for writing from OpenCL
-    // this passes in the vector of VBO buffer objects (position and color)
-    cl_int err = queue.enqueueAcquireGLObjects(&cl_vbos, NULL, &event);
+    collectKernel.setArg(0, positionBuffer);
+    scatterKernel.setArg(0, positionBuffer);
+    scatterKernel.setArg(1, velocityBuffer);
+    scatterKernel.setArg(2, colorBuffer);
+    scatterKernel.setArg(3, idBuffer);
+    if (spawnCapacity) {
+        collectKernel.setArg(2, freeSlotBuffer);
+        collectKernel.setArg(3, freeSlotCount);
+        scatterKernel.setArg(4, spawnPositions);
+        scatterKernel.setArg(5, spawnVelocities);
+        scatterKernel.setArg(6, spawnColors);
+        scatterKernel.setArg(7, spawnIds);
+        scatterKernel.setArg(8, freeSlotBuffer);
+    }
+}
 
-    if (err != CL_SUCCESS) {
-        printf("Error enqueueAcquireGLObjects: %s\n", oclErrorString(err));
+void Simulator::allocateSpawnBuffers() {
+    if (spawnCapacity)
+        return;
+
+    spawnCapacity = spawnBatchCapacity;
+    spawnPositions = cl::Buffer(context, CL_MEM_READ_ONLY,
+                                spawnCapacity * sizeof(glm::vec4));
+    spawnVelocities = cl::Buffer(context, CL_MEM_READ_ONLY,
+                                 spawnCapacity * velocitySize());
+    spawnColors = cl::Buffer(context, CL_MEM_READ_ONLY,
+                             spawnCapacity * sizeof(GLuint));
+    spawnIds = cl::Buffer(context, CL_MEM_READ_ONLY,
+                          spawnCapacity * sizeof(cl_uint));
+    freeSlotBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                spawnCapacity * sizeof(cl_uint));
+    freeSlotCount = cl::Buffer(context, CL_MEM_READ_WRITE,
+                               sizeof(cl_uint));
+    memoryTracker.track("spawn staging", CL_MEMORY,
+                        spawnCapacity * (sizeof(glm::vec4) + velocitySize()
+                                         + sizeof(GLuint)
+                                         + 2 * sizeof(cl_uint)));
+    bindBuffers();
+}
+
+std::vector<cl_uint> Simulator::collectFreeSlots(int count) {
+    std::vector<cl_uint> slots;
+    // the slots are found in a different order every time, so a
+    // deterministic run only appends
+    if (deterministic || count == 0 || particleCount == 0)
+        return slots;
+
+    cl_uint zero = 0;
+    cl_uint found = 0;
+    queue.enqueueWriteBuffer(freeSlotCount, CL_FALSE, 0, sizeof(cl_uint),
+                             &zero);
+    collectKernel.setArg(1, static_cast<cl_uint>(particleCount));
+    collectKernel.setArg(4, static_cast<cl_uint>(count));
+    queue.enqueueNDRangeKernel(collectKernel, cl::NullRange,
+                               cl::NDRange(particleCount), cl::NullRange);
+    queue.enqueueReadBuffer(freeSlotCount, CL_TRUE, 0, sizeof(cl_uint),
+                            &found);
+
+    slots.resize(std::min(found, static_cast<cl_uint>(count)));
+    if (!slots.empty())
+        queue.enqueueReadBuffer(freeSlotBuffer, CL_TRUE, 0,
+                                slots.size() * sizeof(cl_uint),
+                                slots.data());
+    // the staged particles are scattered in ascending order
+    std::sort(slots.begin(), slots.end());
+    return slots;
+}
+
+int Simulator::spawn(const std::vector<glm::vec4>& pos,
+                     const std::vector<glm::vec3>& vel,
+                     const std::vector<GLuint>& color) {
+    int requested = pos.size();
+    if (requested == 0)
+        return 0;
+
+    int recycled = 0;
+    int appended = 0;
+    std::vector<cl_uint> ids;
+    std::vector<cl_uint> slots;
+    try {
+        allocateSpawnBuffers();
+        slots = collectFreeSlots(std::min(requested, spawnCapacity));
+        recycled = slots.size();
+        appended = std::min(requested - recycled,
+                            particleCapacity - particleCount);
+        if (recycled + appended == 0)
+            return 0;
+
+        ids.resize(recycled + appended);
+        for (cl_uint& id : ids)
+            id = nextParticleId++;
+        std::vector<cl_half> halves;
+        const char* velocities = static_cast<const char*>(
+                    packVelocities(vel.data(), recycled + appended,
+                                   halfVelocities, &halves));
+        size_t velocityBytes = velocitySize();
+
+        // recycled slots are scattered over the buffers, so they are
+        // staged and moved by a kernel
+        if (recycled) {
+            queue.enqueueWriteBuffer(spawnPositions, CL_FALSE, 0,
+                                     recycled * sizeof(glm::vec4),
+                                     pos.data());
+            queue.enqueueWriteBuffer(spawnVelocities, CL_FALSE, 0,
+                                     recycled * velocityBytes, velocities);
+            queue.enqueueWriteBuffer(spawnColors, CL_FALSE, 0,
+                                     recycled * sizeof(GLuint),
+                                     color.data());
+            queue.enqueueWriteBuffer(spawnIds, CL_FALSE, 0,
+                                     recycled * sizeof(cl_uint),
+                                     ids.data());
+            queue.enqueueWriteBuffer(freeSlotBuffer, CL_FALSE, 0,
+                                     recycled * sizeof(cl_uint),
+                                     slots.data());
+            scatterKernel.setArg(9, static_cast<cl_uint>(recycled));
+            queue.enqueueNDRangeKernel(scatterKernel, cl::NullRange,
+                                       cl::NDRange(recycled),
+                                       cl::NullRange);
+        }
+
+        // the rest goes right after the last particle
+        if (appended) {
+            size_t first = particleCount;
+            queue.enqueueWriteBuffer(positionBuffer, CL_FALSE,
+                                     first * sizeof(glm::vec4),
+                                     appended * sizeof(glm::vec4),
+                                     &pos[recycled]);
+            queue.enqueueWriteBuffer(velocityBuffer, CL_FALSE,
+                                     first * velocityBytes,
+                                     appended * velocityBytes,
+                                     velocities + recycled * velocityBytes);
+            queue.enqueueWriteBuffer(colorBuffer, CL_FALSE,
+                                     first * sizeof(GLuint),
+                                     appended * sizeof(GLuint),
+                                     &color[recycled]);
+            queue.enqueueWriteBuffer(idBuffer, CL_FALSE,
+                                     first * sizeof(cl_uint),
+                                     appended * sizeof(cl_uint),
+                                     &ids[recycled]);
+        }
+        queue.finish();
     }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n", er.what(), oclErrorString(er.err()));
+        return 0;
+    }
+
+    for (int i = 0; i < recycled; i++)
+        particleIds[slots[i]] = ids[i];
+    particleIds.insert(particleIds.end(), ids.begin() + recycled, ids.end());
+    memoryTracker.track("particle ids", HOST_MEMORY,
+                        particleIds.capacity() * sizeof(cl_uint));
+    particleCount += appended;
+    // colors changed and the renderer has no previous positions for them,
+    // the order is left alone and resorted once the bounds get loose
+    slotGeneration++;
+    return recycled + appended;
+}
 
+
+void Simulator::setMergeLog(const cl::Buffer& count,
+                            const cl::Buffer& events,
+                            cl_uint capacity) {
+    // deterministic merges are logged when they are resolved
+    cl::Kernel& logging = deterministic ? resolveKernel : kernel;
+    int first = deterministic ? 8 : 4;
+    logging.setArg(first, count);
+    logging.setArg(first + 1, events);
+    logging.setArg(first + 2, capacity);
+}
+
+void Simulator::runFast() {
     // pass in the timestep
-    kernel.setArg(4, dt);
+    kernel.setArg(2, dt);
+    kernel.setArg(7, static_cast<cl_uint>(stepCount));
     // execute the kernel
-    err = queue.enqueueNDRangeKernel(
+    cl_int err = queue.enqueueNDRangeKernel(
                 kernel,
                 cl::NullRange,
                 cl::NDRange(particleCount),
                 cl::NullRange, NULL, &event);
-    // printf("clEnqueueNDRangeKernel: %s\n", oclErrorString(err));
+    if (err != CL_SUCCESS) {
+        printf("Error enqueueNDRangeKernel: %s\n", oclErrorString(err));
+    }
+}
+
+void Simulator::runDeterministic() {
+    cl_uint count = particleCount;
+    size_t globalSize = particleCount;
+    cl::NDRange localSize = cl::NullRange;
+    if (workGroupSize) {
+        globalSize = (globalSize + workGroupSize - 1) / workGroupSize
+                * workGroupSize;
+        localSize = cl::NDRange(workGroupSize);
+    }
+
+    try {
+        // the forces only see the positions from before the step
+        queue.enqueueCopyBuffer(positionBuffer, snapshotBuffer, 0, 0,
+                                particleCount * sizeof(glm::vec4));
+        kernel.setArg(2, dt);
+        kernel.setArg(3, count);
+        queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                   cl::NDRange(globalSize), localSize,
+                                   NULL, &event);
+
+        resolveKernel.setArg(2, count);
+        resolveKernel.setArg(11, static_cast<cl_uint>(stepCount));
+        queue.enqueueNDRangeKernel(resolveKernel, cl::NullRange,
+                                   cl::NDRange(1), cl::NullRange);
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n", er.what(), oclErrorString(er.err()));
+    }
+}
+
+void Simulator::runKernel() {
+    // this will update our system by calculating new velocity
+    // and updating the positions of our particles
+
+    if (deterministic)
+        runDeterministic();
+    else
+        runFast();
+    stepCount++;
+
+    for (SimulationStage* stage : stages)
+        stage->afterStep(this);
     queue.finish();
 /*
     queue.enqueueReadBuffer(gravityBuffer,false,0,particleCount*sizeof(float),gravities,NULL,NULL);
@@ -266,9 +816,126 @@ void Simulator::runKernel() {
             std::cout << "gravities[" <<  i << "] = " << gravities[i] << "\n";
     }
 */
-    // Release the VBOs so OpenGL can play with them
-    err = queue.enqueueReleaseGLObjects(&cl_vbos, NULL, &event);
+}
+
+void Simulator::publish() {
+    PublishedState& state = published[publishedStates.back()];
+
+    // the renderer may still be reading the slot it handed back last
+    while (!state.idle.load(std::memory_order_acquire))
+        std::this_thread::sleep_for(
+                    std::chrono::microseconds(simulationIdleMicroseconds));
+
+    // colors only change with the particle order
+    bool colorsChanged = state.slotGeneration != slotGeneration;
+
+    // the renderer finished all GL work on this slot before handing it
+    // back, the mapped memory can be overwritten as well
+    if (!interop) {
+        queue.enqueueReadBuffer(positionBuffer, CL_FALSE, 0,
+                                particleCount * sizeof(glm::vec4),
+                                state.mappedPositions);
+        if (colorsChanged)
+            queue.enqueueReadBuffer(colorBuffer, CL_FALSE, 0,
+                                    particleCount * sizeof(GLuint),
+                                    state.mappedColors);
+        queue.finish();
+    } else {
+        std::vector<cl::Memory>* objects =
+                colorsChanged ? &state.allObjects : &state.positionObjects;
+        cl_int err = queue.enqueueAcquireGLObjects(objects, NULL, &event);
+        if (err != CL_SUCCESS) {
+            printf("Error enqueueAcquireGLObjects: %s\n",
+                   oclErrorString(err));
+        }
+
+        queue.enqueueCopyBuffer(positionBuffer, state.positionBuffer, 0, 0,
+                                particleCount * sizeof(glm::vec4));
+        if (colorsChanged)
+            queue.enqueueCopyBuffer(colorBuffer, state.colorBuffer, 0, 0,
+                                    particleCount * sizeof(GLuint));
+
+        // Release the VBOs so OpenGL can play with them
+        queue.enqueueReleaseGLObjects(objects, NULL, &event);
+        queue.finish();
+    }
+
+    state.particleCount = particleCount;
+    state.step = stepCount;
+    state.slotGeneration = slotGeneration;
+    state.time = currentTime();
+    publishedStates.publish();
+}
+
+void Simulator::measureTransport() {
+    size_t size = particleCount * sizeof(glm::vec4);
+    double interopRate = 0;
+    double mappedRate = 0;
+
+    void* mapped;
+    GLuint mappedVBO = createMappedVBO(size, &mapped);
+    double start = currentTime();
+    // one finish per copy like publish()
+    for (int i = 0; i < transportRepetitions; i++) {
+        queue.enqueueReadBuffer(positionBuffer, CL_FALSE, 0, size, mapped);
+        queue.finish();
+    }
+    mappedRate = transportRepetitions * size / (currentTime() - start);
+    glDeleteBuffers(1, &mappedVBO);
+
+    if (interop) {
+        GLuint sharedVBO = Renderer::createVBO(
+                    NULL, size, GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW);
+        glFinish();
+        cl::BufferGL shared(context, CL_MEM_WRITE_ONLY, sharedVBO);
+        std::vector<cl::Memory> objects = {shared};
+
+        start = currentTime();
+        for (int i = 0; i < transportRepetitions; i++) {
+            queue.enqueueAcquireGLObjects(&objects);
+            queue.enqueueCopyBuffer(positionBuffer, shared, 0, 0, size);
+            queue.enqueueReleaseGLObjects(&objects);
+            queue.finish();
+        }
+        interopRate = transportRepetitions * size / (currentTime() - start);
+        glDeleteBuffers(1, &sharedVBO);
+    }
+
+    bool keepInterop = interop && interopRate >= mappedRate;
+    printf("Publishing %.2fMB of positions: GL sharing %.0fMB/s, "
+           "mapped buffers %.0fMB/s, using %s\n",
+           size / 1.0e6, interopRate / 1.0e6, mappedRate / 1.0e6,
+           keepInterop ? "GL sharing" : "mapped buffers");
+
+    if (interop != keepInterop) {
+        interop = keepInterop;
+        // only the published slots depend on the transport, the loaded
+        // particles stay where they are
+        allocatePublished(particleCapacity);
+    }
+}
+
+void Simulator::readState(std::vector<glm::vec4>* pos,
+                          std::vector<glm::vec3>* vel) {
+    pos->resize(particleCount);
+    vel->resize(particleCount);
+
+    queue.enqueueReadBuffer(positionBuffer, CL_FALSE, 0,
+                            particleCount * sizeof(glm::vec4), pos->data());
+    if (!halfVelocities) {
+        queue.enqueueReadBuffer(velocityBuffer, CL_FALSE, 0,
+                                particleCount * sizeof(glm::vec3),
+                                vel->data());
+        queue.finish();
+        return;
+    }
+
+    std::vector<cl_half> halves(3 * particleCount);
+    queue.enqueueReadBuffer(velocityBuffer, CL_FALSE, 0,
+                            halves.size() * sizeof(cl_half), halves.data());
     queue.finish();
+    for (int i = 0; i < 3 * particleCount; i++)
+        (*vel)[i / 3][i % 3] = glm::unpackHalf1x16(halves[i]);
 }
 
 const char* Simulator::oclErrorString(cl_int error) {
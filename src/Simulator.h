@@ -27,37 +27,186 @@
 #ifndef SRC_SIMULATOR_H_
 #define SRC_SIMULATOR_H_
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include "GL/gl3w.h"
 #include <glm/glm.hpp>
 
 #define __CL_ENABLE_EXCEPTIONS
 #include "CL/cl.hpp"
 
+#include "TripleBuffer.h"
+
+class Simulator;
+
+// The platform and device the simulation runs on
+struct DeviceSelection {
+    cl::Platform platform;
+    cl::Device device;
+};
+
+// A copy of the particle state that OpenGL can draw from while the
+// simulation continues on its own buffers
+struct PublishedState {
+    GLuint positionVBO = 0;
+    GLuint colorVBO = 0;
+    cl::BufferGL positionBuffer;
+    cl::BufferGL colorBuffer;
+    std::vector<cl::Memory> positionObjects;
+    std::vector<cl::Memory> allObjects;
+    // persistently mapped VBO memory when GL sharing is not used
+    void* mappedPositions = NULL;
+    void* mappedColors = NULL;
+
+    int particleCount = 0;
+    unsigned long step = 0;
+    // colors are only copied when this differs from the simulator
+    unsigned long slotGeneration = ~0ul;
+    // currentTime() when the state was published
+    double time = 0;
+    // set by the render thread once the GL commands reading this slot
+    // completed, publish() waits for it before writing the slot again
+    std::atomic<bool> idle{true};
+    // fence after the last of those commands, polled by the renderer
+    GLsync fence = 0;
+};
+
+// Memory a run with a given number of particles is expected to need,
+// sizes that do not scale with the particle count are left out
+struct MemoryFootprint {
+    size_t deviceBytesPerParticle = 0;
+    size_t hostBytesPerParticle = 0;
+    size_t deviceBytes = 0;
+    size_t hostBytes = 0;
+    // the largest single device allocation
+    size_t largestBuffer = 0;
+};
+
+// Extra work enqueued on the simulation queue after every step
+class SimulationStage {
+ public:
+    virtual ~SimulationStage() {}
+    virtual void afterStep(Simulator* simulator) = 0;
+};
+
 class Simulator {
  public:
-    std::vector<cl::Memory> cl_vbos;
+    // xyz is the position, w the mass of the particle
+    cl::Buffer positionBuffer;
+    // packed RGBA8 colors
+    cl::Buffer colorBuffer;
     cl::Buffer velocityBuffer;
     cl::Buffer gravityBuffer;
+    // stable particle id for every slot, permuted along with the particles
+    cl::Buffer idBuffer;
+    std::vector<cl_uint> particleIds;
+    // merge log target while no MergeLog is attached
+    cl::Buffer discardedMergeCount;
+    cl::Buffer discardedMergeEvents;
+    // deterministic mode: positions before the step, merge target of
+    // every particle and the list of absorbed ones
+    cl::Buffer snapshotBuffer;
+    cl::Buffer mergeTargetBuffer;
+    cl::Buffer absorbedBuffer;
+    cl::Buffer absorbedCountBuffer;
+    // spawn() stages particles for recycled slots here, spawnCapacity at
+    // a time, and collects the free slots in freeSlotBuffer
+    cl::Buffer spawnPositions;
+    cl::Buffer spawnVelocities;
+    cl::Buffer spawnColors;
+    cl::Buffer spawnIds;
+    cl::Buffer freeSlotBuffer;
+    cl::Buffer freeSlotCount;
+    int spawnCapacity;
 
-    int positionVBO;
-    int colorVBO;
-    int massVBO;
+    // states handed over to the renderer
+    PublishedState published[3];
+    TripleBuffer publishedStates;
+    // incremented whenever particles are reordered or reloaded
+    unsigned long orderGeneration;
+    // incremented whenever the particle in any slot changes, so with the
+    // order and also with spawned particles, which do not call for a sort
+    unsigned long slotGeneration;
+    // id of the next spawned particle
+    cl_uint nextParticleId;
+
+    int particleCapacity;
     int particleCount;
+    // store velocities as half3 instead of float3, see gpu/storage.cl
+    bool halfVelocities;
+    // publish through cl_khr_gl_sharing, otherwise with non-blocking
+    // reads into persistently mapped VBOs
+    bool interop;
+    // bit identical results independent of scheduling, see
+    // vortexDeterministic in gpu/vortex.cl
+    bool deterministic;
+    // local size of the deterministic kernel, 0 lets the driver choose
+    size_t workGroupSize;
     float* gravities;
     size_t array_size;
     float dt;
+    unsigned long stepCount;
+    std::vector<SimulationStage*> stages;
 
     Simulator();
+    // with shareGL the GL context has to be current on the calling thread
+    explicit Simulator(const DeviceSelection& selection,
+                       bool shareGL = true);
     ~Simulator();
 
-    void loadProgram(std::string kernel_source);
+    // enumerates all OpenCL devices, does not need a GL context
+    static DeviceSelection selectDevice();
+
+    // bytes of one stored velocity
+    size_t velocitySize() const;
+    // takes effect for programs built and data loaded afterwards
+    void setHalfVelocities(bool enabled);
+    // takes effect for programs built and data loaded afterwards
+    void setDeterministic(bool enabled);
+    // bytes per particle of the simulation buffers
+    size_t simulationBytes() const;
+    MemoryFootprint projectFootprint(int count) const;
+    // checks the projected footprint against the device and host memory
+    // before anything is allocated, switches to half velocities if only
+    // those fit and returns false if nothing does
+    bool fitMemory(int count);
+
+    cl::Program buildProgram(std::string kernel_source,
+                             std::string options = "");
+    void loadProgram(std::string kernel_source, std::string options = "");
+    // creates the buffers, needs the GL context on the calling thread
+    void allocate(int capacity);
+    // grows the buffers to at least count particles, by at least
+    // particleGrowthFactor, and keeps the particles in them. Needs the GL
+    // context on the calling thread and no step running.
+    void reserve(int count);
+    // grows the buffers with allocate() if they are too small, particles
+    // are numbered in order unless their ids are given
     void loadData(
             std::vector<glm::vec4> pos,
-            std::vector<glm::vec4> vel,
-            std::vector<glm::vec4> color,
-            std::vector<float> mass);
+            std::vector<glm::vec3> vel,
+            std::vector<GLuint> color,
+            const std::vector<cl_uint>& ids = std::vector<cl_uint>());
     void initKernel();
+    // adds particles in the slots of merged ones, then after the last
+    // particle up to the capacity, uploading only the new ones. Returns
+    // how many were added, the rest needs a reserve() first.
+    int spawn(const std::vector<glm::vec4>& pos,
+              const std::vector<glm::vec3>& vel,
+              const std::vector<GLuint>& color);
+    // where the kernel appends merge events, capacity is in events
+    void setMergeLog(const cl::Buffer& count,
+                     const cl::Buffer& events,
+                     cl_uint capacity);
     void runKernel();
+    // copies the state into the next free published slot
+    void publish();
+    // times both ways of publishing and keeps GL sharing only if it is
+    // at least as fast, needs the GL context on the calling thread
+    void measureTransport();
+    void readState(std::vector<glm::vec4>* pos, std::vector<glm::vec3>* vel);
 
     cl::Device currentDevice;
 
@@ -65,9 +214,23 @@ class Simulator {
     cl::CommandQueue queue;
     cl::Program program;
     cl::Kernel kernel;
+    cl::Kernel resolveKernel;
+    cl::Kernel collectKernel;
+    cl::Kernel scatterKernel;
     cl::Event event;
 
     static const char* oclErrorString(cl_int error);
+
+ private:
+    // creates the published VBOs, needs the GL context
+    void allocatePublished(int capacity);
+    // sets the buffer arguments of the kernels
+    void bindBuffers();
+    void allocateSpawnBuffers();
+    // up to count free slots in ascending order
+    std::vector<cl_uint> collectFreeSlots(int count);
+    void runFast();
+    void runDeterministic();
 };
 
 #endif  // SRC_SIMULATOR_H_
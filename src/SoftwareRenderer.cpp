@@ -0,0 +1,249 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "SoftwareRenderer.h"
+
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "ImageWriter.h"
+#include "options.h"
+
+SoftwareRenderer::SoftwareRenderer(int width, int height, unsigned threads)
+    : width(width), height(height) {
+    threadCount = threads ? threads : std::thread::hardware_concurrency();
+    if (!threadCount)
+        threadCount = 1;
+
+    tilesX = (width + softwareTileSize - 1) / softwareTileSize;
+    tilesY = (height + softwareTileSize - 1) / softwareTileSize;
+
+    framebuffer.resize(width * height);
+    bins.resize(threadCount);
+    for (std::vector<std::vector<Splat>>& threadBins : bins)
+        threadBins.resize(tilesX * tilesY);
+}
+
+void SoftwareRenderer::bin(unsigned thread, float x, float y, float w,
+                           float mass, uint32_t color) {
+    if (w <= softwareNearPlane || mass <= 0)
+        return;
+
+    // the point size of MVP.vert as a radius, w is the distance
+    float radius = std::min(std::max(25 * mass / w, 0.5f),
+                            static_cast<float>(softwareMaxRadius));
+    // outside the clip volume by more than the radius, also catches NaN
+    // before anything is converted to int
+    float marginX = 2 * radius / width * w;
+    float marginY = 2 * radius / height * w;
+    if (!(fabsf(x) <= w + marginX) || !(fabsf(y) <= w + marginY))
+        return;
+
+    Splat splat;
+    splat.x = (x / w + 1) * width * 0.5f;
+    splat.y = (y / w + 1) * height * 0.5f;
+    splat.radius = radius;
+
+    // a splat is much smaller than a tile, so it touches at most four
+    int minX = std::max(0, static_cast<int>(floorf(splat.x - radius)));
+    int maxX = std::min(width - 1,
+                        static_cast<int>(floorf(splat.x + radius)));
+    int minY = std::max(0, static_cast<int>(floorf(splat.y - radius)));
+    int maxY = std::min(height - 1,
+                        static_cast<int>(floorf(splat.y + radius)));
+    if (minX > maxX || minY > maxY)
+        return;
+
+    // same color as gpu/density.vert, heavy particles turn white
+    float white = std::min(mass / 100, 1.0f);
+    for (int c = 0; c < 3; c++) {
+        float channel = ((color >> (8 * c)) & 0xFF) / 255.0f;
+        splat.light[c] = (channel + (1 - channel) * white) * mass;
+    }
+    splat.light[3] = mass;
+
+    for (int ty = minY / softwareTileSize; ty <= maxY / softwareTileSize;
+         ty++)
+        for (int tx = minX / softwareTileSize;
+             tx <= maxX / softwareTileSize; tx++)
+            bins[thread][ty * tilesX + tx].push_back(splat);
+}
+
+void SoftwareRenderer::project(unsigned thread, size_t begin, size_t end,
+                               const std::vector<glm::vec4>& pos,
+                               const std::vector<uint32_t>& color,
+                               const glm::mat4& viewProjection) {
+    const glm::mat4& m = viewProjection;
+    size_t i = begin;
+
+#ifdef __SSE__
+    // x, y and w in clip space and the mass of four particles
+    float clip[4][4];
+    for (; i + 4 <= end; i += 4) {
+        // xyz and mass of four particles, transposed to one vector each
+        __m128 x = _mm_loadu_ps(&pos[i].x);
+        __m128 y = _mm_loadu_ps(&pos[i + 1].x);
+        __m128 z = _mm_loadu_ps(&pos[i + 2].x);
+        __m128 mass = _mm_loadu_ps(&pos[i + 3].x);
+        _MM_TRANSPOSE4_PS(x, y, z, mass);
+
+        const int rows[3] = {0, 1, 3};
+        for (int r = 0; r < 3; r++) {
+            int row = rows[r];
+            __m128 value = _mm_add_ps(
+                        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][row]), x),
+                                   _mm_mul_ps(_mm_set1_ps(m[1][row]), y)),
+                        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2][row]), z),
+                                   _mm_set1_ps(m[3][row])));
+            _mm_storeu_ps(clip[r], value);
+        }
+        _mm_storeu_ps(clip[3], mass);
+
+        for (int k = 0; k < 4; k++)
+            bin(thread, clip[0][k], clip[1][k], clip[2][k], clip[3][k],
+                color[i + k]);
+    }
+#endif
+
+    for (; i < end; i++) {
+        glm::vec4 p = m * glm::vec4(glm::vec3(pos[i]), 1);
+        bin(thread, p.x, p.y, p.w, pos[i].w, color[i]);
+    }
+}
+
+void SoftwareRenderer::rasterize(int tile) {
+    int originX = (tile % tilesX) * softwareTileSize;
+    int originY = (tile / tilesX) * softwareTileSize;
+    int tileWidth = std::min(softwareTileSize, width - originX);
+    int tileHeight = std::min(softwareTileSize, height - originY);
+
+    // small enough to stay in the cache of one core
+    static const int tilePixels = softwareTileSize * softwareTileSize;
+    float pixels[tilePixels][4];
+    std::fill(&pixels[0][0], &pixels[0][0] + tilePixels * 4, 0.0f);
+
+    // the gaussian of gpu/density.frag is separable into x and y weights
+    static const int maxFootprint = 2 * softwareMaxRadius + 2;
+    float weightsX[maxFootprint];
+    float weightsY[maxFootprint];
+
+    for (unsigned thread = 0; thread < threadCount; thread++) {
+        for (const Splat& splat : bins[thread][tile]) {
+            int minX = std::max(originX, static_cast<int>(
+                                    floorf(splat.x - splat.radius)));
+            int maxX = std::min(originX + tileWidth - 1, static_cast<int>(
+                                    floorf(splat.x + splat.radius)));
+            int minY = std::max(originY, static_cast<int>(
+                                    floorf(splat.y - splat.radius)));
+            int maxY = std::min(originY + tileHeight - 1, static_cast<int>(
+                                    floorf(splat.y + splat.radius)));
+            float scale = -4 / (splat.radius * splat.radius);
+
+            for (int x = minX; x <= maxX; x++) {
+                float dx = x + 0.5f - splat.x;
+                weightsX[x - minX] = expf(dx * dx * scale);
+            }
+            for (int y = minY; y <= maxY; y++) {
+                float dy = y + 0.5f - splat.y;
+                weightsY[y - minY] = expf(dy * dy * scale);
+            }
+
+            for (int y = minY; y <= maxY; y++) {
+                float* row = pixels[(y - originY) * softwareTileSize];
+                for (int x = minX; x <= maxX; x++) {
+                    float falloff = weightsX[x - minX] * weightsY[y - minY];
+                    for (int c = 0; c < 4; c++)
+                        row[(x - originX) * 4 + c] += splat.light[c] * falloff;
+                }
+            }
+        }
+        bins[thread][tile].clear();
+    }
+
+    for (int y = 0; y < tileHeight; y++)
+        for (int x = 0; x < tileWidth; x++) {
+            const float* pixel = pixels[y * softwareTileSize + x];
+            framebuffer[(originY + y) * width + originX + x] =
+                    glm::vec4(pixel[0], pixel[1], pixel[2], pixel[3]);
+        }
+}
+
+void SoftwareRenderer::render(const std::vector<glm::vec4>& pos,
+                              const std::vector<uint32_t>& color,
+                              const glm::mat4& view,
+                              const glm::mat4& projection) {
+    glm::mat4 viewProjection = projection * view;
+    std::vector<std::thread> threads;
+
+    // project and bin a contiguous range per thread
+    size_t chunk = (pos.size() + threadCount - 1) / threadCount;
+    for (unsigned t = 0; t < threadCount; t++) {
+        size_t begin = std::min(pos.size(), t * chunk);
+        size_t end = std::min(pos.size(), begin + chunk);
+        threads.emplace_back(&SoftwareRenderer::project, this, t,
+                             begin, end, std::cref(pos), std::cref(color),
+                             std::cref(viewProjection));
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+
+    // splat the tiles, each one is owned by a single thread
+    std::atomic<int> nextTile(0);
+    for (unsigned t = 0; t < threadCount; t++)
+        threads.emplace_back([this, &nextTile]() {
+            int tile;
+            while ((tile = nextTile++) < tilesX * tilesY)
+                rasterize(tile);
+        });
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+std::vector<unsigned char> SoftwareRenderer::toneMap(float exposure) const {
+    std::vector<unsigned char> pixels(width * height * 4);
+    for (size_t i = 0; i < framebuffer.size(); i++) {
+        // same curve as gpu/tonemap.frag, without bloom
+        for (int c = 0; c < 3; c++) {
+            float mapped = 1 - expf(-framebuffer[i][c] * exposure);
+            pixels[i * 4 + c] = static_cast<unsigned char>(
+                        mapped * 255 + 0.5f);
+        }
+        pixels[i * 4 + 3] = 255;
+    }
+    return pixels;
+}
+
+bool SoftwareRenderer::writePng(const std::string& fileName,
+                                float exposure) const {
+    std::vector<unsigned char> pixels = toneMap(exposure);
+    return ::writePng(fileName, width, height, pixels.data());
+}
@@ -0,0 +1,83 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_SOFTWARERENDERER_H_
+#define SRC_SOFTWARERENDERER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// CPU version of the density renderer for hosts without a GL stack.
+// Particles are projected four at a time with SSE and binned per thread
+// into screen tiles. Every tile is then splatted by exactly one thread,
+// so the threads never write to the same pixels.
+class SoftwareRenderer {
+ public:
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    unsigned threadCount;
+
+    // rgb is the accumulated light, a the density, bottom row first
+    std::vector<glm::vec4> framebuffer;
+
+    // threads defaults to the number of hardware threads
+    SoftwareRenderer(int width, int height, unsigned threads = 0);
+
+    // view and projection as built by the Renderer camera
+    void render(const std::vector<glm::vec4>& pos,
+                const std::vector<uint32_t>& color,
+                const glm::mat4& view,
+                const glm::mat4& projection);
+    // RGBA8, bottom row first like glReadPixels
+    std::vector<unsigned char> toneMap(float exposure) const;
+    bool writePng(const std::string& fileName, float exposure) const;
+
+ private:
+    // a projected particle, light is its color times its mass
+    struct Splat {
+        float x;
+        float y;
+        float radius;
+        float light[4];
+    };
+
+    // bins[thread][tile]
+    std::vector<std::vector<std::vector<Splat>>> bins;
+
+    void project(unsigned thread, size_t begin, size_t end,
+                 const std::vector<glm::vec4>& pos,
+                 const std::vector<uint32_t>& color,
+                 const glm::mat4& viewProjection);
+    void bin(unsigned thread, float x, float y, float w, float mass,
+             uint32_t color);
+    void rasterize(int tile);
+};
+
+#endif  // SRC_SOFTWARERENDERER_H_
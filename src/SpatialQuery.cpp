@@ -0,0 +1,218 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "SpatialQuery.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+
+#include "MemoryTracker.h"
+#include "util.h"
+#include "options.h"
+
+const QueryHit* QueryBatch::hitsOf(size_t i) const {
+    return hits.data() + i * queryMaxResults;
+}
+
+size_t QueryBatch::hitCount(size_t i) const {
+    return std::min<size_t>(results[i].count, queryMaxResults);
+}
+
+SpatialQuery::SpatialQuery(Simulator* simulator, ClusterBounds* bounds)
+    : bounds(bounds), pending(false), capacity(0) {
+    program = simulator->buildProgram(
+                readFile("gpu/query.cl"),
+                "-DQUERY_MAX_RESULTS=" + std::to_string(queryMaxResults));
+    try {
+        queue = cl::CommandQueue(simulator->context, simulator->currentDevice,
+                                 CL_QUEUE_PROFILING_ENABLE);
+        queryKernel = cl::Kernel(program, "runQueries");
+
+        queryBuffer = cl::Buffer(
+                    simulator->context, CL_MEM_READ_ONLY,
+                    queryBatchCapacity * sizeof(ParticleQuery));
+        resultBuffer = cl::Buffer(
+                    simulator->context, CL_MEM_WRITE_ONLY,
+                    queryBatchCapacity * sizeof(QueryResult));
+        hitBuffer = cl::Buffer(
+                    simulator->context, CL_MEM_WRITE_ONLY,
+                    queryBatchCapacity * queryMaxResults * sizeof(QueryHit));
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+}
+
+SpatialQuery::~SpatialQuery() {
+    queue.finish();
+}
+
+void SpatialQuery::allocateBuffers(Simulator* simulator) {
+    if (simulator->particleCount <= capacity)
+        return;
+
+    capacity = simulator->particleCount;
+    int clusters = (capacity + boundsClusterSize - 1) / boundsClusterSize;
+    int groups = (clusters + boundsGroupSize - 1) / boundsGroupSize;
+    positionSnapshot = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                                  capacity * sizeof(cl_float4));
+    idSnapshot = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                            capacity * sizeof(cl_uint));
+    // a lower and an upper corner per box
+    clusterBuffer = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                               2 * clusters * sizeof(cl_float4));
+    groupBuffer = cl::Buffer(simulator->context, CL_MEM_READ_WRITE,
+                             2 * groups * sizeof(cl_float4));
+    memoryTracker.track("query snapshot", CL_MEMORY,
+                        capacity * (sizeof(cl_float4) + sizeof(cl_uint))
+                        + 2 * (clusters + groups) * sizeof(cl_float4));
+}
+
+bool SpatialQuery::submit(const std::vector<ParticleQuery>& queries) {
+    if (queries.empty() || queries.size() > queryBatchCapacity) {
+        printf("Query batches hold 1 to %u queries\n", queryBatchCapacity);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!requested.empty())
+        return false;
+    requested = queries;
+    return true;
+}
+
+void SpatialQuery::afterStep(Simulator* simulator) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // one batch at a time, the next one waits for the following step
+    if (pending || requested.empty())
+        return;
+
+    cl_uint particleCount = simulator->particleCount;
+    if (particleCount == 0)
+        return;
+
+    cl_uint clusterCount = bounds->clusterCount;
+    cl_uint groupCount = bounds->groupCount;
+    cl_uint queryCount = requested.size();
+
+    try {
+        allocateBuffers(simulator);
+
+        // the only work on the simulation queue is a device side copy
+        std::vector<cl::Event> copies(4);
+        simulator->queue.enqueueCopyBuffer(
+                    simulator->positionBuffer, positionSnapshot, 0, 0,
+                    particleCount * sizeof(cl_float4), NULL, &copies[0]);
+        simulator->queue.enqueueCopyBuffer(
+                    simulator->idBuffer, idSnapshot, 0, 0,
+                    particleCount * sizeof(cl_uint), NULL, &copies[1]);
+        simulator->queue.enqueueCopyBuffer(
+                    bounds->clusterBuffer, clusterBuffer, 0, 0,
+                    2 * clusterCount * sizeof(cl_float4), NULL, &copies[2]);
+        simulator->queue.enqueueCopyBuffer(
+                    bounds->groupBuffer, groupBuffer, 0, 0,
+                    2 * groupCount * sizeof(cl_float4), NULL, &copies[3]);
+
+        running.queries.swap(requested);
+        requested.clear();
+        running.results.resize(queryCount);
+        running.hits.resize(queryCount * queryMaxResults);
+        running.step = simulator->stepCount;
+        queue.enqueueWriteBuffer(queryBuffer, CL_FALSE, 0,
+                                 queryCount * sizeof(ParticleQuery),
+                                 running.queries.data());
+
+        queryKernel.setArg(0, positionSnapshot);
+        queryKernel.setArg(1, idSnapshot);
+        queryKernel.setArg(2, particleCount);
+        queryKernel.setArg(3, boundsClusterSize);
+        queryKernel.setArg(4, clusterBuffer);
+        queryKernel.setArg(5, clusterCount);
+        queryKernel.setArg(6, boundsGroupSize);
+        queryKernel.setArg(7, groupBuffer);
+        queryKernel.setArg(8, groupCount);
+        queryKernel.setArg(9, queryBuffer);
+        queryKernel.setArg(10, queryCount);
+        queryKernel.setArg(11, resultBuffer);
+        queryKernel.setArg(12, hitBuffer);
+        queue.enqueueNDRangeKernel(
+                    queryKernel, cl::NullRange,
+                    cl::NDRange(queryCount), cl::NullRange, &copies,
+                    &queryEvent);
+
+        // only the compact results come back
+        queue.enqueueReadBuffer(resultBuffer, CL_FALSE, 0,
+                                queryCount * sizeof(QueryResult),
+                                running.results.data());
+        queue.enqueueReadBuffer(hitBuffer, CL_FALSE, 0,
+                                running.hits.size() * sizeof(QueryHit),
+                                running.hits.data(), NULL, &readEvent);
+        queue.flush();
+        pending = true;
+    }
+    catch (cl::Error er) {
+        printf("ERROR: %s(%s)\n",
+               er.what(), Simulator::oclErrorString(er.err()));
+    }
+}
+
+bool SpatialQuery::poll(QueryBatch* batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pending)
+        return false;
+
+    cl_int status =
+            readEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
+    if (status != CL_COMPLETE)
+        return false;
+
+    cl_ulong start =
+            queryEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    cl_ulong end = queryEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    running.deviceMs = (end - start) / 1.0e6;
+
+    std::swap(*batch, running);
+    pending = false;
+    return true;
+}
+
+void SpatialQuery::print(const QueryBatch& batch) {
+    static const char* typeNames[] = {"range", "nearest", "mass"};
+
+    printf("step %lu: %zu queries in %.3f ms\n", batch.step,
+           batch.queries.size(), batch.deviceMs);
+    for (size_t i = 0; i < batch.queries.size(); i++) {
+        const ParticleQuery& query = batch.queries[i];
+        printf("%s (%g, %g, %g) radius %g: %u particles, mass %g\n",
+               typeNames[query.type], query.center[0], query.center[1],
+               query.center[2], query.radius, batch.results[i].count,
+               batch.results[i].mass);
+        const QueryHit* hits = batch.hitsOf(i);
+        for (size_t j = 0; j < batch.hitCount(i); j++)
+            printf("    particle %u at %g\n", hits[j].id, hits[j].distance);
+    }
+}
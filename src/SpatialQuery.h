@@ -0,0 +1,128 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_SPATIALQUERY_H_
+#define SRC_SPATIALQUERY_H_
+
+#include <mutex>
+#include <vector>
+
+#include "Simulator.h"
+#include "ClusterBounds.h"
+
+// Must match the QUERY_ types in gpu/query.cl
+enum QueryType {
+    // particles within radius, the first queryMaxResults are listed
+    QUERY_RANGE = 0,
+    // the k nearest particles within radius, sorted by distance
+    QUERY_NEAREST = 1,
+    // mass and number of the particles within radius
+    QUERY_MASS = 2
+};
+
+// Must match Query in gpu/query.cl
+struct ParticleQuery {
+    cl_float center[3];
+    // distances are measured to the ray from center along this direction
+    // if it is not zero, used for picking
+    cl_float direction[3];
+    // INFINITY for unbounded nearest queries
+    cl_float radius;
+    cl_uint type;
+    cl_uint k;
+};
+
+// Must match QueryResult in gpu/query.cl
+struct QueryResult {
+    // all matches, may exceed the listed hits of range queries
+    cl_uint count;
+    // of range and mass queries
+    cl_float mass;
+};
+
+// Must match QueryHit in gpu/query.cl
+struct QueryHit {
+    // stable particle id, see Simulator::particleIds
+    cl_uint id;
+    cl_float distance;
+};
+
+struct QueryBatch {
+    std::vector<ParticleQuery> queries;
+    std::vector<QueryResult> results;
+    // queryMaxResults per query
+    std::vector<QueryHit> hits;
+    unsigned long step = 0;
+    // the queries on the device
+    double deviceMs = 0;
+
+    // the listed hits of query i
+    const QueryHit* hitsOf(size_t i) const;
+    size_t hitCount(size_t i) const;
+};
+
+// Answers batches of range, nearest and mass queries on the device from
+// a snapshot of the state and its cluster bounds after a step, so it has
+// to follow the ClusterBounds stage. Only the results are read back.
+// Batches are submitted and polled from any thread.
+class SpatialQuery : public SimulationStage {
+ public:
+    cl::CommandQueue queue;
+    cl::Program program;
+    cl::Kernel queryKernel;
+
+    cl::Buffer positionSnapshot;
+    cl::Buffer idSnapshot;
+    cl::Buffer clusterBuffer;
+    cl::Buffer groupBuffer;
+    cl::Buffer queryBuffer;
+    cl::Buffer resultBuffer;
+    cl::Buffer hitBuffer;
+
+    SpatialQuery(Simulator* simulator, ClusterBounds* bounds);
+    ~SpatialQuery();
+
+    // false if a batch is still waiting to run
+    bool submit(const std::vector<ParticleQuery>& queries);
+    void afterStep(Simulator* simulator) override;
+    // moves the answered batch into batch
+    bool poll(QueryBatch* batch);
+    static void print(const QueryBatch& batch);
+
+ private:
+    ClusterBounds* bounds;
+    std::mutex mutex;
+    std::vector<ParticleQuery> requested;
+    // the batch in flight and the targets of its reads
+    QueryBatch running;
+    bool pending;
+    cl::Event queryEvent;
+    cl::Event readEvent;
+    int capacity;
+
+    void allocateBuffers(Simulator* simulator);
+};
+
+#endif  // SRC_SPATIALQUERY_H_
@@ -0,0 +1,74 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_SPSCQUEUE_H_
+#define SRC_SPSCQUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free ring buffer for exactly one producer and one consumer
+// thread. Capacity has to be a power of two.
+template <typename T, size_t Capacity>
+class SpscQueue {
+ public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // producer: false if the queue is full
+    bool push(const T& item) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        items[currentTail & (Capacity - 1)] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer: false if the queue is empty
+    bool pop(T* item) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+            return false;
+        *item = items[currentHead & (Capacity - 1)];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    // either thread: the number of items, may already be outdated
+    size_t size() const {
+        return tail.load(std::memory_order_relaxed)
+                - head.load(std::memory_order_relaxed);
+    }
+
+ private:
+    static_assert((Capacity & (Capacity - 1)) == 0,
+                  "SpscQueue capacity has to be a power of two");
+
+    T items[Capacity];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+#endif  // SRC_SPSCQUEUE_H_
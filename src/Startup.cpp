@@ -0,0 +1,72 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "Startup.h"
+
+StartupProfile::StartupProfile() {
+    start = Clock::now();
+    mainThread = std::this_thread::get_id();
+}
+
+double StartupProfile::toMs(Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                time - start).count() / 1000.0;
+}
+
+StartupProfile::Timer::Timer(StartupProfile* profile,
+                             const std::string& name)
+    : profile(profile), name(name), start(Clock::now()) {}
+
+StartupProfile::Timer::~Timer() {
+    Phase phase = {name, profile->toMs(start), profile->toMs(Clock::now()),
+                   std::this_thread::get_id() == profile->mainThread};
+    std::lock_guard<std::mutex> lock(profile->mutex);
+    profile->phases.push_back(phase);
+}
+
+void StartupProfile::print(const std::string& milestone) {
+    double total = toMs(Clock::now());
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::sort(phases.begin(), phases.end(),
+              [](const Phase& a, const Phase& b) {
+                  return a.startMs < b.startMs;
+              });
+
+    double sequential = 0;
+    printf("\n%-24s %-8s %10s %10s\n", "startup phase", "thread",
+           "start ms", "took ms");
+    for (const Phase& phase : phases) {
+        printf("%-24s %-8s %10.1f %10.1f\n", phase.name.c_str(),
+               phase.mainThread ? "main" : "worker",
+               phase.startMs, phase.endMs - phase.startMs);
+        sequential += phase.endMs - phase.startMs;
+    }
+    printf("%s after %.1f ms, phases add up to %.1f ms\n\n",
+           milestone.c_str(), total, sequential);
+}
@@ -0,0 +1,86 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_STARTUP_H_
+#define SRC_STARTUP_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <chrono>
+
+// Runs startup phases on the calling thread or on worker threads and
+// records when each of them started and how long it took.
+class StartupProfile {
+ public:
+    StartupProfile();
+
+    template <typename F>
+    auto run(const std::string& name, F task) -> decltype(task()) {
+        Timer timer(this, name);
+        return task();
+    }
+
+    template <typename F>
+    auto launch(const std::string& name, F task)
+            -> std::future<decltype(task())> {
+        return std::async(std::launch::async, [this, name, task]() {
+            return run(name, task);
+        });
+    }
+
+    void print(const std::string& milestone);
+
+ private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Phase {
+        std::string name;
+        double startMs;
+        double endMs;
+        bool mainThread;
+    };
+
+    class Timer {
+     public:
+        Timer(StartupProfile* profile, const std::string& name);
+        ~Timer();
+     private:
+        StartupProfile* profile;
+        std::string name;
+        Clock::time_point start;
+    };
+
+    double toMs(Clock::time_point time);
+
+    Clock::time_point start;
+    std::thread::id mainThread;
+    std::mutex mutex;
+    std::vector<Phase> phases;
+};
+
+#endif  // SRC_STARTUP_H_
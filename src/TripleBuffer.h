@@ -0,0 +1,70 @@
+/* Universe
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright 2015 Lubosz Sarnecki <lubosz@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SRC_TRIPLEBUFFER_H_
+#define SRC_TRIPLEBUFFER_H_
+
+#include <atomic>
+
+// Lock-free hand over of the most recent state from one producer thread
+// to one consumer thread. The producer always owns back(), the consumer
+// owns front(), the third slot sits in between and is swapped atomically.
+class TripleBuffer {
+ public:
+    TripleBuffer() : backIndex(0), middle(1), frontIndex(2) {}
+
+    int back() const { return backIndex; }
+    int front() const { return frontIndex; }
+
+    // producer: hand the finished back slot over and take a free one
+    void publish() {
+        backIndex = middle.exchange(backIndex | FRESH,
+                                    std::memory_order_acq_rel) & INDEX;
+    }
+
+    // consumer: true if a state newer than front() is waiting
+    bool hasUpdate() const {
+        return middle.load(std::memory_order_acquire) & FRESH;
+    }
+
+    // consumer: take the newest state, returns false if there is none
+    bool update() {
+        if (!hasUpdate())
+            return false;
+        frontIndex = middle.exchange(frontIndex,
+                                     std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+ private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    int backIndex;
+    std::atomic<int> middle;
+    int frontIndex;
+};
+
+#endif  // SRC_TRIPLEBUFFER_H_
@@ -28,15 +28,61 @@
 
 #include "Renderer.h"
 #include "Simulator.h"
+#include "MortonOrder.h"
+#include "Diagnostics.h"
+#include "MergeLog.h"
+#include "Scenarios.h"
+#include "Catalogue.h"
+#include "Benchmark.h"
+#include "Startup.h"
+#include "SimulationThread.h"
+#include "FrameGovernor.h"
+#include "MetricsServer.h"
+#include "Metrics.h"
+#include "MemoryTracker.h"
+#include "ClusterBounds.h"
+#include "SpatialQuery.h"
+#include "RewindBuffer.h"
+#include "PointHierarchy.h"
+#include "DensityRenderer.h"
+#include "FrameCapture.h"
+#include "SoftwareRenderer.h"
+#include "Ensemble.h"
+#include "OutOfCore.h"
+#include "CpuForces.h"
 #include "util.h"
 #include "options.h"
+#include <limits.h>
 #include <math.h>
 #include <random>
 #include <ctime>
 #include <chrono>
+#include <future>
+#include <string>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 Simulator* simulator;
+MortonOrder* mortonOrder = NULL;
+Diagnostics* diagnostics = NULL;
+MergeLog* mergeLog = NULL;
+ClusterBounds* clusterBounds = NULL;
+SpatialQuery* spatialQuery = NULL;
+RewindBuffer* rewindBuffer = NULL;
+SimulationThread* simulationThread = NULL;
+FrameGovernor* governor = NULL;
+MetricsServer* metricsServer = NULL;
+bool governing = true;
 Renderer* renderer = NULL;
+PointHierarchy* hierarchy = NULL;
+DensityRenderer* densityRenderer = NULL;
+bool levelOfDetail = true;
+bool densityRendering = false;
+FrameCapture* frameCapture = NULL;
+// offscreen capture renders without showing the window
+bool hiddenWindow = false;
 GLFWwindow* window = NULL;
 bool fullscreen = false;
 
@@ -46,37 +92,113 @@ int currentWindowHeight = window_height;
 int mouse_old_x, mouse_old_y;
 int mouse_buttons = 0;
 
+// one vertex array per published state
+GLuint stateVertexArrays[3];
+// positions of the state published before the front one
+GLuint previousPositionVBO = 0;
+double previousTime = 0;
+unsigned long previousGeneration = 0;
+
 void initWindow();
-void initParticles();
+// newContext skips deleting the vertex arrays, they died with the old one
+void createStateVertexArrays(bool newContext);
+
+// Substeps, step size and render detail of the current governor level,
+// the ungoverned defaults otherwise
+static void applyGovernorLevel() {
+    const GovernorLevel& level = governor->current();
+    simulationThread->substeps = governing ? level.substeps : 0;
+    // frame times differ between runs, so they must not change the dt of
+    // a deterministic run
+    bool scaleDt = governing && !simulator->deterministic;
+    simulationThread->dtScale = scaleDt ? level.dtScale : 1;
+    hierarchy->detailPixels = governing ? level.detailPixels : lodPixels;
+}
+
+static void sendCommand(const SimulationCommand& command) {
+    if (!simulationThread->send(command))
+        printf("Simulation command queue is full\n");
+}
 
 static void windowFrameBufferCallback(
         GLFWwindow * window, int width, int height) {
     renderer->updateProjection(width, height);
+    if (densityRenderer)
+        densityRenderer->resize(width, height);
 }
 
 static void errorCallback(int error, const char* description) {
     fputs(description, stderr);
 }
+// the nearest particle to the ray under the cursor
+static void pickParticle(GLFWwindow* window, double x, double y) {
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+    glm::vec4 viewport(0, 0, width, height);
+    glm::vec3 cursor(x, height - y, 0);
+    glm::vec3 nearPoint = glm::unProject(cursor, renderer->view,
+                                         renderer->projection, viewport);
+    cursor.z = 1;
+    glm::vec3 farPoint = glm::unProject(cursor, renderer->view,
+                                        renderer->projection, viewport);
+    glm::vec3 direction = glm::normalize(farPoint - nearPoint);
+
+    ParticleQuery query = {
+        {nearPoint.x, nearPoint.y, nearPoint.z},
+        {direction.x, direction.y, direction.z},
+        queryPickRadius, QUERY_NEAREST, 1
+    };
+    spatialQuery->submit({query});
+}
+
+// the mass enclosed in spheres of doubling radius around the origin
+static void queryMassProfile() {
+    std::vector<ParticleQuery> queries(queryProfileShells);
+    float radius = queryProfileRadius;
+    for (ParticleQuery& query : queries) {
+        query = {{0, 0, 0}, {0, 0, 0}, radius, QUERY_MASS, 0};
+        radius *= 2;
+    }
+    spatialQuery->submit(queries);
+}
+
 static void keyCallback(
         GLFWwindow* window, int key, int scancode, int action, int mods) {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GL_TRUE);
     if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
-        simulator->dt = fastDt;
+        sendCommand({SimulationCommand::SET_DT, fastDt, 0, 0});
     if (key == GLFW_KEY_SPACE && action == GLFW_RELEASE)
-        simulator->dt = slowDt;
+        sendCommand({SimulationCommand::SET_DT, slowDt, 0, 0});
     if (key == GLFW_KEY_F && action == GLFW_PRESS) {
         fullscreen = !fullscreen;
         initWindow();
         renderer->bindState(currentWindowWidth,
                             currentWindowHeight);
-        renderer->createVertexArray(simulator->positionVBO,
-                       simulator->colorVBO,
-                       simulator->massVBO);
+        createStateVertexArrays(true);
+        hierarchy->createVertexArray();
+        densityRenderer->resize(currentWindowWidth, currentWindowHeight);
+    }
+    if (key == GLFW_KEY_L && action == GLFW_PRESS)
+        levelOfDetail = !levelOfDetail;
+    if (key == GLFW_KEY_D && action == GLFW_PRESS)
+        densityRendering = !densityRendering;
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        governing = !governing;
+        applyGovernorLevel();
     }
     if (key == GLFW_KEY_R && action == GLFW_PRESS) {
-        initParticles();
+        std::random_device rd;
+        unsigned int seed = deterministicSimulation ? deterministicSeed : rd();
+        sendCommand({SimulationCommand::RESET, 0, seed, 0});
     }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS)
+        queryMassProfile();
+    if (key == GLFW_KEY_J && action == GLFW_PRESS)
+        simulationThread->jetRate =
+                simulationThread->jetRate ? 0 : jetParticlesPerStep;
+    if (key == GLFW_KEY_B && action == GLFW_PRESS)
+        sendCommand({SimulationCommand::REWIND, 0, 0, rewindSeconds});
 }
 
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
@@ -93,6 +215,8 @@ void buttonCallback(GLFWwindow* window, int button, int action, int mods) {
 
     double x, y;
     glfwGetCursorPos(window, &x, &y);
+    if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS)
+        pickParticle(window, x, y);
 
     mouse_old_x = x;
     mouse_old_y = y;
@@ -122,6 +246,7 @@ void initWindow() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, hiddenWindow ? GL_FALSE : GL_TRUE);
 
     if (fullscreen) {
         const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
@@ -168,159 +293,587 @@ void initWindow() {
 }
 
 void initSolarSystem() {
-    std::vector<glm::vec4> pos;
-    std::vector<glm::vec4> vel;
-    std::vector<glm::vec4> color;
-    std::vector<GLfloat> mass;
-
-    float gravity = 0.000000000066742;
-    float centralMass = 1000;
-    float radius = 20;
-    float sateliteMass = 100;
-
-    // create central mass particle
-    pos.push_back(glm::vec4(0, 0, 0, 1));
-    vel.push_back(glm::vec4(0, 0, 0, 1));
-    color.push_back(glm::vec4(1, 0, 0, 1));
-    mass.push_back(centralMass);
-
-    // calculate inertial direction/tangent on circle
-    glm::vec4 tangent =
-            glm::vec4(
-                cos(2 * M_PI * 0.1),
-                -sin(2 * M_PI * 0.1), 0, 1);
-    // normalize tangent
-    glm::vec4 normalizedTanent = glm::normalize(tangent);
-
-    // calculate inertial acceleration of satelite to match a stable orbit
-    float acceleration = sqrt(gravity * centralMass / radius);
-
-    // create satellite particle
-    pos.push_back(glm::vec4(0, radius, 0, 1));
-    vel.push_back(glm::vec4(normalizedTanent.x * acceleration,
-                       normalizedTanent.y * acceleration,
-                       normalizedTanent.z * acceleration,
-                       1.0));
-    color.push_back(glm::vec4(0, 1, 0, 1));
-    mass.push_back(sateliteMass);
-
-    simulator->loadData(pos, vel, color, mass);
+    ParticleData data = generateSolarSystem();
+    simulator->loadData(data.pos, data.vel, data.color);
 }
 
-void initParticles() {
-    // initialize our particle system with positions, velocities and color
-    const int num = NUM_PARTICLES;
-
-    std::vector<glm::vec4> pos(num);
-    std::vector<glm::vec4> vel(num);
-    std::vector<glm::vec4> color(num);
-    std::vector<GLfloat> mass(num);
+void createStateVertexArrays(bool newContext) {
+    static int previousPositionCapacity = 0;
+    if (previousPositionCapacity < simulator->particleCapacity) {
+        if (previousPositionVBO)
+            glDeleteBuffers(1, &previousPositionVBO);
+        previousPositionCapacity = simulator->particleCapacity;
+        size_t size = previousPositionCapacity * sizeof(glm::vec4);
+        previousPositionVBO = Renderer::createVBO(
+                    NULL, size, GL_ARRAY_BUFFER, GL_DYNAMIC_COPY);
+        memoryTracker.track("previous positions", GL_BUFFER_MEMORY, size);
+    }
 
-    std::random_device rd;
-    std::mt19937 e2(rd());
+    // growing the capacity would leak the old ones, before the first call
+    // they are 0, which glDeleteVertexArrays ignores
+    if (!newContext)
+        glDeleteVertexArrays(3, stateVertexArrays);
+    for (int i = 0; i < 3; i++)
+        stateVertexArrays[i] = renderer->createVertexArray(
+                    simulator->published[i].positionVBO,
+                    previousPositionVBO,
+                    simulator->published[i].colorVBO);
+    renderer->bindVertexArray(
+                stateVertexArrays[simulator->publishedStates.front()]);
+}
 
-    float meanRadius = 20;
-    std::normal_distribution<> radiusDistribution(meanRadius, meanRadius/2.0);
-    std::normal_distribution<> positionDistribution(0.5, 0.5);
-    std::normal_distribution<> heightDistribution(0, .5);
-    std::uniform_real_distribution<> massDistribution(1, 50);
+static void copyPositions(const PublishedState& state) {
+    glBindBuffer(GL_COPY_READ_BUFFER, state.positionVBO);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, previousPositionVBO);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        state.particleCount * sizeof(glm::vec4));
+    previousTime = state.time;
+    previousGeneration = state.slotGeneration;
+}
 
-    for (int i = 0; i < num; i++) {
-        // distribute the particles in a circle
-        float radius = radiusDistribution(e2);
-        float arrayPositionRatio = positionDistribution(e2);
+// Lets the simulation thread write to the slots whose GL commands
+// completed, without waiting for the others
+static void pollSlotFences() {
+    for (PublishedState& state : simulator->published) {
+        if (!state.fence)
+            continue;
+        GLenum status = glClientWaitSync(state.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED
+                && status != GL_CONDITION_SATISFIED)
+            continue;
+        glDeleteSync(state.fence);
+        state.fence = 0;
+        state.idle.store(true, std::memory_order_release);
+    }
+}
 
-        pos[i] = glm::vec4(radius * sin(2 * M_PI * arrayPositionRatio),
-                      radius * cos(2 * M_PI * arrayPositionRatio),
-                      heightDistribution(e2), 1.0f);
+// Before the simulation thread stops, so it does not wait for a poll
+static void releaseSlots() {
+    glFinish();
+    pollSlotFences();
+}
 
-        // distribute masses
-        mass[i] = massDistribution(e2);
+// Takes the newest published state, the one it replaces is kept in
+// previousPositionVBO to interpolate between them.
+void updateFrontState() {
+    pollSlotFences();
+    TripleBuffer& states = simulator->publishedStates;
+    if (!states.hasUpdate())
+        return;
+
+    PublishedState& released = simulator->published[states.front()];
+    copyPositions(released);
+    // the slot goes back to the simulation thread, which waits for this
+    // fence before OpenCL copies or writes through its mapping again
+    released.idle = false;
+    released.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    states.update();
+
+    // after a reorder or reset the previous positions belong to other
+    // particles, start from the new state instead
+    const PublishedState& front = simulator->published[states.front()];
+    if (front.slotGeneration != previousGeneration)
+        copyPositions(front);
+
+    renderer->bindVertexArray(stateVertexArrays[states.front()]);
+
+    hierarchy->build(front.positionVBO, previousPositionVBO, front.colorVBO,
+                     front.particleCount);
+}
 
+// Position of the frame time between the previous and the front state
+float interpolationFactor() {
+    const PublishedState& front =
+            simulator->published[simulator->publishedStates.front()];
+    double interval = front.time - previousTime;
+    if (interval <= 0)
+        return 1;
+    return glm::clamp(
+                static_cast<float>((currentTime() - front.time) / interval),
+                0.0f, 1.0f);
+}
 
-        // give initial velocity in circle tangent direction
-        glm::vec4 tangent = glm::vec4(
-                    cos(2 * M_PI * arrayPositionRatio),
-                    -sin(2 * M_PI * arrayPositionRatio), 0, 1);
-        glm::vec4 normalizedTanent = glm::normalize(tangent);
+// Renders a catalogue, or a generated galaxy without one, on the CPU,
+// needs neither GL nor CL
+void renderPreview(const char* fileName, int count, const char* catalogue) {
+    ParticleData data;
+    if (catalogue) {
+        CatalogueStats stats;
+        if (!loadCatalogue(catalogue, &data, &stats))
+            exit(EXIT_FAILURE);
+        count = data.pos.size();
+    } else {
+        std::random_device rd;
+        data = generateGalaxy(count, rd());
+    }
 
-        float acceleration = 0.001 * (radius/meanRadius*0.75);
-        vel[i] = normalizedTanent * acceleration;
+    SoftwareRenderer software(window_width, window_height);
+    glm::mat4 view = Renderer::viewMatrix(initialScrollPosition,
+                                          initialTheta, initialPhi);
+    glm::mat4 projection = Renderer::projectionMatrix(window_width,
+                                                      window_height);
+
+    std::chrono::time_point<std::chrono::system_clock> start =
+            std::chrono::system_clock::now();
+    software.render(data.pos, data.color, view, projection);
+    float renderMs = std::chrono::duration_cast<std::chrono::microseconds>
+            (std::chrono::system_clock::now() - start).count() / 1000.0;
+
+    software.writePng(fileName, densityExposure);
+    printf("Rendered %d particles in %.2fms on %d threads to %s\n",
+           count, renderMs, software.threadCount, fileName);
+}
 
-        // set color. bigger radius blue, closer to center red
-        color[i] = glm::mix(glm::vec4(.9, .1, .1, 1),
-                            glm::vec4(.1, .1, .9, 1),
-                            radius / 30.0);
+// Steps a sweep of solar systems in one launch, needs no window
+void runEnsemble(int systemCount, int steps) {
+    Simulator device(Simulator::selectDevice(), false);
+    Ensemble ensemble(&device, readFile("gpu/vortex.cl"));
+
+    std::vector<ParticleData> members;
+    std::vector<float> radii;
+    for (int i = 0; i < systemCount; i++) {
+        float t = systemCount > 1 ? i / (systemCount - 1.0f) : 0;
+        radii.push_back(ensembleRadiusMin
+                        + t * (ensembleRadiusMax - ensembleRadiusMin));
+        members.push_back(generateSolarSystem(radii.back()));
+    }
+    ensemble.load(members);
+    std::vector<SimulationStats> initial = ensemble.stats();
+
+    std::chrono::time_point<std::chrono::system_clock> start =
+            std::chrono::system_clock::now();
+    ensemble.run(steps, slowDt);
+    float runMs = std::chrono::duration_cast<std::chrono::microseconds>
+            (std::chrono::system_clock::now() - start).count() / 1000.0;
+
+    std::vector<SimulationStats> result = ensemble.stats();
+
+    printf("%8s %8s %14s %6s %10s\n",
+           "system", "radius", "energy drift", "live", "max v");
+    for (int i = 0; i < systemCount; i++) {
+        float energy = initial[i].kineticEnergy + initial[i].potentialEnergy;
+        float drift = result[i].kineticEnergy + result[i].potentialEnergy
+                - energy;
+        printf("%8d %8.2f %14.6e %6.0f %10.4e\n", i, radii[i],
+               energy != 0 ? drift / fabs(energy) : drift,
+               result[i].liveParticles, result[i].maxVelocity);
     }
+    printf("%d systems, %d particles, %d steps in %.2fms\n",
+           systemCount, ensemble.particleCount, steps, runMs);
+}
 
-    pos[1] = glm::vec4(0, 0, 0, 1);
-    vel[1] = glm::vec4(0, 0, 0, 1);
-    mass[1] = bigMass;
+// the constant rate time stamp counter where there is one, which ticks
+// independently of turbo and frequency scaling, nanoseconds elsewhere
+#if defined(__x86_64__) || defined(__i386__)
+static const char* tickRate = "interact/tick";
+static unsigned long long readTicks() {
+    return __rdtsc();
+}
+#else
+static const char* tickRate = "interact/ns";
+static unsigned long long readTicks() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+// Compares every CPU force kernel the host supports against the scalar
+// one, needs neither GL nor CL
+void runCpuForces(int count) {
+    ParticleArrays particles;
+    particles.load(generateGalaxy(count, benchmarkSeed).pos);
+    double interactions = static_cast<double>(count) * count;
+
+    ForceResult reference;
+    reference.resize(particles.paddedCount);
+    CpuForces::scalar().compute(particles, 0, particles.paddedCount,
+                                &reference);
+
+    CpuForces forces;
+    printf("%d particles, dispatching to %s\n", count, forces.kernel->name);
+    printf("%-8s %12s %16s %12s %10s\n", "kernel", "ms",
+           tickRate, "force rms", "merge diff");
+
+    for (const CpuForceKernel& kernel : CpuForces::kernels()) {
+        if (!kernel.supported())
+            continue;
+
+        // the fastest repetition, the others are warmup and noise
+        ForceResult result;
+        result.resize(particles.paddedCount);
+        unsigned long long ticks = ~0ull;
+        double ms = 0;
+        for (int repetition = 0; repetition < cpuForceRepetitions;
+             repetition++) {
+            std::chrono::time_point<std::chrono::system_clock> start =
+                    std::chrono::system_clock::now();
+            unsigned long long startTicks = readTicks();
+            kernel.compute(particles, 0, particles.paddedCount, &result);
+            unsigned long long elapsed = readTicks() - startTicks;
+            if (elapsed < ticks) {
+                ticks = elapsed;
+                ms = std::chrono::duration_cast<std::chrono::microseconds>
+                        (std::chrono::system_clock::now() - start).count()
+                        / 1000.0;
+            }
+        }
+
+        double errorSum = 0;
+        double referenceSum = 0;
+        int mergeMismatches = 0;
+        for (int i = 0; i < count; i++) {
+            glm::dvec3 expected(reference.ax[i], reference.ay[i],
+                                reference.az[i]);
+            glm::dvec3 error = glm::dvec3(result.ax[i], result.ay[i],
+                                          result.az[i]) - expected;
+            errorSum += glm::dot(error, error);
+            referenceSum += glm::dot(expected, expected);
+            if (result.mergeInto[i] != reference.mergeInto[i])
+                mergeMismatches++;
+        }
 
-    // our load data function sends our initial values to the GPU
-    simulator->loadData(pos, vel, color, mass);
+        printf("%-8s %12.3f %16.3f %12.3e %10d\n", kernel.name, ms,
+               interactions / ticks,
+               referenceSum > 0 ? sqrt(errorSum / referenceSum) : 0,
+               mergeMismatches);
+    }
+}
+
+// Steps more particles than fit on the device, needs no window
+void runStreaming(size_t particleCount, int steps, const char* file) {
+    Simulator device(Simulator::selectDevice(), false);
+    OutOfCore stream(&device, readFile("gpu/vortex.cl"), particleCount,
+                     file);
+    stream.generate(streamSeed);
+
+    printf("%zu particles in %.1fMB of %s, %.1fMB on the device\n",
+           particleCount, stream.storageSize / 1.0e6,
+           file ? file : "host memory", stream.deviceBytes() / 1.0e6);
+
+    for (int i = 0; i < steps; i++) {
+        stream.step(slowDt);
+        const StreamingStats& stats = stream.stats;
+        printf("step %d: %.2fms, transfer %.2fms at %.2fGB/s, "
+               "compute %.2fms, overlap %.0f%%\n",
+               i, stats.wallMs, stats.transferMs, stats.bandwidth(),
+               stats.computeMs, stats.overlap() * 100);
+    }
 }
 
 int main(int argc, char** argv) {
-    initWindow();
-    renderer = new Renderer(currentWindowWidth,
-                            currentWindowHeight);
-    std::string kernel_source = readFile("gpu/vortex.cl");
-    simulator = new Simulator();
-    simulator->loadProgram(kernel_source);
+    // --cpu-forces [particles]
+    if (argc > 1 && std::string(argv[1]) == "--cpu-forces") {
+        runCpuForces(argc > 2 ? atoi(argv[2]) : cpuForceParticles);
+        exit(EXIT_SUCCESS);
+    }
 
-    initParticles();
-    // initSolarSystem();
+    // --stream <particles> [steps] [file]
+    if (argc > 2 && std::string(argv[1]) == "--stream") {
+        runStreaming(strtoull(argv[2], NULL, 10),
+                     argc > 3 ? atoi(argv[3]) : streamSteps,
+                     argc > 4 ? argv[4] : NULL);
+        exit(EXIT_SUCCESS);
+    }
+
+    // --ensemble [systems] [steps]
+    if (argc > 1 && std::string(argv[1]) == "--ensemble") {
+        runEnsemble(argc > 2 ? atoi(argv[2]) : ensembleSystems,
+                    argc > 3 ? atoi(argv[3]) : ensembleSteps);
+        exit(EXIT_SUCCESS);
+    }
+
+    // --preview <file.png> [particles | --load <catalogue>]
+    if (argc > 2 && std::string(argv[1]) == "--preview") {
+        if (argc > 4 && std::string(argv[3]) == "--load")
+            renderPreview(argv[2], 0, argv[4]);
+        else
+            renderPreview(argv[2], argc > 3 ? atoi(argv[3]) : NUM_PARTICLES,
+                          NULL);
+        exit(EXIT_SUCCESS);
+    }
+
+    StartupProfile startup;
+
+    // --merge-log <file.csv> and --metrics <port> after any of the modes
+    // below
+    const char* mergeLogName = mergeLogFile[0] ? mergeLogFile : NULL;
+    int metricsListenPort = metricsPort;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--merge-log")
+            mergeLogName = argv[i + 1];
+        if (std::string(argv[i]) == "--metrics")
+            metricsListenPort = atoi(argv[i + 1]);
+    }
+
+    // --capture <directory> [frames]
+    std::string captureDirectory;
+    unsigned long captureFrames = 0;
+    if (argc > 2 && std::string(argv[1]) == "--capture") {
+        captureDirectory = argv[2];
+        if (argc > 3)
+            captureFrames = strtoul(argv[3], NULL, 10);
+        hiddenWindow = true;
+    }
+
+    // --load <catalogue>
+    const char* catalogue = NULL;
+    if (argc > 2 && std::string(argv[1]) == "--load")
+        catalogue = argv[2];
+
+    // these need neither a GL nor a CL context and run while the window
+    // is created
+    std::future<DeviceSelection> deviceSelection =
+            startup.launch("device discovery", Simulator::selectDevice);
+    std::future<std::string> kernelSource =
+            startup.launch("kernel source", []() {
+                return readFile("gpu/vortex.cl");
+            });
+    std::future<gli::texture> cloudTexture =
+            startup.launch("texture load", []() {
+                return Renderer::loadTexture("media/cloud-big.dds");
+            });
+    std::random_device rd;
+    unsigned int seed = deterministicSimulation ? deterministicSeed : rd();
+    // a catalogue is checked against the memory of the device before its
+    // particles are allocated, so the import waits for the CL context
+    std::promise<Simulator*> simulatorCreated;
+    std::shared_future<Simulator*> createdSimulator =
+            simulatorCreated.get_future().share();
+    std::future<ParticleData> particles =
+            startup.launch("particle generation",
+                           [seed, catalogue, createdSimulator]() {
+                if (!catalogue)
+                    return generateGalaxy(NUM_PARTICLES, seed);
+                ParticleData data;
+                CatalogueStats stats;
+                CatalogueCheck fits = [createdSimulator](size_t count) {
+                    if (count > INT_MAX) {
+                        printf("ERROR: %zu particles do not fit into "
+                               "memory\n", count);
+                        return false;
+                    }
+                    return createdSimulator.get()->fitMemory(
+                                static_cast<int>(count));
+                };
+                if (loadCatalogue(catalogue, &data, &stats, fits))
+                    printf("Loaded %zu particles from %s (%s) in %.0fms, "
+                           "%.0fMB/s on %d threads\n", stats.particles,
+                           catalogue, stats.format, stats.seconds * 1000,
+                           stats.bandwidth(), stats.threads);
+                if (stats.malformed)
+                    printf("Skipped %zu lines with missing values\n",
+                           stats.malformed);
+                return data;
+            });
+
+    startup.run("window", initWindow);
+    renderer = startup.run("renderer", [&]() {
+        return new Renderer(currentWindowWidth,
+                            currentWindowHeight,
+                            cloudTexture.get());
+    });
+    simulator = startup.run("cl context", [&]() {
+        return new Simulator(deviceSelection.get());
+    });
+    simulator->setHalfVelocities(storeHalfVelocities);
+    simulator->setDeterministic(deterministicSimulation);
+    simulatorCreated.set_value(simulator);
+    std::string kernel_source = kernelSource.get();
+
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        Benchmark benchmark(simulator, kernel_source);
+        benchmark.run();
+
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        delete(renderer);
+        delete(simulator);
+        exit(EXIT_SUCCESS);
+    }
+
+    // refuse or downgrade before the driver fails halfway through, the
+    // import of a catalogue already did
+    ParticleData initial = particles.get();
+    if (initial.pos.empty() || (!catalogue && !simulator->fitMemory(
+                                    static_cast<int>(initial.pos.size())))) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        delete(renderer);
+        delete(simulator);
+        exit(EXIT_FAILURE);
+    }
+
+    // programs only need the CL context, buffers also need the GL context
+    std::future<void> vortexProgram =
+            startup.launch("build vortex", [&]() {
+                simulator->loadProgram(kernel_source);
+            });
+    std::future<MortonOrder*> mortonProgram =
+            startup.launch("build morton", [&]() {
+                return new MortonOrder(simulator);
+            });
+    std::future<Diagnostics*> diagnosticsProgram =
+            startup.launch("build diagnostics", [&]() {
+                return new Diagnostics(simulator);
+            });
+    std::shared_future<ClusterBounds*> boundsProgram =
+            startup.launch("build bounds", [&]() {
+                return new ClusterBounds(simulator);
+            }).share();
+    std::future<SpatialQuery*> queryProgram =
+            startup.launch("build queries", [&, boundsProgram]() {
+                return new SpatialQuery(simulator, boundsProgram.get());
+            });
+
+    startup.run("particle upload", [&]() {
+        simulator->loadData(std::move(initial.pos), std::move(initial.vel),
+                            std::move(initial.color));
+    });
+
+    vortexProgram.get();
     simulator->initKernel();
+    mortonOrder = mortonProgram.get();
+    diagnostics = diagnosticsProgram.get();
+    simulator->stages.push_back(diagnostics);
+    // without it the kernel appends to the discarded merge buffers
+    if (mergeLogName) {
+        mergeLog = new MergeLog(simulator, mergeLogName);
+        simulator->stages.push_back(mergeLog);
+    }
+    spatialQuery = queryProgram.get();
+    clusterBounds = boundsProgram.get();
+    // queries copy the bounds refitted before them
+    simulator->stages.push_back(clusterBounds);
+    simulator->stages.push_back(spatialQuery);
+    rewindBuffer = new RewindBuffer(simulator);
+    simulator->stages.push_back(rewindBuffer);
+
+    simulator->measureTransport();
+    // the renderer starts with the initial state while the simulation
+    // thread works on the next one
+    simulator->publish();
+    createStateVertexArrays(false);
+    hierarchy = new PointHierarchy();
+    densityRenderer = new DensityRenderer(currentWindowWidth,
+                                          currentWindowHeight);
+    if (!captureDirectory.empty())
+        frameCapture = new FrameCapture(captureDirectory,
+                                        currentWindowWidth,
+                                        currentWindowHeight);
+    simulationThread = new SimulationThread(simulator, mortonOrder,
+                                            diagnostics, clusterBounds,
+                                            rewindBuffer);
+    // captured frames are not shown live, they get every step
+    governor = new FrameGovernor(governorTargetMs, governorMaxDtScale);
+    governing = !frameCapture;
+    applyGovernorLevel();
+    simulationThread->start();
+    if (metricsListenPort || metricsSocket[0])
+        metricsServer = new MetricsServer(metricsListenPort, metricsSocket);
 
     int printCounter = 0;
+    bool firstFrame = true;
 
     std::chrono::time_point<std::chrono::system_clock>
-            start, physicsStep, graphicsStep;
-
-    renderer->createVertexArray(simulator->positionVBO,
-                   simulator->colorVBO,
-                   simulator->massVBO);
+            start, graphicsStep;
 
     while (!glfwWindowShouldClose(window)) {
         start = std::chrono::system_clock::now();
-        simulator->runKernel();
-        physicsStep = std::chrono::system_clock::now();
 
-        renderer->draw(simulator->particleCount);
-        glfwSwapBuffers(window);
+        // spawned particles that do not fit wait for a larger capacity,
+        // which needs the GL context and the simulation paused
+        if (simulationThread->requiredCapacity > simulator->particleCapacity) {
+            releaseSlots();
+            simulationThread->stop();
+            simulator->reserve(simulationThread->requiredCapacity);
+            createStateVertexArrays(false);
+            simulator->publish();
+            simulationThread->start();
+        }
 
-        glFinish();
+        simulationThread->frame();
+        updateFrontState();
+        renderer->setInterpolation(interpolationFactor());
+        if (frameCapture)
+            frameCapture->bind(renderer);
+        int visibleCount = simulator->published[
+                simulator->publishedStates.front()].particleCount;
+        if (densityRendering)
+            densityRenderer->draw(renderer,
+                                  levelOfDetail ? hierarchy : NULL,
+                                  visibleCount);
+        else if (levelOfDetail)
+            renderer->draw(hierarchy);
+        else
+            renderer->draw(visibleCount);
+
+        if (frameCapture) {
+            // no glFinish, the readback completes in the background
+            frameCapture->capture();
+            if (captureFrames && frameCapture->frameCount >= captureFrames)
+                glfwSetWindowShouldClose(window, GL_TRUE);
+        } else {
+            glfwSwapBuffers(window);
+            glFinish();
+        }
 
         graphicsStep = std::chrono::system_clock::now();
+        float totalMs = std::chrono::duration_cast<std::chrono::microseconds>
+                (graphicsStep - start).count() / 1000.0;
+
+        metrics.frames.add();
+        if (totalMs > governorTargetMs)
+            metrics.droppedFrames.add();
+
+        if (governing && governor->update(totalMs, simulationThread->stepMs)) {
+            applyGovernorLevel();
+            governor->print();
+        }
+
+        if (firstFrame) {
+            startup.print("first frame");
+            memoryTracker.print();
+            firstFrame = false;
+        }
 
         glfwPollEvents();
 
+        QueryBatch answered;
+        if (spatialQuery->poll(&answered))
+            SpatialQuery::print(answered);
+
         printCounter--;
         if (printCounter < 0) {
-            std::cout << "simulation: "
-                      << std::chrono::duration_cast<std::chrono::microseconds>
-                         (physicsStep-start).count() / 1000.0
-                      << "ms\n";
-
-            std::cout << "graphics: "
-                      << std::chrono::duration_cast<std::chrono::microseconds>
-                         (graphicsStep-physicsStep).count() / 1000.0
-                      << "ms\n";
+            std::cout << "simulation: " << simulationThread->stepMs
+                      << "ms per step\n";
 
-            float totalMs =
-                    std::chrono::duration_cast<std::chrono::microseconds>
-                    (graphicsStep-start).count() / 1000.0;
-
-            std::cout << "total: " << totalMs << "ms ("
+            std::cout << "graphics: " << totalMs << "ms ("
                       << 1.0 / (totalMs / 1000.0) << " fps)\n";
             printCounter = 10;
         }
     }
 
+    memoryTracker.print();
+    delete(metricsServer);
+    releaseSlots();
+    simulationThread->stop();
+    delete(simulationThread);
+    delete(governor);
+    delete(hierarchy);
+    delete(densityRenderer);
+    delete(frameCapture);
+
     glfwDestroyWindow(window);
     glfwTerminate();
 
+    rewindBuffer->print();
+    delete(rewindBuffer);
+    delete(spatialQuery);
+    delete(clusterBounds);
+    delete(mergeLog);
+    delete(diagnostics);
+    delete(mortonOrder);
     delete(renderer);
     delete(simulator);
 
@@ -45,6 +45,64 @@ const float fov = 45.0f;
 const float scrollSpeed = 0.05;
 const float rotationSpeed = 0.002;
 
+// Level of detail
+
+// particles per leaf of the point hierarchy, consecutive in Morton order
+const int lodClusterSize = 256;
+// leaves per group node
+const int lodGroupSize = 16;
+// nodes smaller than this on screen are drawn as a single impostor
+const float lodPixels = 2.0f;
+
+// Frame governor
+
+// frame time held by the governor, toggled with G
+const double governorTargetMs = 1000.0 / 60.0;
+// simulation steps per frame at the best level
+const int governorSubsteps = 4;
+// accuracy floor, the governor never scales dt further. --benchmark
+// reports the error of bigger steps.
+const float governorMaxDtScale = 4;
+// coarsest impostor threshold as a multiple of lodPixels
+const float governorMaxDetailScale = 8;
+// smoothed frame times above target * governorUpperBand make the next
+// frames cheaper, below target * governorLowerBand more detailed
+const double governorUpperBand = 1.05;
+const double governorLowerBand = 0.7;
+// frames outside the band before the level changes
+const int governorPatience = 10;
+// frames ignored after a change, until its effect shows
+const int governorCooldown = 30;
+const double governorSmoothing = 0.1;
+
+// Density rendering
+
+// the density buffer has 1 / densityDownscale of the window resolution
+const int densityDownscale = 2;
+// in density buffer pixels
+const float densityMaxPointSize = 4.0f;
+const float densityExposure = 0.02f;
+const float densityBloom = 0.5f;
+
+// Software rendering
+
+// pixels per tile edge, a tile is splatted by one thread
+const int softwareTileSize = 64;
+// largest splat radius in pixels, sizes the footprint arrays
+const int softwareMaxRadius = 2;
+const float softwareNearPlane = 0.01f;
+
+// Capture
+
+// frames read back asynchronously before the renderer waits for one
+const int captureRingSize = 3;
+// frames waiting for the writer thread before the renderer waits for it
+const size_t captureQueueLimit = 8;
+// "png" or "ppm"
+const char captureFormat[] = "png";
+// nanoseconds to wait for a readback
+const unsigned long captureTimeout = 1000000000;
+
 // Simulation
 
 #define NUM_PARTICLES 15000
@@ -55,5 +113,176 @@ const float fastDt = 10 * slowDt;
 
 const float bigMass = 1;
 
+// Storage
+
+// velocities as half3, 6 instead of 12 bytes per particle. Forces are
+// still accumulated in float, --benchmark reports the accuracy impact.
+const bool storeHalfVelocities = false;
+
+// Deterministic mode
+
+// bit identical runs independent of scheduling and work group size, at
+// the cost of a position copy and a serial merge pass per step.
+// --benchmark checks the reproducibility and reports the overhead.
+const bool deterministicSimulation = false;
+// replaces the random seed of the generated and reset galaxies
+const unsigned int deterministicSeed = 42;
+// merges per step that are listed, more fall back to a full scan
+const unsigned int deterministicMergeCapacity = 1024;
+// work group sizes whose results --benchmark compares, 0 lets the
+// driver choose
+const size_t reproducibilityGroupSizes[] = {0, 0, 32, 64, 128};
+
+// copies timed per transport at startup to choose between GL sharing
+// and mapped buffers
+const int transportRepetitions = 10;
+// steps granted per frame that are kept when the simulation falls
+// behind, in frames
+const int substepCreditFrames = 2;
+// sleep of the simulation thread while it waits for the next frame
+const int simulationIdleMicroseconds = 200;
+
+// Memory Locality
+
+// sort particles along a Morton curve once the mean diagonal of the
+// cluster bounds grew by this factor since the last sort
+const float reorderSpreadThreshold = 1.5;
+// 10 bits give 30 bit keys, 21 bits give 63 bit keys, one more bit sorts
+// the deleted particles last
+const unsigned int mortonBitsPerAxis = 10;
+// keys one work item of the device radix sort walks through per pass
+const int mortonSortBlockSize = 256;
+// region covered by the curve until the diagnostics report the real bounds,
+// particles outside are clamped to its border
+const float mortonBoundsMin = -64;
+const float mortonBoundsSize = 128;
+
+// Diagnostics
+
+// evaluate energy, momentum and bounds every diagnosticsInterval steps
+const int diagnosticsInterval = 10;
+// particles whose exact potential is summed to estimate the total
+const unsigned int potentialSamples = 256;
+const size_t diagnosticsGroups = 64;
+const size_t diagnosticsGroupSize = 256;
+// print the diagnostics every diagnosticsPrintInterval steps,
+// a multiple of diagnosticsInterval
+const unsigned long diagnosticsPrintInterval = 1000;
+
+// Merge log
+
+// the device buffers are rotated and drained every mergeLogInterval steps
+const int mergeLogInterval = 10;
+const int mergeLogSlots = 3;
+// merges per interval that fit, further ones are counted as dropped
+const unsigned int mergeLogCapacity = 4096;
+// written only if not empty, or if --merge-log names a file
+const char mergeLogFile[] = "";
+
+// Cluster bounds
+
+// particles per bounding box and boxes per group, refitted every step
+const unsigned int boundsClusterSize = 32;
+const unsigned int boundsGroupSize = 32;
+// steps between reading back how loose the clusters got
+const int boundsCheckInterval = 10;
+
+// Spatial queries
+
+// hits listed per query, nearest queries find at most this many
+const unsigned int queryMaxResults = 16;
+const unsigned int queryBatchCapacity = 1024;
+// press M for the mass enclosed in these radii around the origin
+const int queryProfileShells = 8;
+const float queryProfileRadius = 0.5;
+// right click picks the nearest particle within this distance of the ray
+const float queryPickRadius = 1;
+
+// Spawning
+
+// the capacity grows by at least this factor when particles do not fit
+const float particleGrowthFactor = 2;
+// slots of merged particles reused per spawn, staged on the device
+const int spawnBatchCapacity = 4096;
+// press J to toggle a jet along z emitting this many particles per step
+const int jetParticlesPerStep = 8;
+const float jetSpeed = 0.005;
+const float jetSpread = 0.1;
+const float jetMass = 1;
+
+// Rewind
+
+// press B to go back rewindSeconds, states are captured every
+// rewindInterval seconds and kept within rewindMemory bytes
+const double rewindSeconds = 5;
+const double rewindInterval = 0.25;
+const size_t rewindMemory = 512ul << 20;
+// a state is stored on its own every rewindKeyframeInterval captures,
+// the ones between only as the difference to it
+const int rewindKeyframeInterval = 20;
+// low mantissa bits dropped from every float, 8 keeps about 5 digits
+const int rewindDroppedBits = 8;
+// captures waiting for the compression thread, more are skipped
+const size_t rewindQueueLimit = 2;
+
+// Metrics
+
+// the Prometheus endpoint listens on 127.0.0.1:metricsPort, or on the
+// Unix socket metricsSocket if it is not empty. A port of 0 disables it,
+// --metrics <port> enables it for one run.
+const int metricsPort = 0;
+const char metricsSocket[] = "";
+const int metricsPollMilliseconds = 200;
+
+// Benchmark
+
+// run with --benchmark to compare accuracy and speed of the kernel modes
+const int benchmarkParticles = 2048;
+const int benchmarkSteps = 100;
+const unsigned int benchmarkSeed = 42;
+
+// Ensemble
+
+// run with --ensemble to sweep the orbit radius of many solar systems
+const int ensembleSystems = 4096;
+const int ensembleSteps = 1000;
+const float ensembleRadiusMin = 10;
+const float ensembleRadiusMax = 30;
+
+// CPU forces
+
+// particle arrays are padded to a multiple of the widest SIMD kernel
+const int cpuForcePadding = 16;
+// run with --cpu-forces to measure interactions per cycle of every kernel
+const int cpuForceParticles = 4096;
+const int cpuForceRepetitions = 5;
+
+// Out-of-core streaming
+
+// run with --stream to keep the particles in host memory or a file,
+// the device only holds two i-blocks and two j-tiles of these sizes
+const size_t streamBlockSize = 65536;
+const size_t streamTileSize = 65536;
+const int streamSteps = 10;
+const unsigned int streamSeed = 42;
+
+// Catalogue import
+
+// run with --load <file> to start from a Gadget snapshot or a text table,
+// scaled into the units of the simulation by these factors
+const float importPositionScale = 1;
+const float importVelocityScale = 1;
+const float importMassScale = 1;
+// mass of particles from a table without a mass column
+const float importDefaultMass = 10;
+// parsing threads, 0 uses one per core
+const int importThreads = 0;
+
+// Memory
+
+// share of the device and host memory a run may plan to use, the rest is
+// left to the driver, the window system and other processes
+const double memoryBudget = 0.9;
+
 #endif // OPTIONS_H
 
@@ -25,15 +25,23 @@
 
 #include <string>
 #include <fstream>
-#include <streambuf>
 #include <iostream>
+#include <chrono>
 
 #include "util.h"
 
 std::string readFile(const char* fileName) {
-    std::ifstream stream(fileName);
-    std::string source((std::istreambuf_iterator<char>(stream)),
-                              std::istreambuf_iterator<char>());
+    std::ifstream stream(fileName, std::ios::in | std::ios::binary);
+    std::string source;
+
+    // read the whole file at once instead of char by char
+    stream.seekg(0, std::ios::end);
+    std::streamoff size = stream.tellg();
+    if (stream && size > 0) {
+        source.resize(size);
+        stream.seekg(0, std::ios::beg);
+        stream.read(&source[0], size);
+    }
 
     if (source.size() == 0) {
         std::cout << "ERROR: Could not load " << fileName << ".\n";
@@ -42,3 +50,8 @@ std::string readFile(const char* fileName) {
 
     return source;
 }
+
+double currentTime() {
+    return std::chrono::duration_cast<std::chrono::duration<double>>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
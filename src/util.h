@@ -29,4 +29,7 @@
 
 std::string readFile(const char* fileName);
 
+// seconds on a monotonic clock, comparable between threads
+double currentTime();
+
 #endif  // SRC_UTIL_H_